@@ -1,4 +1,7 @@
+#include <string.h>
+
 #include "abuff.h"
+#include "mem.h"
 
 void ab_append(struct abuf *ab, const char *s, int len)
 {
@@ -8,9 +11,11 @@ void ab_append(struct abuf *ab, const char *s, int len)
 	memcpy(&new[ab->len], s, len);
 	ab->b = new;
 	ab->len += len;
+	mem_add(MEM_OUTPUT, len);
 }
 
 void ab_free(struct abuf *ab)
 {
 	free(ab->b);
+	mem_add(MEM_OUTPUT, -ab->len);
 }
@@ -0,0 +1,523 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+
+#include "editor.h"
+#include "event.h"
+#include "pager.h"
+#include "undo.h"
+
+// Headless benchmark of the editor core. Generates a few corpora, drives
+// the buffer through open, insert, delete, search, highlight, render and
+// save, and reports throughput, latency percentiles and allocations.
+//
+//   yolo-bench [-d dir] [-l log_mb] [-n ops] [-o results] [-c baseline]
+//
+// -o writes the results in a line format that -c reads back, so runs of two
+// commits can be compared: make bench BENCH_FLAGS="-o new.txt -c old.txt"
+
+#define BENCH_DEFAULT_DIR "/tmp/yolo-bench"
+#define BENCH_DEFAULT_LOG_MB 1024
+#define BENCH_DEFAULT_OPS 2000
+#define BENCH_WIDE_MB 80
+#define BENCH_MAX_RESULTS 64
+
+// allocations are counted by wrapping the allocator at link time (see Makefile)
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+static long long allocs;
+static long long alloc_bytes;
+
+void* __wrap_malloc(size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&alloc_bytes, n * size, __ATOMIC_RELAXED);
+	return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* p, size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+	return __real_realloc(p, size);
+}
+
+struct result
+{
+	char corpus[16];
+	char op[16];
+	int n;
+	double total_ms;
+	double p50_us, p90_us, p99_us, max_us;
+	double mb_s; // 0 when the op has no byte count
+	long long allocs;
+	long long alloc_bytes;
+};
+
+static struct
+{
+	const char* dir;
+	int log_mb;
+	int ops;
+	struct result results[BENCH_MAX_RESULTS];
+	int nresults;
+
+	// the op being measured
+	const char* corpus;
+	long long* lat; // ns per sample
+	int nlat;
+	long long start_allocs;
+	long long start_alloc_bytes;
+	long long start;
+} B;
+
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static unsigned int seed = 1;
+
+static unsigned int rnd()
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) & 0xffffff;
+}
+
+// 48 random bits, enough to index rows and columns of the big corpora
+static long long rnd_wide()
+{
+	return (long long) rnd() << 24 | rnd();
+}
+
+// corpora
+
+static const char* small_lines[] =
+{
+	"#include <stdio.h>",
+	"",
+	"/* parses one record of the input */",
+	"static int parse_record(const char* s, struct record* out)",
+	"{",
+	"\tint n = 0;",
+	"\tfor (int i = 0; s[i]; ++i)",
+	"\t{",
+	"\t\tif (s[i] == ',') ++n; // field separator",
+	"\t\telse if (s[i] == '\"') return -1;",
+	"\t}",
+	"\tout->fields = n + 1;",
+	"\tprintf(\"%d fields in \\\"%s\\\"\\n\", n, s);",
+	"\treturn 0x1f & n;",
+	"}",
+};
+
+typedef void (*generator)(FILE* fp, long long size);
+
+static void gen_small(FILE* fp, long long size)
+{
+	long long written = 0;
+	int n = sizeof(small_lines) / sizeof(small_lines[0]);
+	for (int i = 0; written < size; ++i)
+		written += fprintf(fp, "%s\n", small_lines[i % n]);
+}
+
+static void gen_log(FILE* fp, long long size)
+{
+	static const char* levels[] = { "INFO", "INFO", "INFO", "WARN", "DEBUG", "ERROR" };
+	long long written = 0;
+	for (long long i = 0; written < size; ++i)
+	{
+		written += fprintf(fp, "2026-10-19T%02lld:%02lld:%02lld.%03lld %-5s worker-%02u request id=%lld path=/api/v1/items/%u latency_ms=%u\n",
+			(i / 3600000) % 24, (i / 60000) % 60, (i / 1000) % 60, i % 1000,
+			levels[rnd() % 6], rnd() % 32, i, rnd() % 100000, rnd() % 500);
+	}
+}
+
+static void gen_wide(FILE* fp, long long size)
+{
+	long long written = fprintf(fp, "[");
+	for (long long i = 0; written < size; ++i)
+		written += fprintf(fp, "{\"id\": %lld, \"name\": \"item%lld\", \"tags\": [\"a\", \"b\"], \"v\": %u.5}, ", i, i, rnd() % 100000);
+	fprintf(fp, "{}]\n");
+}
+
+static void gen_comment(FILE* fp, long long size)
+{
+	long long written = fprintf(fp, "/*\n");
+	for (long long i = 0; written < size; ++i)
+		written += fprintf(fp, " * %lld: int x = \"not code\"; // still the same comment\n", i);
+	fprintf(fp, " */\nint main() { return 0; }\n");
+}
+
+// source with UTF-8 in its comments and strings, every row takes the
+// non-ASCII path
+static void gen_utf8(FILE* fp, long long size)
+{
+	long long written = 0;
+	for (long long i = 0; written < size; ++i)
+	{
+		written += fprintf(fp, "\tlabel(%lld, \"grüße, naïve café\"); // 日本語のコメント %u 👍🏽\n",
+			i, rnd() % 100000);
+	}
+}
+
+// writes the corpus once, later runs reuse it when the size matches
+static char* corpus(const char* name, generator gen, long long size)
+{
+	char* path = malloc(strlen(B.dir) + strlen(name) + 2);
+	sprintf(path, "%s/%s", B.dir, name);
+
+	struct stat st;
+	if (stat(path, &st) == 0 && st.st_size >= size && st.st_size < size + (1 << 20)) return path;
+
+	fprintf(stderr, "generating %s (%lld MB)\n", path, size >> 20);
+	FILE* fp = fopen(path, "w");
+	if (!fp) die(path);
+	seed = 1;
+	gen(fp, size);
+	if (fclose(fp) != 0) die(path);
+	return path;
+}
+
+// measurement
+
+static int cmp_ll(const void* a, const void* b)
+{
+	long long x = *(const long long*) a, y = *(const long long*) b;
+	return (x > y) - (x < y);
+}
+
+static void op_begin(int n)
+{
+	B.lat = realloc(B.lat, sizeof(long long) * (n > 0 ? n : 1));
+	B.nlat = 0;
+	B.start_allocs = allocs;
+	B.start_alloc_bytes = alloc_bytes;
+	B.start = now_ns();
+}
+
+static void sample(long long t0)
+{
+	B.lat[B.nlat++] = now_ns() - t0;
+}
+
+static void op_end(const char* op, long long bytes)
+{
+	long long total = now_ns() - B.start;
+	if (B.nresults == BENCH_MAX_RESULTS) return;
+
+	struct result* r = &B.results[B.nresults++];
+	memset(r, 0, sizeof(*r));
+	snprintf(r->corpus, sizeof(r->corpus), "%s", B.corpus);
+	snprintf(r->op, sizeof(r->op), "%s", op);
+	r->n = B.nlat;
+	r->total_ms = total / 1e6;
+	r->allocs = allocs - B.start_allocs;
+	r->alloc_bytes = alloc_bytes - B.start_alloc_bytes;
+
+	long long measured = 0;
+	for (int i = 0; i < B.nlat; ++i) measured += B.lat[i];
+	if (bytes > 0 && measured > 0) r->mb_s = (bytes / 1048576.0) / (measured / 1e9);
+
+	if (B.nlat > 0)
+	{
+		qsort(B.lat, B.nlat, sizeof(long long), cmp_ll);
+		r->p50_us = B.lat[B.nlat / 2] / 1e3;
+		r->p90_us = B.lat[(long long) B.nlat * 90 / 100] / 1e3;
+		r->p99_us = B.lat[(long long) B.nlat * 99 / 100] / 1e3;
+		r->max_us = B.lat[B.nlat - 1] / 1e3;
+	}
+
+	printf("%-8s %-10s %6d %10.1f %10.1f %10.1f %10.1f %9.1f %10lld %9.1f\n",
+		r->corpus, r->op, r->n, r->p50_us, r->p90_us, r->p99_us, r->max_us,
+		r->mb_s, r->allocs, r->alloc_bytes / 1048576.0);
+	fflush(stdout);
+}
+
+// a random spot in the buffer, on a row that has text when there is one
+static void place_cursor()
+{
+	E.cy = E.numrows > 0 ? rnd_wide() % E.numrows : 0;
+	erow* row = E.cy < E.numrows ? editor_row_at(E.cy) : NULL;
+	E.cx = row && row->size > 0 ? rnd_wide() % row->size : 0;
+}
+
+// the benchmark
+
+static void bench_open(const char* path)
+{
+	struct stat st;
+	if (stat(path, &st) == -1) die(path);
+
+	op_begin(1);
+	long long t0 = now_ns();
+	editor_open((char*) path);
+	// a paged buffer is only editable once it is indexed
+	while (E.paged && pager_progress() >= 0) event_wait(10);
+	sample(t0);
+	op_end("open", st.st_size);
+}
+
+static void bench_insert()
+{
+	op_begin(B.ops);
+	for (int i = 0; i < B.ops; ++i)
+	{
+		place_cursor();
+		long long t0 = now_ns();
+		undo_begin_group(1);
+		insert_char('a' + i % 26);
+		sample(t0);
+	}
+	op_end("insert", 0);
+}
+
+static void bench_delete()
+{
+	op_begin(B.ops);
+	for (int i = 0; i < B.ops; ++i)
+	{
+		place_cursor();
+		if (E.cx == 0 && E.cy > 0) ++E.cx; // keep rows from being joined
+		long long t0 = now_ns();
+		undo_begin_group(0);
+		del_char();
+		sample(t0);
+	}
+	op_end("delete", 0);
+}
+
+static void bench_search()
+{
+	long long bytes = E.file_size;
+	static const char* hits[] = { "return", "id=4242", "item77", "still" };
+	int n = 8;
+	op_begin(n);
+	int cx, rx;
+	// misses scan the whole buffer
+	for (int i = 0; i < n / 2; ++i)
+	{
+		long long t0 = now_ns();
+		editor_search("no such text here", -1, 1, &cx, &rx);
+		sample(t0);
+	}
+	op_end("search", bytes * (n / 2));
+
+	op_begin(n);
+	for (int i = 0; i < n; ++i)
+	{
+		int from = E.numrows > 0 ? rnd_wide() % E.numrows : 0;
+		long long t0 = now_ns();
+		editor_search(hits[i % 4], from, 1, &cx, &rx);
+		sample(t0);
+	}
+	op_end("find", 0);
+}
+
+// opening and closing a comment on the first row re-highlights what follows
+static void bench_highlight()
+{
+	int n = 20;
+	erow* first = E.numrows > 0 ? editor_row_at(0) : NULL;
+	int opened = first && first->size >= 2 && !strncmp(first->chars, "/*", 2);
+
+	op_begin(n);
+	for (int i = 0; i < n; ++i)
+	{
+		E.cy = 0;
+		E.cx = 0;
+		long long t0 = now_ns();
+		undo_begin_group(0);
+		if ((i % 2 == 0) != opened)
+		{
+			insert_text("/*", 2);
+		}
+		else
+		{
+			E.cx = 2;
+			del_char();
+			del_char();
+		}
+		sample(t0);
+	}
+	op_end("highlight", 0);
+}
+
+// a word replaced everywhere by a longer one and back, a pass over the
+// buffer each, about one line in six of the log holds ERROR
+static void bench_replace()
+{
+	static const char* words[][2] = {
+		{ "return", "return_value" }, { "ERROR", "FAILURE" }, { "item", "item_name" }, { "still", "still there" }
+	};
+	int n = 8;
+	int rows;
+	op_begin(n);
+	for (int i = 0; i < n; ++i)
+	{
+		const char** w = words[i / 2];
+		long long t0 = now_ns();
+		undo_begin_group(0);
+		editor_replace_all(w[i % 2], w[1 - i % 2], &rows, 0);
+		sample(t0);
+	}
+	op_end("replace", E.file_size * n);
+}
+
+static void bench_render()
+{
+	int n = B.ops / 4;
+	long long bytes = 0;
+	op_begin(n);
+	for (int i = 0; i < n; ++i)
+	{
+		place_cursor();
+		long long t0 = now_ns();
+		struct abuf ab = ABUF_INIT;
+		editor_scroll();
+		draw_rows(&ab);
+		draw_status_bar(&ab);
+		draw_message_bar(&ab);
+		sample(t0);
+		bytes += ab.len;
+		ab_free(&ab);
+	}
+	op_end("render", bytes);
+}
+
+static void bench_save(const char* name)
+{
+	char* path = malloc(strlen(B.dir) + strlen(name) + 8);
+	sprintf(path, "%s/saved-%s", B.dir, name);
+	free(E.filename);
+	E.filename = path; // owned by E from here on
+
+	op_begin(1);
+	long long t0 = now_ns();
+	long long written = editor_write_file();
+	sample(t0);
+	if (written == -1) die("save");
+	op_end("save", written);
+	unlink(path);
+}
+
+static void run(const char* name, const char* file, generator gen, long long size)
+{
+	char* path = corpus(file, gen, size);
+	B.corpus = name;
+	seed = 42;
+
+	bench_open(path);
+	bench_insert();
+	bench_delete();
+	bench_search();
+	bench_highlight();
+	bench_replace();
+	bench_render();
+	bench_save(file);
+	editor_close();
+	free(path);
+}
+
+// results files
+
+static void write_results(const char* path)
+{
+	FILE* fp = fopen(path, "w");
+	if (!fp) die(path);
+	fprintf(fp, "# corpus op n total_ms p50_us p90_us p99_us max_us mb_s allocs alloc_bytes\n");
+	for (int i = 0; i < B.nresults; ++i)
+	{
+		struct result* r = &B.results[i];
+		fprintf(fp, "%s %s %d %.3f %.3f %.3f %.3f %.3f %.3f %lld %lld\n",
+			r->corpus, r->op, r->n, r->total_ms, r->p50_us, r->p90_us, r->p99_us,
+			r->max_us, r->mb_s, r->allocs, r->alloc_bytes);
+	}
+	fclose(fp);
+}
+
+static double change(double now, double before)
+{
+	return before != 0 ? (now - before) * 100 / before : 0;
+}
+
+static void compare(const char* path)
+{
+	FILE* fp = fopen(path, "r");
+	if (!fp) die(path);
+
+	printf("\nagainst %s (%% change, negative latency and positive MB/s are better)\n", path);
+	printf("%-8s %-10s %10s %10s %10s %10s\n", "corpus", "op", "p50", "p99", "MB/s", "allocs");
+
+	char line[512];
+	struct result old;
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (line[0] == '#') continue;
+		if (sscanf(line, "%15s %15s %d %lf %lf %lf %lf %lf %lf %lld %lld",
+			old.corpus, old.op, &old.n, &old.total_ms, &old.p50_us, &old.p90_us,
+			&old.p99_us, &old.max_us, &old.mb_s, &old.allocs, &old.alloc_bytes) != 11)
+			continue;
+
+		for (int i = 0; i < B.nresults; ++i)
+		{
+			struct result* r = &B.results[i];
+			if (strcmp(r->corpus, old.corpus) || strcmp(r->op, old.op)) continue;
+			printf("%-8s %-10s %+9.1f%% %+9.1f%% %+9.1f%% %+9.1f%%\n", r->corpus, r->op,
+				change(r->p50_us, old.p50_us), change(r->p99_us, old.p99_us),
+				change(r->mb_s, old.mb_s), change(r->allocs, old.allocs));
+		}
+	}
+	fclose(fp);
+}
+
+int main(int argc, char** argv)
+{
+	const char* out = NULL;
+	const char* base = NULL;
+	B.dir = BENCH_DEFAULT_DIR;
+	B.log_mb = BENCH_DEFAULT_LOG_MB;
+	B.ops = BENCH_DEFAULT_OPS;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-d")) B.dir = argv[i + 1];
+		else if (!strcmp(argv[i], "-l")) B.log_mb = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-n")) B.ops = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-o")) out = argv[i + 1];
+		else if (!strcmp(argv[i], "-c")) base = argv[i + 1];
+	}
+	if (argc % 2 == 0)
+	{
+		fprintf(stderr, "usage: %s [-d dir] [-l log_mb] [-n ops] [-o results] [-c baseline]\n", argv[0]);
+		return 2;
+	}
+	if (B.ops < 4) B.ops = 4;
+	mkdir(B.dir, 0755);
+
+	editor_core_init(48, 160);
+
+	printf("%-8s %-10s %6s %10s %10s %10s %10s %9s %10s %9s\n",
+		"corpus", "op", "n", "p50 us", "p90 us", "p99 us", "max us", "MB/s", "allocs", "alloc MB");
+	run("small", "small.c", gen_small, 256 * 1024);
+	run("log", "big.log", gen_log, (long long) B.log_mb << 20);
+	run("wide", "wide.json", gen_wide, (long long) BENCH_WIDE_MB << 20);
+	run("comment", "comment.c", gen_comment, 16 << 20);
+	run("utf8", "utf8.c", gen_utf8, 16 << 20);
+
+	if (out) write_results(out);
+	if (base) compare(base);
+	return 0;
+}
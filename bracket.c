@@ -0,0 +1,295 @@
+#include "bracket.h"
+#include "mem.h"
+
+struct brackets
+{
+	int closes[BRACKET_KINDS]; // closing brackets with no match before them
+	int opens[BRACKET_KINDS]; // opening brackets left open at the end
+	int stale; // long-line and unlexed rows below that still need a count
+};
+
+static struct
+{
+	struct brackets* t; // t[1] is the root, the leaf of row i is t[cap + i]
+	int cap; // a power of two
+	int n;
+	int dirty_from; // first leaf whose ancestors need summing, -1 for none
+} B = { NULL, 0, 0, -1 };
+
+static struct brackets* leaf(int at)
+{
+	return &B.t[B.cap + at];
+}
+
+// a followed by b, the opening brackets of a match b's closing ones first
+static void combine(struct brackets* out, const struct brackets* a, const struct brackets* b)
+{
+	for (int k = 0; k < BRACKET_KINDS; ++k)
+	{
+		int matched = a->opens[k] < b->closes[k] ? a->opens[k] : b->closes[k];
+		out->closes[k] = a->closes[k] + b->closes[k] - matched;
+		out->opens[k] = a->opens[k] - matched + b->opens[k];
+	}
+	out->stale = a->stale + b->stale;
+}
+
+static int kind_of(char c, int* open)
+{
+	*open = (c == '(' || c == '[' || c == '{');
+	switch (c)
+	{
+		case '(': case ')': return BRACKET_PAREN;
+		case '[': case ']': return BRACKET_SQUARE;
+		case '{': case '}': return BRACKET_CURLY;
+		default: return -1;
+	}
+}
+
+static int is_code(unsigned char hl)
+{
+	return hl != HL_COMMENT && hl != HL_MLCOMMENT && hl != HL_STRING;
+}
+
+static void summarize(const char* s, const unsigned char* hl, int len, struct brackets* b)
+{
+	memset(b, 0, sizeof(*b));
+	for (int i = 0; i < len; ++i)
+	{
+		int open;
+		int k = kind_of(s[i], &open);
+		if (k == -1 || !is_code(hl[i])) continue;
+		if (open) ++b->opens[k];
+		else if (b->opens[k] > 0) --b->opens[k];
+		else ++b->closes[k];
+	}
+}
+
+static void pull_up(int at)
+{
+	for (int p = (B.cap + at) / 2; p >= 1; p /= 2)
+		combine(&B.t[p], &B.t[2 * p], &B.t[2 * p + 1]);
+}
+
+static void mark_dirty(int at)
+{
+	if (B.dirty_from == -1 || at < B.dirty_from) B.dirty_from = at;
+}
+
+// sums the nodes above the leaves from dirty_from on, level by level
+static void rebuild()
+{
+	if (B.dirty_from == -1) return;
+	int lo = (B.cap + B.dirty_from) / 2;
+	int hi = (2 * B.cap - 1) / 2;
+	while (lo >= 1)
+	{
+		for (int p = lo; p <= hi; ++p) combine(&B.t[p], &B.t[2 * p], &B.t[2 * p + 1]);
+		lo /= 2;
+		hi /= 2;
+	}
+	B.dirty_from = -1;
+}
+
+static void reserve(int n)
+{
+	if (n <= B.cap) return;
+	int cap = B.cap ? B.cap : 1024;
+	while (cap < n) cap *= 2;
+
+	struct brackets* t = calloc(2 * cap, sizeof(struct brackets));
+	if (B.t) memcpy(&t[cap], leaf(0), sizeof(struct brackets) * B.n);
+	mem_add(MEM_ROWS, (long long) sizeof(struct brackets) * 2 * (cap - B.cap));
+	free(B.t);
+	B.t = t;
+	B.cap = cap;
+	B.dirty_from = 0;
+}
+
+// lexes the whole of a row's text, long lines included, into hl
+static void lex_row(erow* row, unsigned char* hl)
+{
+	struct lex_state st = editor_syntax_start(row);
+	editor_syntax_lex(row->chars, row->size, hl, &st);
+}
+
+static void count_stale(int at)
+{
+	erow* row = editor_row_at(at);
+	unsigned char* hl = malloc(row->size + 1);
+	lex_row(row, hl);
+	summarize(row->chars, hl, row->size, leaf(at));
+	free(hl);
+	pull_up(at);
+}
+
+// brings the tree up to date before a search
+static void refresh()
+{
+	rebuild();
+	while (B.t[1].stale)
+	{
+		int p = 1;
+		while (p < B.cap) p = B.t[2 * p].stale ? 2 * p : 2 * p + 1;
+		count_stale(p - B.cap);
+	}
+}
+
+// called by the syntax pass once a row is lexed
+void bracket_update_row(erow* row)
+{
+	if (E.paged || row->idx >= B.n) return;
+	struct brackets* b = leaf(row->idx);
+	if (row->wide)
+	{
+		if (b->stale) return;
+		memset(b, 0, sizeof(*b));
+		b->stale = 1;
+	}
+	else
+	{
+		summarize(row->render, row->hl, row->rsize, b);
+	}
+	if (B.dirty_from == -1 || row->idx < B.dirty_from) pull_up(row->idx);
+}
+
+void bracket_insert_rows(int at, int n)
+{
+	if (E.paged) return;
+	reserve(B.n + n);
+	memmove(leaf(at + n), leaf(at), sizeof(struct brackets) * (B.n - at));
+	memset(leaf(at), 0, sizeof(struct brackets) * n);
+	B.n += n;
+	mark_dirty(at);
+}
+
+// rows inserted without being lexed, counted on the next search
+void bracket_stale_rows(int at, int n)
+{
+	if (E.paged) return;
+	for (int i = at; i < at + n; ++i)
+	{
+		memset(leaf(i), 0, sizeof(struct brackets));
+		leaf(i)->stale = 1;
+	}
+	mark_dirty(at);
+}
+
+void bracket_delete_rows(int at, int n)
+{
+	if (E.paged) return;
+	memmove(leaf(at), leaf(at + n), sizeof(struct brackets) * (B.n - at - n));
+	memset(leaf(B.n - n), 0, sizeof(struct brackets) * n);
+	B.n -= n;
+	mark_dirty(at);
+}
+
+void bracket_clear()
+{
+	mem_add(MEM_ROWS, -(long long) sizeof(struct brackets) * 2 * B.cap);
+	free(B.t);
+	B.t = NULL;
+	B.cap = B.n = 0;
+	B.dirty_from = -1;
+}
+
+// first row from `from` on where the closing bracket that brings `need`
+// open ones down to none is, leaving *need as it stands at that row
+static int find_forward(int p, int lo, int hi, int from, int k, int* need)
+{
+	if (hi <= from) return -1;
+	if (lo >= from && B.t[p].closes[k] < *need)
+	{
+		*need += B.t[p].opens[k] - B.t[p].closes[k];
+		return -1;
+	}
+	if (p >= B.cap) return lo;
+	int mid = (lo + hi) / 2;
+	int at = find_forward(2 * p, lo, mid, from, k, need);
+	return at != -1 ? at : find_forward(2 * p + 1, mid, hi, from, k, need);
+}
+
+// the same going up from the row above `to`
+static int find_backward(int p, int lo, int hi, int to, int k, int* need)
+{
+	if (lo >= to) return -1;
+	if (hi <= to && B.t[p].opens[k] < *need)
+	{
+		*need += B.t[p].closes[k] - B.t[p].opens[k];
+		return -1;
+	}
+	if (p >= B.cap) return lo;
+	int mid = (lo + hi) / 2;
+	int at = find_backward(2 * p + 1, mid, hi, to, k, need);
+	return at != -1 ? at : find_backward(2 * p, lo, mid, to, k, need);
+}
+
+static int scan_forward(const char* s, const unsigned char* hl, int from, int to, int k, int* need)
+{
+	for (int i = from; i < to; ++i)
+	{
+		int open;
+		if (kind_of(s[i], &open) != k || !is_code(hl[i])) continue;
+		if (open) ++*need;
+		else if (--*need == 0) return i;
+	}
+	return -1;
+}
+
+static int scan_backward(const char* s, const unsigned char* hl, int to, int k, int* need)
+{
+	for (int i = to - 1; i >= 0; --i)
+	{
+		int open;
+		if (kind_of(s[i], &open) != k || !is_code(hl[i])) continue;
+		if (!open) ++*need;
+		else if (--*need == 0) return i;
+	}
+	return -1;
+}
+
+// finds the bracket matching the one at cx of row `at`, or the one just
+// before cx. Returns 1 with its position, 0 when it has no match and -1
+// when there is no bracket there.
+int bracket_match(int at, int cx, int* match_row, int* match_cx)
+{
+	if (E.paged || at >= E.numrows) return -1;
+	refresh();
+
+	erow* row = editor_row_at(at);
+	unsigned char* hl = malloc(row->size + 1);
+	lex_row(row, hl);
+
+	int open, k = -1;
+	int pos = cx;
+	if (pos < row->size) k = kind_of(row->chars[pos], &open);
+	if ((k == -1 || !is_code(hl[pos])) && pos > 0)
+	{
+		pos = cx - 1;
+		k = kind_of(row->chars[pos], &open);
+	}
+	if (k == -1 || !is_code(hl[pos]))
+	{
+		free(hl);
+		return -1;
+	}
+
+	int need = 1;
+	int found = open ? scan_forward(row->chars, hl, pos + 1, row->size, k, &need)
+		: scan_backward(row->chars, hl, pos, k, &need);
+	free(hl);
+	if (found == -1)
+	{
+		at = open ? find_forward(1, 0, B.cap, at + 1, k, &need) : find_backward(1, 0, B.cap, at, k, &need);
+		if (at == -1 || at >= E.numrows) return 0;
+		row = editor_row_at(at);
+		hl = malloc(row->size + 1);
+		lex_row(row, hl);
+		found = open ? scan_forward(row->chars, hl, 0, row->size, k, &need)
+			: scan_backward(row->chars, hl, row->size, k, &need);
+		free(hl);
+		if (found == -1) return 0;
+	}
+	*match_row = at;
+	*match_cx = found;
+	return 1;
+}
@@ -0,0 +1,31 @@
+#ifndef BRACKET_H_
+#define BRACKET_H_
+
+#include "editor.h"
+
+// Bracket index. The syntax pass sums up each row's (), [] and {} outside of
+// comments and strings as the closing brackets with no match on the row and
+// the opening ones still open at its end. A segment tree over the rows
+// combines those, so the row holding a match is found by walking down the
+// tree in O(log n). An edit within a row updates its path right away, rows
+// inserted or deleted shift the leaves and the nodes above them are summed
+// again on the next search. Long-line rows are counted on the next search
+// too, their hl only covers a window, and so are rows loaded without being
+// lexed. Not kept for paged files.
+
+enum bracket_kind
+{
+	BRACKET_PAREN,
+	BRACKET_SQUARE,
+	BRACKET_CURLY,
+	BRACKET_KINDS
+};
+
+void bracket_update_row(erow* row);
+void bracket_insert_rows(int at, int n);
+void bracket_stale_rows(int at, int n);
+void bracket_delete_rows(int at, int n);
+void bracket_clear();
+int bracket_match(int at, int cx, int* match_row, int* match_cx);
+
+#endif
@@ -0,0 +1,951 @@
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+
+#include "bracket.h"
+#include "clip.h"
+#include "cold.h"
+#include "complete.h"
+#include "diff.h"
+#include "editor.h"
+#include "event.h"
+#include "fold.h"
+#include "follow.h"
+#include "journal.h"
+#include "longline.h"
+#include "mem.h"
+#include "pager.h"
+#include "rowmem.h"
+#include "session.h"
+#include "trace.h"
+#include "undo.h"
+#include "utf8.h"
+
+// The buffer: rows, edits at the cursor, file i/o and search. Nothing here
+// touches the terminal, so the editor core can run headless (see bench.c).
+
+struct editor_config E;
+
+static void (*die_hook)();
+
+// sets up the editor state for a screen of rows x cols, without a terminal
+void editor_core_init(int rows, int cols)
+{
+	E.cx = 0;
+	E.cy = 0;
+	E.rx = 0;
+	E.rowoff = 0;
+	E.coloff = 0;
+	E.numrows = 0;
+	E.row_capacity = 0;
+	E.row = NULL;
+	E.paged = 0;
+	E.following = 0;
+	E.file_size = 0;
+	E.screen_rows = rows;
+	E.screen_cols = cols;
+	E.filename = NULL;
+	E.status_msg[0] = '\0';
+	E.status_msg_time = 0;
+	E.is_dirty = 0;
+	E.syntax = NULL;
+	E.hud = NULL;
+
+	event_init();
+	rowmem_init();
+	cold_init();
+	mem_init();
+	trace_init();
+}
+
+// called by die before it reports, the front end restores the terminal there
+void editor_on_die(void (*callback)())
+{
+	die_hook = callback;
+}
+
+void die(const char *s)
+{
+	if (die_hook) die_hook();
+	perror(s);
+	journal_flush();
+	exit(1);
+}
+
+void set_status_message(const char* fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(E.status_msg, sizeof(E.status_msg), fmt, ap);
+	va_end(ap);
+	E.status_msg_time = time(NULL);
+	event_redraw();
+	event_timer(STATUS_MSG_TIMEOUT * 1000, event_redraw);
+}
+
+// row operation
+
+erow* editor_row_at(int at)
+{
+	if (E.paged) return pager_row(at);
+	erow* row = &E.row[at];
+	if (row->cold) cold_thaw(row);
+	else if (!row->render) editor_update_row(row); // stripped to fit a memory budget
+	row->last_use = E.row_clock;
+	return row;
+}
+
+// like editor_row_at but never loads a row that is not resident or laid out
+erow* editor_row_peek(int at)
+{
+	if (E.paged) return pager_row_peek(at);
+	return E.row[at].render ? &E.row[at] : NULL;
+}
+
+// row that is about to be edited, NULL when the buffer can't be edited yet
+erow* editor_row_mut(int at)
+{
+	if (E.paged) return pager_row_mut(at);
+	return editor_row_at(at);
+}
+
+int editor_row_cx_to_rx(erow *row, int cx)
+{
+	if (row->wide) return longline_cx_to_rx(row, cx);
+	if (row->cols) return utf8_cx_to_rx(row, cx);
+
+	int i, rx = 0;
+
+	for (i=0; i < cx; ++i)
+	{
+		if (row->chars[i] == '\t')
+			rx += (TAB_LEN - 1) - (rx % TAB_LEN);
+		++rx;
+	}
+	return rx;
+}
+
+int editor_row_rx_to_cx(erow* row, int rx)
+{
+	if (row->wide) return longline_rx_to_cx(row, rx);
+	if (row->cols) return utf8_rx_to_cx(row, rx);
+
+	int cur_rx = 0;
+	int cx;
+
+	for (cx = 0; cx < row->size; ++cx)
+	{
+		if (row->chars[cx] == '\t')
+			cur_rx += (TAB_LEN - 1) - (cur_rx % TAB_LEN);
+		++cur_rx;
+
+		if (cur_rx > rx) return cx;
+	}
+	return cx;
+}
+
+// lays out render from chars, hl is left to editor_update_syntax. A row
+// that isn't pure ASCII is laid out by utf8_render along with its stops.
+static void render_row(erow* row)
+{
+	int tabs = 0;
+	int j;
+	for (j=0; j < row->size; ++j)
+		if (row->chars[j] == '\t') tabs++;
+
+	rowmem_layout(row, row->size + (tabs*(TAB_LEN-1))); // row->size already count 1 for each tab
+	if (!utf8_is_ascii(row->chars, row->size))
+	{
+		row->rsize = utf8_render(row);
+		return;
+	}
+	utf8_free(row);
+
+	int idx = 0;
+	for (j = 0; j < row->size; ++j)
+	{
+		if (row->chars[j] == '\t')
+		{
+			row->render[idx++] = ' ';
+			while (idx % TAB_LEN != 0) row->render[idx++] = ' '; // the next tab stop is the first column multiple of TAB_LEN
+		}
+		else
+		{
+			row->render[idx++] = row->chars[j];
+		}
+	}
+
+	row->render[idx] = '\0';
+	row->rsize = idx;
+}
+
+void editor_update_row(erow* row)
+{
+	long long span = trace_begin();
+	if (!(row->wide || row->size >= LONGLINE_MIN) || !longline_update(row))
+	{
+		render_row(row);
+		editor_update_syntax(row);
+	}
+	trace_end("editor_update_row", span);
+}
+
+// like editor_row_peek, but a stripped row gets its render back so that a
+// change of comment state can be carried through it
+erow* editor_row_lexable(int at)
+{
+	if (E.paged) return pager_row_peek(at);
+	erow* row = &E.row[at];
+	if (!row->render && !row->cold) render_row(row);
+	return row->render ? row : NULL;
+}
+
+// the row at `at` has new rows above it, which may have changed the comment
+// state it starts in
+static void relex_row(int at)
+{
+	if (at >= E.numrows) return;
+	erow* row = editor_row_lexable(at);
+	if (row) editor_update_syntax(row);
+}
+
+// rows inserted while set are left for editor_row_at to lay out, their
+// comment states come from the session record
+static int unlaid;
+
+// inserts n rows at `at` with a single move of the rows below them
+void editor_insert_rows(int at, int n, char** lines, size_t* lens)
+{
+	if (at < 0 || at > E.numrows || n <= 0) return;
+	if (E.paged)
+	{
+		int i;
+		for (i = 0; i < n; ++i)
+		{
+			if (!pager_insert_row(at + i, lines[i], lens[i])) break;
+			E.is_dirty = 1;
+		}
+		undo_record_insert_rows(at, i, lines, lens);
+		journal_insert_rows(at, i, lines, lens);
+		fold_insert_rows(at, i);
+		return;
+	}
+	undo_record_insert_rows(at, n, lines, lens);
+	journal_insert_rows(at, n, lines, lens);
+	fold_insert_rows(at, n);
+	bracket_insert_rows(at, n);
+	if (E.sel_active && E.sel_cy >= at) E.sel_cy += n; // the mark stays on its text
+
+	if (E.numrows + n > E.row_capacity)
+	{
+		mem_add(MEM_ROWS, -(long long) sizeof(erow) * E.row_capacity);
+		if (E.row_capacity == 0) E.row_capacity = 64;
+		while (E.numrows + n > E.row_capacity) E.row_capacity *= 2;
+		E.row = realloc(E.row, sizeof(erow) * E.row_capacity);
+		mem_add(MEM_ROWS, (long long) sizeof(erow) * E.row_capacity);
+	}
+	memmove(&E.row[at + n], &E.row[at], sizeof(erow) * (E.numrows - at));
+	for (int j = at + n; j < E.numrows + n; ++j) E.row[j].idx += n;
+	E.numrows += n;
+
+	for (int i = 0; i < n; ++i)
+	{
+		erow* row = &E.row[at + i];
+		row->idx = at + i;
+
+		row->chars = NULL;
+		row->cap = 0;
+		row->pin = 0;
+		if (unlaid) rowmem_set_chars(row, lines[i], lens[i]);
+		else rowmem_set_text(row, lines[i], lens[i]);
+		row->hl_open_comment = 0;
+		row->cold = NULL;
+		row->wide = NULL;
+		row->cols = NULL;
+		row->last_use = E.row_clock;
+		if (!unlaid) editor_update_row(row);
+	}
+	if (unlaid) bracket_stale_rows(at, n);
+	complete_insert_rows(at, n);
+	diff_insert_rows(at, n);
+	relex_row(at + n);
+
+	E.is_dirty = 1;
+}
+
+void editor_insert_row(int at, char* s, size_t len)
+{
+	editor_insert_rows(at, 1, &s, &len);
+}
+
+void editor_free_row(erow* row)
+{
+	cold_release(row);
+	longline_free(row);
+	rowmem_free(row);
+}
+
+// removes n rows starting at `at` with a single move of the rows below them
+void editor_del_rows(int at, int n)
+{
+	if (at < 0 || n <= 0 || at + n > E.numrows) return;
+	if (E.paged)
+	{
+		if (pager_progress() < 0)
+		{
+			undo_record_delete_rows(at, n);
+			journal_delete_rows(at, n);
+		}
+		for (int i = 0; i < n; ++i)
+			if (pager_del_row(at)) E.is_dirty = 1;
+		fold_delete_rows(at, n);
+		return;
+	}
+	undo_record_delete_rows(at, n);
+	journal_delete_rows(at, n);
+	fold_delete_rows(at, n);
+	bracket_delete_rows(at, n);
+	if (E.sel_active && E.sel_cy >= at + n) E.sel_cy -= n;
+	else if (E.sel_active && E.sel_cy >= at)
+	{
+		// the row of the mark is gone, it moves to the start of the rows after it
+		E.sel_cy = at;
+		E.sel_cx = 0;
+	}
+	complete_delete_rows(at, n);
+	diff_delete_rows(at, n);
+	for (int i = 0; i < n; ++i) editor_free_row(&E.row[at + i]);
+	memmove(&E.row[at], &E.row[at + n], sizeof(erow) * (E.numrows - at - n));
+	E.numrows -= n;
+	for (int j = at; j < E.numrows; ++j) E.row[j].idx -= n;
+	relex_row(at);
+	E.is_dirty = 1;
+}
+
+void editor_del_row(int at)
+{
+	editor_del_rows(at, 1);
+}
+
+void editor_row_insert_char(erow* row, int at, int c)
+{
+	if (at < 0 || at > row->size) at = row->size;
+	char ch = c;
+	undo_record_insert_text(row->idx, at, &ch, 1);
+	journal_insert_text(row->idx, at, &ch, 1);
+	complete_edit_begin(row, at, 0);
+	rowmem_reserve(row, row->size + 1);
+	memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+	++row->size;
+	row->chars[at] = c;
+	complete_edit_end(row);
+	diff_edit_row(row->idx);
+	longline_edit(row, at, 0, 1);
+	editor_update_row(row);
+	E.is_dirty = 1;
+}
+
+void editor_row_insert_string(erow* row, int at, char* s, size_t len)
+{
+	if (at < 0 || at > row->size) at = row->size;
+	undo_record_insert_text(row->idx, at, s, len);
+	journal_insert_text(row->idx, at, s, len);
+	complete_edit_begin(row, at, 0);
+	rowmem_reserve(row, row->size + len);
+	memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+	memcpy(&row->chars[at], s, len);
+	row->size += len;
+	complete_edit_end(row);
+	diff_edit_row(row->idx);
+	longline_edit(row, at, 0, len);
+	editor_update_row(row);
+	E.is_dirty = 1;
+}
+
+void editor_row_append_string(erow* row, char* s, size_t len)
+{
+	undo_record_insert_text(row->idx, row->size, s, len);
+	journal_insert_text(row->idx, row->size, s, len);
+	complete_edit_begin(row, row->size, 0);
+	rowmem_reserve(row, row->size + len);
+	memcpy(&row->chars[row->size], s, len);
+	row->size += len;
+	row->chars[row->size] = '\0';
+	complete_edit_end(row);
+	diff_edit_row(row->idx);
+	longline_edit(row, row->size - len, 0, len);
+	editor_update_row(row);
+	E.is_dirty = 1;
+}
+
+// deleting at the end of the row removes its last character
+void editor_row_del_char(erow* row, int at)
+{
+	if (at < 0 || at > row->size || row->size == 0) return;
+	if (at == row->size) --at;
+	editor_row_del_string(row, at, 1);
+}
+
+void editor_row_del_string(erow* row, int at, size_t len)
+{
+	if (at < 0 || at > row->size) return;
+	if (len > (size_t) (row->size - at)) len = row->size - at;
+	if (len == 0) return;
+	undo_record_delete_text(row->idx, at, &row->chars[at], len);
+	journal_delete_text(row->idx, at, len);
+	complete_edit_begin(row, at, len);
+	rowmem_own(row);
+	memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+	row->size -= len;
+	complete_edit_end(row);
+	diff_edit_row(row->idx);
+	longline_edit(row, at, len, 0);
+	editor_update_row(row);
+	E.is_dirty = 1;
+}
+
+// operations
+
+void insert_char(int c)
+{
+	if (E.cy == E.numrows)
+		editor_insert_row(E.numrows, "", 0);
+	erow* row = editor_row_mut(E.cy);
+	if (!row) return;
+	editor_row_insert_char(row, E.cx, c);
+	++E.cx;
+}
+
+// inserts n + 1 lines at the cursor, split by n line breaks: the lines
+// between the first and the last one go in as one bulk row insertion,
+// highlighted in a single pass
+void insert_lines(char** lines, size_t* lens, int n)
+{
+	if (E.cy == E.numrows)
+		editor_insert_row(E.numrows, "", 0);
+	erow* row = editor_row_mut(E.cy);
+	if (!row) return;
+
+	if (n == 0)
+	{
+		editor_row_insert_string(row, E.cx, lines[0], lens[0]);
+		E.cx += lens[0];
+		return;
+	}
+
+	// the text after the cursor moves to the end of the last line
+	char* end = lines[n];
+	size_t end_len = lens[n];
+	size_t tail_len = row->size - E.cx;
+	char* last = malloc(end_len + tail_len);
+	memcpy(last, end, end_len);
+	memcpy(&last[end_len], &row->chars[E.cx], tail_len);
+	lines[n] = last;
+	lens[n] += tail_len;
+
+	editor_syntax_defer();
+	editor_row_del_string(row, E.cx, tail_len);
+	editor_row_append_string(row, lines[0], lens[0]);
+	editor_insert_rows(E.cy + 1, n, &lines[1], &lens[1]);
+	editor_syntax_flush();
+
+	lines[n] = end;
+	lens[n] = end_len;
+	free(last);
+	E.cy += n;
+	E.cx = end_len;
+}
+
+// inserts pasted text at the cursor
+void insert_text(char* s, size_t len)
+{
+	if (len == 0) return;
+
+	int n = 0;
+	size_t i;
+	for (i = 0; i < len; ++i)
+		if (s[i] == '\n' || (s[i] == '\r' && (i + 1 == len || s[i + 1] != '\n'))) ++n;
+
+	char** lines = malloc(sizeof(char*) * (n + 1));
+	size_t* lens = malloc(sizeof(size_t) * (n + 1));
+	int k = 0;
+	size_t start = 0;
+	for (i = 0; i < len; ++i)
+	{
+		if (s[i] != '\n' && s[i] != '\r') continue;
+		lines[k] = &s[start];
+		lens[k++] = i - start;
+		if (s[i] == '\r' && i + 1 < len && s[i + 1] == '\n') ++i;
+		start = i + 1;
+	}
+	lines[k] = &s[start];
+	lens[k] = len - start;
+
+	insert_lines(lines, lens, n);
+	free(lens);
+	free(lines);
+}
+
+void insert_new_line()
+{
+	if (E.cx == 0)
+	{
+		int numrows = E.numrows;
+		editor_insert_row(E.cy, "", 0);
+		if (E.numrows == numrows) return;
+	}
+	else
+	{
+		erow* row = editor_row_mut(E.cy);
+		if (!row) return;
+		editor_insert_row(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
+		row = editor_row_mut(E.cy);
+		editor_row_del_string(row, E.cx, row->size - E.cx);
+	}
+	++E.cy;
+	E.cx = 0;
+}
+
+void del_char()
+{
+	if (E.cy == E.numrows) return;
+	if (E.cx == 0 && E.cy == 0) return;
+
+	erow* row = editor_row_mut(E.cy);
+	if (!row) return;
+	if (E.cx > 0)
+	{
+		// the whole cluster before the cursor goes, with its combining marks
+		int at = utf8_prev(row->chars, row->size, E.cx);
+		editor_row_del_string(row, at, E.cx - at);
+		E.cx = at;
+	}
+	else
+	{
+		erow* prev = editor_row_mut(E.cy - 1);
+		E.cx = prev->size;
+		editor_row_append_string(prev, row->chars, row->size);
+		editor_del_row(E.cy);
+		--E.cy;
+	}
+}
+
+// file i/o
+
+char* editor_rows_to_string(int* buffer_len)
+{
+	int file_len = 0;
+	int j;
+	for (j = 0; j < E.numrows; ++j)
+	{
+		file_len += E.row[j].size + 1;
+	}
+	*buffer_len = file_len;
+
+	char* buf = malloc(file_len);
+	char* p = buf;
+
+	for (j = 0; j < E.numrows; ++j)
+	{
+		memcpy(p, E.row[j].cold ? cold_text(&E.row[j]) : E.row[j].chars, E.row[j].size);
+		p += E.row[j].size;
+		*p = '\n';
+		++p;
+	}
+	return buf;
+}
+
+static void editor_read_file(char* filename)
+{
+	FILE* fp = fopen(filename, "r");
+	if (!fp) die("fopen");
+
+	char* line = NULL;
+	size_t linecap = 0;
+	ssize_t linelen;
+	E.file_size = 0;
+	undo_suspend();
+	journal_suspend();
+	while ((linelen = getline(&line, &linecap, fp)) != -1)
+	{
+		E.file_size += linelen;
+		while (linelen > 0 && (line[linelen-1] == '\n' || line[linelen-1] == '\r'))
+			linelen--;
+		editor_insert_row(E.numrows, line, linelen);
+	}
+	journal_resume();
+	undo_resume();
+	free(line);
+	fclose(fp);
+	complete_schedule();
+	diff_set_baseline();
+}
+
+void editor_open(char* filename)
+{
+	long long span = trace_begin();
+	free(E.filename);
+	E.filename = strdup(filename);
+
+	editor_select_syntax_highlight();
+	session_load(filename);
+
+	if (pager_should_open(filename))
+	{
+		if (!session_open_pager(filename)) pager_open(filename);
+	}
+	else
+	{
+		unlaid = session_rows() >= 0;
+		editor_read_file(filename);
+		if (unlaid && !session_restore_rows())
+		{
+			// the file changed while it was read, lex it after all
+			for (int i = 0; i < E.numrows; ++i) editor_update_row(&E.row[i]);
+		}
+		unlaid = 0;
+	}
+	session_restore_position();
+	session_track();
+	E.is_dirty = 0;
+	trace_end("editor_open", span);
+}
+
+static void free_rows()
+{
+	clip_clear();
+	cold_release_all();
+	fold_clear();
+	bracket_clear();
+	complete_clear();
+	diff_clear();
+	for (int i = 0; i < E.numrows; ++i)
+	{
+		longline_free(&E.row[i]);
+		utf8_free(&E.row[i]);
+	}
+	E.numrows = 0;
+	rowmem_release();
+}
+
+// empties the buffer, leaving the editor as it was before editor_open
+void editor_close()
+{
+	if (E.paged)
+	{
+		pager_close();
+		fold_clear();
+	}
+	else
+	{
+		free_rows();
+	}
+
+	free(E.filename);
+	E.filename = NULL;
+	E.syntax = NULL;
+	E.cx = E.cy = E.rx = 0;
+	E.rowoff = E.coloff = 0;
+	E.file_size = 0;
+	E.is_dirty = 0;
+	undo_clear();
+	journal_discard();
+}
+
+// drops the buffer and reads E.filename again, keeping the cursor where possible
+void editor_reload()
+{
+	if (E.paged)
+	{
+		pager_close();
+		fold_clear();
+		pager_open(E.filename);
+	}
+	else
+	{
+		free_rows();
+		editor_read_file(E.filename);
+	}
+
+	if (E.cy > E.numrows) E.cy = E.numrows;
+	E.cx = 0;
+	E.is_dirty = 0;
+	session_track();
+	undo_clear();
+	journal_discard();
+}
+
+// writes the buffer to E.filename, returns the bytes written or -1 with errno set
+long long editor_write_file()
+{
+	long long written = -1;
+	if (E.paged)
+	{
+		written = pager_save(E.filename);
+		if (written == -1) return -1;
+		follow_reset();
+	}
+	else
+	{
+		int len;
+		char* buf = editor_rows_to_string(&len);
+
+		int fd = open(E.filename, O_RDWR | O_CREAT, 0644); // @todo use a temporary file and rename it after success write
+		if (fd != -1)
+		{
+			if (ftruncate(fd, len) != -1 && write(fd, buf, len) != -1) written = len;
+			int saved = errno;
+			close(fd);
+			errno = saved;
+		}
+		free(buf);
+		if (written == -1) return -1;
+		diff_set_baseline();
+	}
+
+	E.is_dirty = 0;
+	session_track();
+	undo_mark_saved();
+	journal_discard();
+	E.file_size = written;
+	return written;
+}
+
+// search
+
+// first row after `from` in `direction` holding query, wrapping around the
+// buffer. Returns the row or -1 and sets the match column in *cx and its
+// offset in render in *rx (-1 when the row has no full render, see longline.h).
+int editor_search(const char* query, int from, int direction, int* cx, int* rx)
+{
+	int current = from;
+	int limit = E.numrows;
+	size_t query_len = strlen(query);
+	int plain = strchr(query, ' ') == NULL; // render and chars only differ in tabs
+
+	if (E.paged)
+	{
+		int start = current + direction;
+		if (start < 0) start = E.numrows - 1;
+		else if (start >= E.numrows) start = 0;
+
+		int line = pager_find(query, start, direction);
+		if (line == -1) return -1;
+		if (line >= 0)
+		{
+			// land on the match through the loop below
+			current = line - direction;
+			limit = 1;
+		}
+	}
+
+	for (int i = 0; i < limit; ++i)
+	{
+		current += direction;
+		if (current == -1) current = E.numrows - 1;
+		else if (current == E.numrows) current = 0;
+
+		// look into cold and stripped rows without laying them out
+		if (!E.paged && !E.row[current].render && plain)
+		{
+			erow* r = &E.row[current];
+			if (!memmem(r->cold ? cold_text(r) : r->chars, r->size, query, query_len)) continue;
+		}
+
+		erow* row = editor_row_at(current);
+		if (row->wide)
+		{
+			// render only holds a window of a long row, search its text
+			char* hit = memmem(row->chars, row->size, query, query_len);
+			if (!hit) continue;
+			*cx = hit - row->chars;
+			*rx = -1;
+			return current;
+		}
+
+		char* match = strstr(row->render, query);
+		if (match)
+		{
+			*rx = match - row->render;
+			*cx = row->cols ? utf8_ro_to_cx(row, *rx) : editor_row_rx_to_cx(row, *rx);
+			return current;
+		}
+	}
+	return -1;
+}
+
+// swaps the whole text of a row, recorded as one delete and one insert
+void editor_row_set_text(erow* row, const char* s, size_t len)
+{
+	// only the span between the common start and end is logged
+	size_t old = row->size;
+	size_t pre = 0;
+	while (pre < len && pre < old && row->chars[pre] == s[pre]) ++pre;
+	size_t suf = 0;
+	while (suf < len - pre && suf < old - pre && row->chars[old - 1 - suf] == s[len - 1 - suf]) ++suf;
+	undo_record_delete_text(row->idx, pre, &row->chars[pre], old - pre - suf);
+	journal_delete_text(row->idx, pre, old - pre - suf);
+	undo_record_insert_text(row->idx, pre, &s[pre], len - pre - suf);
+	journal_insert_text(row->idx, pre, &s[pre], len - pre - suf);
+	complete_edit_begin(row, 0, old);
+	rowmem_reserve(row, len);
+	memcpy(row->chars, s, len);
+	row->chars[len] = '\0';
+	row->size = len;
+	complete_edit_end(row);
+	diff_edit_row(row->idx);
+	longline_edit(row, 0, old, len);
+	editor_update_row(row);
+	E.is_dirty = 1;
+}
+
+// replace-all state, shared with the pager through replace_row
+static struct
+{
+	const char* query;
+	size_t qlen;
+	const char* with;
+	size_t wlen;
+	char* out;
+	size_t out_cap;
+	long long count;
+	int* hits; // rows holding the query
+	int hits_cap;
+	long long undo_records; // what the undo log takes for the replacement
+	long long undo_bytes;
+} R;
+
+static void reserve_out(size_t need)
+{
+	if (need <= R.out_cap) return;
+	mem_add(MEM_SEARCH, -(long long) R.out_cap);
+	while (need > R.out_cap) R.out_cap = R.out_cap ? R.out_cap * 2 : 4096;
+	R.out = realloc(R.out, R.out_cap);
+	mem_add(MEM_SEARCH, R.out_cap);
+}
+
+// builds the new text of a row holding the query and swaps it in
+static void replace_row(erow* row)
+{
+	const char* p = row->chars;
+	const char* end = row->chars + row->size;
+	const char* hit;
+	size_t len = 0;
+	while ((hit = memmem(p, end - p, R.query, R.qlen)) != NULL)
+	{
+		reserve_out(len + (hit - p) + R.wlen);
+		memcpy(&R.out[len], p, hit - p);
+		len += hit - p;
+		memcpy(&R.out[len], R.with, R.wlen);
+		len += R.wlen;
+		p = hit + R.qlen;
+		++R.count;
+	}
+	reserve_out(len + (end - p));
+	memcpy(&R.out[len], p, end - p);
+	len += end - p;
+	editor_row_set_text(row, R.out, len);
+}
+
+// the undo log takes the span of a row from its first match to the end of
+// its last one, before and after the replacement
+static void measure(const char* text, int size)
+{
+	const char* p = text;
+	const char* end = text + size;
+	const char* first = NULL;
+	const char* hit;
+	long long count = 0;
+	while ((hit = memmem(p, end - p, R.query, R.qlen)) != NULL)
+	{
+		if (!first) first = hit;
+		p = hit + R.qlen;
+		++count;
+	}
+	if (!first) return;
+	R.undo_records += 2;
+	R.undo_bytes += 2 * (p - first) + count * ((long long) R.wlen - (long long) R.qlen);
+}
+
+static void measure_row(erow* row)
+{
+	measure(row->chars, row->size);
+}
+
+// replaces every occurrence of query with `with` in one pass over the rows.
+// A touched row gets its new text built once and is laid out once, and the
+// highlighting of all of them is redone in a single pass at the end.
+// Returns the number of replacements and sets *rows to the rows touched.
+// When `undoable` is set and the replacement wouldn't fit in the undo log,
+// nothing is replaced and -1 is returned.
+long long editor_replace_all(const char* query, const char* with, int* rows, int undoable)
+{
+	*rows = 0;
+	if (!*query) return 0;
+
+	long long span = trace_begin();
+	R.query = query;
+	R.qlen = strlen(query);
+	R.with = with;
+	R.wlen = strlen(with);
+	R.count = 0;
+	R.undo_records = 0;
+	R.undo_bytes = 0;
+
+	// the rows holding the query are found first and measured when the
+	// replacement has to be undoable, nothing changes if it can't be
+	int fits = 1;
+	editor_syntax_defer();
+	if (E.paged)
+	{
+		// the pager finds the lines in one pass over the file
+		if (pager_find_matches(query) == 0)
+		{
+			if (undoable)
+			{
+				pager_each_match(query, measure_row);
+				fits = undo_fits(R.undo_records, R.undo_bytes);
+			}
+			if (fits) *rows = pager_each_match(query, replace_row);
+		}
+	}
+	else
+	{
+		int n = 0;
+		for (int at = 0; at < E.numrows; ++at)
+		{
+			// look into cold and stripped rows without bringing them back
+			erow* row = &E.row[at];
+			const char* text = row->cold ? cold_text(row) : row->chars;
+			if (!memmem(text, row->size, query, R.qlen)) continue;
+			if (undoable) measure(text, row->size);
+			if (n == R.hits_cap)
+			{
+				R.hits_cap = R.hits_cap ? R.hits_cap * 2 : 1024;
+				R.hits = realloc(R.hits, sizeof(int) * R.hits_cap);
+			}
+			R.hits[n++] = at;
+		}
+		if (undoable) fits = undo_fits(R.undo_records, R.undo_bytes);
+		for (int i = 0; fits && i < n; ++i) replace_row(editor_row_mut(R.hits[i]));
+		if (fits) *rows = n;
+		free(R.hits);
+		R.hits = NULL;
+		R.hits_cap = 0;
+	}
+	editor_syntax_flush();
+	free(R.out);
+	mem_add(MEM_SEARCH, -(long long) R.out_cap);
+	R.out = NULL;
+	R.out_cap = 0;
+
+	if (E.cy < E.numrows)
+	{
+		erow* row = editor_row_at(E.cy);
+		if (E.cx > row->size) E.cx = row->size;
+	}
+	trace_end("editor_replace_all", span);
+	return fits ? R.count : -1;
+}
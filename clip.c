@@ -0,0 +1,178 @@
+#include "clip.h"
+#include "cold.h"
+#include "rowmem.h"
+#include "trace.h"
+
+// a line held: text in the block of a pinned row (or of the block it
+// left), or in a cold block
+struct slice
+{
+	const char* s; // NULL when the text is in `cold`
+	struct cold_block* cold;
+	int off; // where the line starts in the text of the cold block
+	int len;
+};
+
+static struct
+{
+	struct slice* lines;
+	int n; // lines held, a line break between each two of them
+} K;
+
+// the ends of the selection in buffer order, 0 when there is none
+int clip_selection(int* r0, int* c0, int* r1, int* c1)
+{
+	if (!E.sel_active || E.paged) return 0;
+	int sy = E.sel_cy < E.numrows ? E.sel_cy : E.numrows;
+	int sx = sy < E.numrows ? E.sel_cx : 0;
+	if (sy < E.numrows && sx > E.row[sy].size) sx = E.row[sy].size;
+	if (sy < E.cy || (sy == E.cy && sx <= E.cx))
+	{
+		*r0 = sy;
+		*c0 = sx;
+		*r1 = E.cy;
+		*c1 = E.cx;
+	}
+	else
+	{
+		*r0 = E.cy;
+		*c0 = E.cx;
+		*r1 = sy;
+		*c1 = sx;
+	}
+	return 1;
+}
+
+// lets go of the text held and of the blocks it kept
+void clip_clear()
+{
+	for (int i = 0; i < K.n; ++i)
+		if (K.lines[i].cold) cold_drop(K.lines[i].cold);
+	free(K.lines);
+	K.lines = NULL;
+	K.n = 0;
+	rowmem_unpin_all();
+}
+
+// holds the text from (r0, c0) up to (r1, c1), a row past the last one
+// stands for an empty line. Returns the lines held, 0 for a paged file.
+int clip_copy(int r0, int c0, int r1, int c1)
+{
+	clip_clear();
+	if (E.paged || r0 > r1 || r0 > E.numrows) return 0;
+	long long span = trace_begin();
+	if (r1 > E.numrows) r1 = E.numrows;
+	K.n = r1 - r0 + 1;
+	K.lines = calloc(K.n, sizeof(struct slice));
+	for (int i = 0; i < K.n; ++i)
+	{
+		int at = r0 + i;
+		struct slice* line = &K.lines[i];
+		if (at == E.numrows)
+		{
+			line->s = "";
+			continue;
+		}
+		erow* row = &E.row[at];
+		int from = i == 0 ? c0 : 0;
+		int to = at == r1 ? c1 : row->size;
+		if (to > row->size) to = row->size;
+		if (from > to) from = to;
+		line->len = to - from;
+		if (row->cold)
+		{
+			line->cold = cold_hold(row);
+			line->off = row->cold_off + from;
+		}
+		else
+		{
+			rowmem_pin(row);
+			line->s = &row->chars[from];
+		}
+	}
+	trace_end("clip_copy", span);
+	return K.n;
+}
+
+// copies the text from (r0, c0) up to (r1, c1) and deletes it, the cursor
+// goes where it started. Returns the lines held.
+int clip_cut(int r0, int c0, int r1, int c1)
+{
+	int n = clip_copy(r0, c0, r1, c1);
+	if (n == 0 || r0 == E.numrows) return n;
+	long long span = trace_begin();
+	if (r1 > E.numrows) r1 = E.numrows;
+	erow* row;
+	if (r0 == r1)
+	{
+		row = editor_row_mut(r0);
+		editor_row_del_string(row, c0, K.lines[0].len);
+	}
+	else
+	{
+		// the rest of the last row joins the first one
+		char* tail = NULL;
+		size_t tail_len = 0;
+		if (r1 < E.numrows)
+		{
+			erow* last = editor_row_at(r1);
+			tail_len = last->size - K.lines[n - 1].len;
+			tail = malloc(tail_len + 1);
+			memcpy(tail, &last->chars[K.lines[n - 1].len], tail_len);
+		}
+		else
+		{
+			--r1;
+		}
+		editor_syntax_defer();
+		editor_del_rows(r0 + 1, r1 - r0);
+		row = editor_row_mut(r0);
+		editor_row_del_string(row, c0, row->size - c0);
+		editor_row_append_string(row, tail ? tail : "", tail_len);
+		editor_syntax_flush();
+		free(tail);
+	}
+	E.cy = r0;
+	E.cx = c0 < row->size ? c0 : row->size;
+	trace_end("clip_cut", span);
+	return n;
+}
+
+// inserts the text held at the cursor, 0 when there is none. The lines of
+// cold blocks are decompressed into one buffer for the insertion.
+int clip_paste()
+{
+	if (K.n == 0 || E.paged) return 0;
+	long long span = trace_begin();
+	char** lines = malloc(sizeof(char*) * K.n);
+	size_t* lens = malloc(sizeof(size_t) * K.n);
+	size_t cold_len = 0;
+	for (int i = 0; i < K.n; ++i)
+		if (K.lines[i].cold) cold_len += K.lines[i].len;
+	char* buf = malloc(cold_len + 1);
+	char* p = buf;
+	for (int i = 0; i < K.n; ++i)
+	{
+		struct slice* line = &K.lines[i];
+		lens[i] = line->len;
+		if (!line->cold)
+		{
+			lines[i] = (char*) line->s;
+			continue;
+		}
+		memcpy(p, cold_block_text(line->cold) + line->off, line->len);
+		lines[i] = p;
+		p += line->len;
+	}
+	insert_lines(lines, lens, K.n - 1);
+	free(buf);
+	free(lens);
+	free(lines);
+	trace_end("clip_paste", span);
+	return K.n;
+}
+
+int clip_lines()
+{
+	return K.n;
+}
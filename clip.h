@@ -0,0 +1,23 @@
+#ifndef CLIP_H_
+#define CLIP_H_
+
+#include "editor.h"
+
+// Selection and clipboard. The selection runs from the mark (E.sel_cx,
+// E.sel_cy) to the cursor. Copying doesn't copy the text: the clipboard
+// keeps a pointer and a length per line into the rows' own blocks, and
+// pins those rows in rowmem so their blocks stay as they are while it
+// holds them. Copying and pasting cost a slice per row, whatever the
+// length of the rows; pasting puts the lines in with one bulk row
+// insertion and one highlight pass. The lines of cold rows are held as
+// the compressed block they are in, and only decompressed when pasted.
+// Not available for paged files.
+
+int clip_selection(int* r0, int* c0, int* r1, int* c1);
+int clip_copy(int r0, int c0, int r1, int c1);
+int clip_cut(int r0, int c0, int r1, int c1);
+int clip_paste();
+int clip_lines();
+void clip_clear();
+
+#endif
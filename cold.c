@@ -0,0 +1,318 @@
+#include "cold.h"
+#include "event.h"
+#include "mem.h"
+#include "rowmem.h"
+
+#define HASH_BITS 12
+#define MIN_MATCH 4
+
+struct cold_block
+{
+	int refs; // rows still pointing at the block
+	int raw_len;
+	int len; // compressed bytes, raw_len when stored as is
+	unsigned char data[];
+};
+
+static struct
+{
+	int age; // sweeps a row must go untouched, 0 when disabled
+	int pos; // where the next sweep starts
+	struct
+	{
+		struct cold_block* block;
+		char* raw;
+	} cache[COLD_CACHE_BLOCKS];
+	int next_slot;
+	char* raw; // scratch for compression
+	unsigned char* out;
+	size_t scratch_cap;
+} C;
+
+// LZ77 in the usual LZ4 layout: a token with 4 bits of literal length and
+// 4 bits of match length, 255-byte length extensions, the literals and a
+// 16-bit little endian offset. The last sequence has literals only.
+
+static unsigned int read32(const unsigned char* p)
+{
+	unsigned int v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static unsigned char* put_length(unsigned char* op, int len)
+{
+	for (; len >= 255; len -= 255) *op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+static unsigned char* put_sequence(unsigned char* op, const unsigned char* lit, int lit_len, int off, int match_len)
+{
+	unsigned char* token = op++;
+	*token = (lit_len < 15 ? lit_len : 15) << 4;
+	if (lit_len >= 15) op = put_length(op, lit_len - 15);
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+
+	if (match_len)
+	{
+		*op++ = off & 0xff;
+		*op++ = off >> 8;
+		match_len -= MIN_MATCH;
+		*token |= match_len < 15 ? match_len : 15;
+		if (match_len >= 15) op = put_length(op, match_len - 15);
+	}
+	return op;
+}
+
+// dst needs n + n / 255 + 16 bytes
+static int lz_compress(const unsigned char* src, int n, unsigned char* dst)
+{
+	int table[1 << HASH_BITS];
+	memset(table, -1, sizeof(table));
+
+	unsigned char* op = dst;
+	int anchor = 0;
+	int ip = 0;
+	while (ip + MIN_MATCH <= n)
+	{
+		unsigned int seq = read32(&src[ip]);
+		int h = (seq * 2654435761u) >> (32 - HASH_BITS);
+		int ref = table[h];
+		table[h] = ip;
+
+		if (ref < 0 || ip - ref > 0xffff || read32(&src[ref]) != seq)
+		{
+			++ip;
+			continue;
+		}
+
+		int len = MIN_MATCH;
+		while (ip + len < n && src[ref + len] == src[ip + len]) ++len;
+		op = put_sequence(op, &src[anchor], ip - anchor, ip - ref, len);
+		ip += len;
+		anchor = ip;
+	}
+	op = put_sequence(op, &src[anchor], n - anchor, 0, 0);
+	return op - dst;
+}
+
+static int get_length(const unsigned char* src, int n, int* sp, int len)
+{
+	if (len != 15) return len;
+	while (*sp < n)
+	{
+		int b = src[(*sp)++];
+		len += b;
+		if (b != 255) break;
+	}
+	return len;
+}
+
+// returns the decompressed size, -1 if the input is corrupt
+static int lz_decompress(const unsigned char* src, int n, char* dst, int cap)
+{
+	int sp = 0;
+	int dp = 0;
+	while (sp < n)
+	{
+		int token = src[sp++];
+		int lit = get_length(src, n, &sp, token >> 4);
+		if (sp + lit > n || dp + lit > cap) return -1;
+		memcpy(&dst[dp], &src[sp], lit);
+		sp += lit;
+		dp += lit;
+		if (sp >= n) break;
+
+		if (sp + 2 > n) return -1;
+		int off = src[sp] | (src[sp + 1] << 8);
+		sp += 2;
+		int len = get_length(src, n, &sp, token & 15) + MIN_MATCH;
+		if (off == 0 || off > dp || dp + len > cap) return -1;
+		for (int i = 0; i < len; ++i, ++dp) dst[dp] = dst[dp - off]; // may overlap
+	}
+	return dp;
+}
+
+// block cache
+
+static void cache_drop(struct cold_block* block)
+{
+	for (int i = 0; i < COLD_CACHE_BLOCKS; ++i)
+	{
+		if (C.cache[i].block != block) continue;
+		mem_add(MEM_COLD, -block->raw_len);
+		free(C.cache[i].raw);
+		C.cache[i].block = NULL;
+		C.cache[i].raw = NULL;
+	}
+}
+
+static const char* block_raw(struct cold_block* block)
+{
+	if (block->len == block->raw_len) return (const char*) block->data;
+
+	for (int i = 0; i < COLD_CACHE_BLOCKS; ++i)
+		if (C.cache[i].block == block) return C.cache[i].raw;
+
+	int slot = C.next_slot;
+	C.next_slot = (C.next_slot + 1) % COLD_CACHE_BLOCKS;
+	if (C.cache[slot].block) mem_add(MEM_COLD, -C.cache[slot].block->raw_len);
+	free(C.cache[slot].raw);
+	C.cache[slot].block = block;
+	C.cache[slot].raw = malloc(block->raw_len);
+	mem_add(MEM_COLD, block->raw_len);
+	if (lz_decompress(block->data, block->len, C.cache[slot].raw, block->raw_len) != block->raw_len)
+		die("cold block");
+	return C.cache[slot].raw;
+}
+
+// text of a cold row, valid until the next call into this module
+const char* cold_text(erow* row)
+{
+	return block_raw(row->cold) + row->cold_off;
+}
+
+// the block stays until cold_drop, whatever happens to the row
+struct cold_block* cold_hold(erow* row)
+{
+	++row->cold->refs;
+	return row->cold;
+}
+
+void cold_drop(struct cold_block* block)
+{
+	if (--block->refs > 0) return;
+	cache_drop(block);
+	mem_add(MEM_COLD, -(long long) (sizeof(struct cold_block) + block->len));
+	free(block);
+}
+
+// text of a block held with cold_hold, valid like cold_text
+const char* cold_block_text(struct cold_block* block)
+{
+	return block_raw(block);
+}
+
+void cold_release(erow* row)
+{
+	struct cold_block* block = row->cold;
+	if (!block) return;
+	row->cold = NULL;
+	cold_drop(block);
+}
+
+void cold_thaw(erow* row)
+{
+	const char* s = cold_text(row);
+	row->chars = NULL;
+	row->cap = 0;
+	row->pin = 0;
+	rowmem_set_text(row, s, row->size);
+	cold_release(row);
+	editor_update_row(row);
+}
+
+// the rows of every block are going away too
+void cold_release_all()
+{
+	for (int i = 0; i < E.numrows; ++i)
+	{
+		if (!E.row[i].cold) continue;
+		cold_release(&E.row[i]);
+	}
+}
+
+// sweeping
+
+static int is_cold_candidate(int at, int lo, int hi)
+{
+	erow* row = &E.row[at];
+	return !row->cold && !row->wide && (at < lo || at > hi) && E.row_clock - row->last_use >= (unsigned int) C.age;
+}
+
+static void freeze(int from, int to, int raw_len)
+{
+	if (C.scratch_cap < (size_t) raw_len + raw_len / 255 + 16)
+	{
+		mem_add(MEM_COLD, 2 * ((long long) raw_len + raw_len / 255 + 16 - C.scratch_cap));
+		C.scratch_cap = raw_len + raw_len / 255 + 16;
+		C.raw = realloc(C.raw, C.scratch_cap);
+		C.out = realloc(C.out, C.scratch_cap);
+	}
+
+	int off = 0;
+	for (int i = from; i < to; ++i)
+	{
+		memcpy(&C.raw[off], E.row[i].chars, E.row[i].size);
+		off += E.row[i].size;
+	}
+
+	int len = lz_compress((unsigned char*) C.raw, raw_len, C.out);
+	int stored = len < raw_len;
+	if (!stored) len = raw_len;
+
+	struct cold_block* block = malloc(sizeof(struct cold_block) + len);
+	mem_add(MEM_COLD, sizeof(struct cold_block) + len);
+	block->refs = to - from;
+	block->raw_len = raw_len;
+	block->len = len;
+	memcpy(block->data, stored ? C.out : (unsigned char*) C.raw, len);
+
+	off = 0;
+	for (int i = from; i < to; ++i)
+	{
+		erow* row = &E.row[i];
+		rowmem_free(row);
+		row->rsize = 0;
+		row->cold = block;
+		row->cold_off = off;
+		off += row->size;
+	}
+}
+
+static void sweep()
+{
+	event_timer(COLD_SWEEP_MS, sweep);
+	++E.row_clock;
+	if (E.paged || E.numrows == 0) return;
+
+	// keep a screen of rows around the viewport warm
+	int lo = E.rowoff - E.screen_rows;
+	int hi = E.rowoff + 2 * E.screen_rows;
+
+	int budget = COLD_SWEEP_BYTES;
+	int at = C.pos < E.numrows ? C.pos : 0;
+	int scanned = 0;
+	while (scanned < COLD_SWEEP_ROWS && scanned < E.numrows && budget > 0)
+	{
+		if (!is_cold_candidate(at, lo, hi))
+		{
+			++at;
+			++scanned;
+		}
+		else
+		{
+			int from = at;
+			int bytes = 0;
+			while (at < E.numrows && at - from < COLD_BLOCK_ROWS && bytes < COLD_BLOCK_BYTES &&
+			       is_cold_candidate(at, lo, hi))
+				bytes += E.row[at++].size;
+			scanned += at - from;
+			budget -= bytes;
+			if (at - from > 1) freeze(from, at, bytes);
+		}
+		if (at >= E.numrows) at = 0;
+	}
+	C.pos = at;
+}
+
+void cold_init()
+{
+	char* v = getenv("YOLO_COLD_SECONDS");
+	int seconds = v ? atoi(v) : COLD_DEFAULT_SECONDS;
+	if (seconds <= 0) return;
+	C.age = (seconds * 1000 + COLD_SWEEP_MS - 1) / COLD_SWEEP_MS;
+	event_timer(COLD_SWEEP_MS, sweep);
+}
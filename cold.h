@@ -0,0 +1,34 @@
+#ifndef COLD_H_
+#define COLD_H_
+
+#include "editor.h"
+
+// Cold row storage. Runs of rows that haven't been touched for
+// YOLO_COLD_SECONDS (COLD_DEFAULT_SECONDS by default, 0 disables it) are
+// compressed together into one block with a small LZ77 codec, their
+// chars/render/hl buffers are freed and only the erow itself stays.
+// editor_row_at thaws a cold row transparently; the last few decompressed
+// blocks are cached so scrolling through a cold region stays cheap. The
+// clipboard holds on to the blocks of the cold rows it copied with
+// cold_hold, so copying doesn't thaw them.
+
+#define COLD_DEFAULT_SECONDS 30
+#define COLD_SWEEP_MS 1000
+#define COLD_SWEEP_ROWS (1 << 20)         // rows looked at per sweep
+#define COLD_SWEEP_BYTES (4 * 1024 * 1024) // text compressed per sweep
+#define COLD_BLOCK_ROWS 256
+#define COLD_BLOCK_BYTES (64 * 1024)
+#define COLD_CACHE_BLOCKS 4
+
+struct cold_block;
+
+void cold_init();
+void cold_thaw(erow* row);
+const char* cold_text(erow* row);
+void cold_release(erow* row);
+void cold_release_all();
+struct cold_block* cold_hold(erow* row);
+void cold_drop(struct cold_block* block);
+const char* cold_block_text(struct cold_block* block);
+
+#endif
@@ -0,0 +1,360 @@
+#include "complete.h"
+#include "cold.h"
+#include "event.h"
+#include "mem.h"
+#include "trace.h"
+
+struct word
+{
+	struct word* next; // in its hash chain
+	int count; // occurrences in the buffer
+	int len;
+	char s[]; // NUL-terminated
+};
+
+struct block
+{
+	int n;
+	struct word* w[COMPLETE_BLOCK]; // sorted
+};
+
+static struct
+{
+	int counted; // rows above this one are in the index
+	struct word** table; // hash chains
+	int table_cap; // a power of two
+	int words;
+	struct block** blocks; // sorted by their first word, none empty
+	int nblocks;
+	int blocks_cap;
+	int edit_from; // start of the words taken out by complete_edit_begin
+	int edit_tail; // and the bytes after them
+} W;
+
+static void (*on_indexed)(); // told when a slice counts the last row
+
+int complete_is_word_char(int c)
+{
+	return isalnum(c) || c == '_' || c >= 0x80;
+}
+
+static unsigned int hash(const char* s, int len)
+{
+	unsigned int h = 2166136261u;
+	for (int i = 0; i < len; ++i) h = (h ^ (unsigned char) s[i]) * 16777619u;
+	return h;
+}
+
+static int compare(const char* s, int len, const struct word* w)
+{
+	int r = memcmp(s, w->s, len < w->len ? len : w->len);
+	return r ? r : len - w->len;
+}
+
+// block that holds or would hold s, the last one starting at or before it
+static int find_block(const char* s, int len)
+{
+	int lo = 0, hi = W.nblocks;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (compare(s, len, W.blocks[mid]->w[0]) >= 0) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo > 0 ? lo - 1 : 0;
+}
+
+// first position in the block whose word isn't below s
+static int find_in_block(const struct block* b, const char* s, int len)
+{
+	int lo = 0, hi = b->n;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (compare(s, len, b->w[mid]) > 0) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+static void insert_block(int at, struct block* b)
+{
+	if (W.nblocks == W.blocks_cap)
+	{
+		mem_add(MEM_WORDS, -(long long) sizeof(struct block*) * W.blocks_cap);
+		W.blocks_cap = W.blocks_cap ? W.blocks_cap * 2 : 64;
+		W.blocks = realloc(W.blocks, sizeof(struct block*) * W.blocks_cap);
+		mem_add(MEM_WORDS, (long long) sizeof(struct block*) * W.blocks_cap);
+	}
+	memmove(&W.blocks[at + 1], &W.blocks[at], sizeof(struct block*) * (W.nblocks - at));
+	W.blocks[at] = b;
+	++W.nblocks;
+	mem_add(MEM_WORDS, sizeof(struct block));
+}
+
+static void index_insert(struct word* w)
+{
+	if (W.nblocks == 0)
+	{
+		struct block* first = malloc(sizeof(struct block));
+		first->n = 1;
+		first->w[0] = w;
+		insert_block(0, first);
+		return;
+	}
+	int bi = find_block(w->s, w->len);
+	struct block* b = W.blocks[bi];
+	int pos = find_in_block(b, w->s, w->len);
+	if (b->n == COMPLETE_BLOCK)
+	{
+		// a full block splits in two halves
+		struct block* upper = malloc(sizeof(struct block));
+		upper->n = COMPLETE_BLOCK / 2;
+		memcpy(upper->w, &b->w[COMPLETE_BLOCK / 2], sizeof(struct word*) * upper->n);
+		b->n = COMPLETE_BLOCK / 2;
+		insert_block(bi + 1, upper);
+		if (pos > b->n)
+		{
+			pos -= b->n;
+			b = upper;
+		}
+	}
+	memmove(&b->w[pos + 1], &b->w[pos], sizeof(struct word*) * (b->n - pos));
+	b->w[pos] = w;
+	++b->n;
+}
+
+static void index_remove(struct word* w)
+{
+	int bi = find_block(w->s, w->len);
+	struct block* b = W.blocks[bi];
+	int pos = find_in_block(b, w->s, w->len);
+	memmove(&b->w[pos], &b->w[pos + 1], sizeof(struct word*) * (b->n - pos - 1));
+	if (--b->n > 0) return;
+	free(b);
+	mem_add(MEM_WORDS, -(long long) sizeof(struct block));
+	memmove(&W.blocks[bi], &W.blocks[bi + 1], sizeof(struct block*) * (W.nblocks - bi - 1));
+	--W.nblocks;
+}
+
+static void grow_table()
+{
+	int cap = W.table_cap ? W.table_cap * 2 : 4096;
+	struct word** table = calloc(cap, sizeof(struct word*));
+	for (int i = 0; i < W.table_cap; ++i)
+	{
+		struct word* w = W.table[i];
+		while (w)
+		{
+			struct word* next = w->next;
+			unsigned int h = hash(w->s, w->len) & (cap - 1);
+			w->next = table[h];
+			table[h] = w;
+			w = next;
+		}
+	}
+	mem_add(MEM_WORDS, (long long) sizeof(struct word*) * (cap - W.table_cap));
+	free(W.table);
+	W.table = table;
+	W.table_cap = cap;
+}
+
+static void count_word(const char* s, int len, int delta)
+{
+	if (W.words >= W.table_cap) grow_table();
+	struct word** link = &W.table[hash(s, len) & (W.table_cap - 1)];
+	while (*link && ((*link)->len != len || memcmp((*link)->s, s, len))) link = &(*link)->next;
+
+	struct word* w = *link;
+	if (w)
+	{
+		w->count += delta;
+		if (w->count > 0) return;
+		*link = w->next;
+		index_remove(w);
+		mem_add(MEM_WORDS, -(long long) (sizeof(struct word) + len + 1));
+		free(w);
+		--W.words;
+		return;
+	}
+	if (delta < 0) return;
+
+	w = malloc(sizeof(struct word) + len + 1);
+	w->count = delta;
+	w->len = len;
+	memcpy(w->s, s, len);
+	w->s[len] = '\0';
+	w->next = NULL;
+	*link = w;
+	index_insert(w);
+	mem_add(MEM_WORDS, sizeof(struct word) + len + 1);
+	++W.words;
+}
+
+static void count_words(const char* s, int len, int delta)
+{
+	int i = 0;
+	while (i < len)
+	{
+		if (!complete_is_word_char((unsigned char) s[i]))
+		{
+			++i;
+			continue;
+		}
+		int j = i + 1;
+		while (j < len && complete_is_word_char((unsigned char) s[j])) ++j;
+		if (!isdigit((unsigned char) s[i]) && j - i >= COMPLETE_MIN_LEN && j - i <= COMPLETE_MAX_LEN)
+			count_word(&s[i], j - i, delta);
+		i = j;
+	}
+}
+
+static const char* row_text(erow* row)
+{
+	return row->cold ? cold_text(row) : row->chars;
+}
+
+// counts the rows not in the index yet, for at most ms milliseconds
+// when ms isn't 0
+static void count_rows(long ms)
+{
+	if (E.paged) return;
+	long long span = trace_begin();
+	long long until = event_now_ms() + ms;
+	while (W.counted < E.numrows)
+	{
+		erow* row = &E.row[W.counted++];
+		count_words(row_text(row), row->size, 1);
+		if (ms && (W.counted & 255) == 0 && event_now_ms() >= until) break;
+	}
+	trace_end("complete_count_rows", span);
+}
+
+static void slice()
+{
+	count_rows(COMPLETE_SLICE_MS);
+	if (complete_indexing()) event_timer(1, slice);
+	else if (on_indexed) on_indexed();
+}
+
+// rows are left to count, a lookup now ranks only the words seen so far
+int complete_indexing()
+{
+	return !E.paged && W.counted < E.numrows;
+}
+
+void complete_on_indexed(void (*callback)())
+{
+	on_indexed = callback;
+}
+
+// indexes the buffer from the event loop a slice at a time, so that the
+// first lookup finds it done
+void complete_schedule()
+{
+	event_timer(1, slice);
+}
+
+// the text of row from at to at + removed is about to be replaced: the
+// words it touches are taken out until complete_edit_end counts them again
+void complete_edit_begin(erow* row, int at, int removed)
+{
+	if (E.paged || row->idx >= W.counted) return;
+	int from = at, to = at + removed;
+	while (from > 0 && complete_is_word_char((unsigned char) row->chars[from - 1])) --from;
+	while (to < row->size && complete_is_word_char((unsigned char) row->chars[to])) ++to;
+	count_words(&row->chars[from], to - from, -1);
+	W.edit_from = from;
+	W.edit_tail = row->size - to;
+}
+
+void complete_edit_end(erow* row)
+{
+	if (E.paged || row->idx >= W.counted) return;
+	count_words(&row->chars[W.edit_from], row->size - W.edit_tail - W.edit_from, 1);
+}
+
+// rows inserted at or below the ones left to count are counted with them
+void complete_insert_rows(int at, int n)
+{
+	if (E.paged || at >= W.counted) return;
+	for (int i = at; i < at + n; ++i) count_words(E.row[i].chars, E.row[i].size, 1);
+	W.counted += n;
+}
+
+// called before the rows go
+void complete_delete_rows(int at, int n)
+{
+	if (E.paged || at >= W.counted) return;
+	int end = at + n < W.counted ? at + n : W.counted;
+	for (int i = at; i < end; ++i) count_words(row_text(&E.row[i]), E.row[i].size, -1);
+	W.counted -= end - at;
+}
+
+void complete_clear()
+{
+	for (int i = 0; i < W.table_cap; ++i)
+	{
+		struct word* w = W.table[i];
+		while (w)
+		{
+			struct word* next = w->next;
+			free(w);
+			w = next;
+		}
+	}
+	for (int i = 0; i < W.nblocks; ++i) free(W.blocks[i]);
+	free(W.table);
+	free(W.blocks);
+	mem_add(MEM_WORDS, -mem_used(MEM_WORDS));
+	memset(&W, 0, sizeof(W));
+}
+
+// the words starting with prefix, the most frequent first, leaving out the
+// prefix itself. Only the first COMPLETE_SCAN of them in sorted order are
+// ranked, which bounds the time a short prefix takes. A lookup counts rows
+// for one more slice at most; when complete_indexing() is still true after
+// it the ranking is partial and the slices go on from the event loop. The
+// words are valid until the next edit.
+int complete_lookup(const char* prefix, int len, const char** out, int max)
+{
+	if (E.paged || len <= 0) return 0;
+	count_rows(COMPLETE_SLICE_MS);
+	if (complete_indexing()) event_timer(1, slice);
+	if (W.nblocks == 0) return 0;
+
+	int counts[COMPLETE_MATCHES];
+	if (max > COMPLETE_MATCHES) max = COMPLETE_MATCHES;
+	int n = 0, scanned = 0;
+	int bi = find_block(prefix, len);
+	int pos = find_in_block(W.blocks[bi], prefix, len);
+	for (; bi < W.nblocks; ++bi, pos = 0)
+	{
+		struct block* b = W.blocks[bi];
+		for (; pos < b->n; ++pos)
+		{
+			struct word* w = b->w[pos];
+			if (w->len < len || memcmp(w->s, prefix, len)) return n;
+			if (w->len == len) continue;
+			if (++scanned > COMPLETE_SCAN) return n;
+
+			// insertion into the ranking, ties stay in sorted order
+			int i = n < max ? n++ : max;
+			while (i > 0 && counts[i - 1] < w->count)
+			{
+				if (i < max)
+				{
+					out[i] = out[i - 1];
+					counts[i] = counts[i - 1];
+				}
+				--i;
+			}
+			if (i < max)
+			{
+				out[i] = w->s;
+				counts[i] = w->count;
+			}
+		}
+	}
+	return n;
+}
@@ -0,0 +1,34 @@
+#ifndef COMPLETE_H_
+#define COMPLETE_H_
+
+#include "editor.h"
+
+// Word completion from the buffer. The words in it (runs of letters,
+// digits, _ and UTF-8 bytes, not starting with a digit) are counted in a
+// hash table and listed in a sorted index made of blocks of at most
+// COMPLETE_BLOCK words, so the words starting with a prefix are found with
+// two binary searches and read in order. A file read in is indexed from
+// the event loop in slices of COMPLETE_SLICE_MS; a lookup before that is
+// done counts one more slice and ranks the words seen so far. The row
+// functions report every edit to the rows indexed so far and only the
+// words around it are counted again. Not kept for paged files.
+
+#define COMPLETE_MIN_LEN 3
+#define COMPLETE_MAX_LEN 64 // longer words are left out
+#define COMPLETE_BLOCK 256
+#define COMPLETE_SLICE_MS 4
+#define COMPLETE_SCAN 4096 // words with the prefix looked at to rank the best ones
+#define COMPLETE_MATCHES 8 // completions a lookup returns at most
+
+void complete_schedule();
+void complete_edit_begin(erow* row, int at, int removed);
+void complete_edit_end(erow* row);
+void complete_insert_rows(int at, int n);
+void complete_delete_rows(int at, int n);
+void complete_clear();
+int complete_lookup(const char* prefix, int len, const char** out, int max);
+int complete_indexing();
+void complete_on_indexed(void (*callback)());
+int complete_is_word_char(int c);
+
+#endif
@@ -0,0 +1,424 @@
+#include <pthread.h>
+
+#include "cold.h"
+#include "diff.h"
+#include "event.h"
+#include "mem.h"
+#include "trace.h"
+
+// the rows between two matched ones, or the ends of the buffer, and the
+// lines on disk between theirs
+struct job
+{
+	int from; // first row
+	int rows;
+	int first_line;
+	int lines;
+	int* base; // line of each row or -1, the diff fills in the -1s it can
+	unsigned long long* hash; // of each row
+	unsigned long long* disk; // of each line
+	unsigned char* marks; // of each row and of the matched row after them
+	unsigned int edits; // D.edits when the job was taken
+	int generation;
+};
+
+static struct
+{
+	int active; // a baseline was taken
+	unsigned long long* disk; // hashes of the lines on disk
+	int ndisk;
+	int disk_cap;
+	int* base; // line on disk of each row, -1 for none
+	unsigned char* marks; // of each row and one more for lines deleted at the end
+	int n;
+	int cap;
+	int dirty_lo; // rows to diff again, -1 for none
+	int dirty_hi;
+	unsigned int edits;
+	int generation; // counts the baselines
+	int busy; // a job is with the worker
+} D = { .dirty_lo = -1 };
+
+static struct
+{
+	int started;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct job* todo;
+	struct job* done;
+} W = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+static unsigned long long hash_text(const char* s, int len)
+{
+	unsigned long long h = 0x9e3779b97f4a7c15ull ^ len;
+	int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		unsigned long long w;
+		memcpy(&w, &s[i], 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdull;
+		h ^= h >> 32;
+	}
+	unsigned long long w = 0;
+	memcpy(&w, &s[i], len - i);
+	h = (h ^ w) * 0xc4ceb9fe1a85ec53ull;
+	return h ^ (h >> 29);
+}
+
+static unsigned long long hash_row(int at)
+{
+	erow* row = &E.row[at];
+	return hash_text(row->cold ? cold_text(row) : row->chars, row->size);
+}
+
+static void reserve_rows(int n)
+{
+	if (n + 1 <= D.cap) return;
+	long long was = D.cap;
+	if (D.cap == 0) D.cap = 1024;
+	while (D.cap < n + 1) D.cap *= 2;
+	D.base = realloc(D.base, sizeof(int) * D.cap);
+	D.marks = realloc(D.marks, D.cap);
+	mem_add(MEM_ROWS, (long long) (sizeof(int) + 1) * (D.cap - was));
+}
+
+// Myers' greedy search for a shortest edit script from a to b, giving up
+// past DIFF_MAX_COST. The rows on the diagonals it follows get the line
+// they match plus offset in match.
+static void myers(const unsigned long long* a, int n, const unsigned long long* b, int m, int* match, int offset)
+{
+	int max = n + m < DIFF_MAX_COST ? n + m : DIFF_MAX_COST;
+	int* furthest = malloc(sizeof(int) * (2 * max + 3));
+	int* v = furthest + max + 1; // v[k] for k in -max-1..max+1
+	int* trace = malloc(sizeof(int) * (max + 1) * (max + 1)); // round d at d*d, k from -d
+	int d, found = 0;
+	v[1] = 0;
+	for (d = 0; d <= max && !found; ++d)
+	{
+		for (int k = -d; k <= d; k += 2)
+		{
+			int x = (k == -d || (k != d && v[k - 1] < v[k + 1])) ? v[k + 1] : v[k - 1] + 1;
+			int y = x - k;
+			while (x < n && y < m && a[x] == b[y]) ++x, ++y;
+			v[k] = x;
+			if (k == n - m && x >= n) found = 1;
+		}
+		memcpy(&trace[d * d], &v[-d], sizeof(int) * (2 * d + 1));
+	}
+
+	if (found)
+	{
+		int x = n, y = m;
+		for (--d; d > 0; --d)
+		{
+			const int* prev = &trace[(d - 1) * (d - 1)] + d - 1;
+			int k = x - y;
+			int down = k == -d || (k != d && prev[k - 1] < prev[k + 1]);
+			int pk = down ? k + 1 : k - 1;
+			int px = prev[pk], py = px - pk;
+			int sx = down ? px : px + 1, sy = down ? py + 1 : py;
+			while (x > sx && y > sy) match[--x] = --y + offset;
+			x = px;
+			y = py;
+		}
+		while (x > 0 && y > 0) match[--x] = --y + offset;
+	}
+	free(furthest);
+	free(trace);
+}
+
+// lines of b matched by the rows of a, -1 for rows not matched
+static void align(const unsigned long long* a, int n, const unsigned long long* b, int m, int* match)
+{
+	for (int i = 0; i < n; ++i) match[i] = -1;
+	int s = 0, e = 0;
+	while (s < n && s < m && a[s] == b[s])
+	{
+		match[s] = s;
+		++s;
+	}
+	while (e < n - s && e < m - s && a[n - 1 - e] == b[m - 1 - e])
+	{
+		match[n - 1 - e] = m - 1 - e;
+		++e;
+	}
+	if (n - s - e > 0 && m - s - e > 0) myers(&a[s], n - s - e, &b[s], m - s - e, &match[s], s);
+}
+
+// diffs each window between matched rows of the job. The unmatched rows
+// of a window pair up with its unmatched lines as changed, the ones left
+// over are added, lines left over mark the next row as having deleted
+// lines above it.
+static void run_job(struct job* job)
+{
+	long long span = trace_begin();
+	int prev = -1, prev_line = job->first_line - 1;
+	for (int r = 0; r <= job->rows; ++r)
+	{
+		if (r < job->rows && job->base[r] < 0) continue;
+		int line = r < job->rows ? job->base[r] : job->first_line + job->lines;
+		int first = prev + 1;
+		align(&job->hash[first], r - first, &job->disk[prev_line + 1 - job->first_line],
+			line - prev_line - 1, &job->base[first]);
+		for (int i = first; i < r; ++i)
+			if (job->base[i] >= 0) job->base[i] += prev_line + 1;
+
+		int last = prev_line, run = 0;
+		for (int i = first; i <= r; ++i)
+		{
+			int at = i < r ? job->base[i] : line;
+			if (at < 0)
+			{
+				++run;
+				continue;
+			}
+			int gap = at - last - 1;
+			for (int k = i - run; k < i; ++k) job->marks[k] = k - (i - run) < gap ? DIFF_CHANGED : DIFF_ADDED;
+			job->marks[i] = gap > run ? DIFF_DELETED : 0;
+			last = at;
+			run = 0;
+		}
+		prev = r;
+		prev_line = line;
+	}
+	trace_end("diff_job", span);
+}
+
+static void* worker_main(void* arg)
+{
+	(void) arg;
+	pthread_mutex_lock(&W.lock);
+	while (1)
+	{
+		while (!W.todo) pthread_cond_wait(&W.cond, &W.lock);
+		struct job* job = W.todo;
+		W.todo = NULL;
+		pthread_mutex_unlock(&W.lock);
+		run_job(job);
+		pthread_mutex_lock(&W.lock);
+		W.done = job;
+		event_wakeup();
+	}
+	return NULL;
+}
+
+// the window from the matched row p (or the top) to the matched row q (or
+// the end), in one block of memory
+static struct job* take_job(int p, int q)
+{
+	int rows = q - p - 1;
+	int first_line = p >= 0 ? D.base[p] + 1 : 0;
+	int lines = (q < D.n ? D.base[q] : D.ndisk) - first_line;
+	struct job* job = malloc(sizeof(struct job) + sizeof(unsigned long long) * (rows + lines)
+		+ sizeof(int) * rows + rows + 1);
+	job->hash = (unsigned long long*) (job + 1);
+	job->disk = job->hash + rows;
+	job->base = (int*) (job->disk + lines);
+	job->marks = (unsigned char*) (job->base + rows);
+	job->from = p + 1;
+	job->rows = rows;
+	job->first_line = first_line;
+	job->lines = lines;
+	job->edits = D.edits;
+	job->generation = D.generation;
+
+	memcpy(job->base, &D.base[p + 1], sizeof(int) * rows);
+	for (int i = 0; i < rows; ++i)
+		job->hash[i] = job->base[i] >= 0 ? D.disk[job->base[i]] : hash_row(p + 1 + i);
+	memcpy(job->disk, &D.disk[first_line], sizeof(unsigned long long) * lines);
+	return job;
+}
+
+// a job taken before the last edit or baseline is dropped, the rows it
+// covered are still dirty
+static void apply_job(struct job* job)
+{
+	if (job->generation != D.generation || job->edits != D.edits) return;
+	memcpy(&D.base[job->from], job->base, sizeof(int) * job->rows);
+	memcpy(&D.marks[job->from], job->marks, job->rows + 1);
+	D.dirty_lo = -1;
+	event_redraw();
+}
+
+static void resolve()
+{
+	if (!D.active || D.dirty_lo == -1 || D.busy) return;
+	int hi = D.dirty_hi < D.n ? D.dirty_hi : D.n;
+	int p = D.dirty_lo - 1;
+	while (p >= 0 && D.base[p] < 0) --p;
+	int q = hi;
+	while (q < D.n && D.base[q] < 0) ++q;
+
+	struct job* job = take_job(p, q);
+	if (job->rows + job->lines <= DIFF_SYNC_LINES)
+	{
+		run_job(job);
+		apply_job(job);
+		free(job);
+		return;
+	}
+
+	D.busy = 1;
+	pthread_mutex_lock(&W.lock);
+	if (!W.started)
+	{
+		if (pthread_create(&W.thread, NULL, worker_main, NULL) != 0) die("pthread_create");
+		pthread_detach(W.thread);
+		W.started = 1;
+	}
+	W.todo = job;
+	pthread_cond_signal(&W.cond);
+	pthread_mutex_unlock(&W.lock);
+}
+
+static void collect()
+{
+	pthread_mutex_lock(&W.lock);
+	struct job* job = W.done;
+	W.done = NULL;
+	pthread_mutex_unlock(&W.lock);
+	if (!job) return;
+	D.busy = 0;
+	apply_job(job);
+	free(job);
+	resolve();
+}
+
+static void touch(int lo, int hi)
+{
+	if (D.dirty_lo == -1)
+	{
+		D.dirty_lo = lo;
+		D.dirty_hi = hi;
+	}
+	if (lo < D.dirty_lo) D.dirty_lo = lo;
+	if (hi > D.dirty_hi) D.dirty_hi = hi;
+	++D.edits;
+	event_timer(0, resolve);
+}
+
+// the rows as they are now are the lines on disk
+void diff_set_baseline()
+{
+	if (E.paged)
+	{
+		diff_clear();
+		return;
+	}
+	long long span = trace_begin();
+	if (E.numrows > D.disk_cap)
+	{
+		mem_add(MEM_ROWS, (long long) sizeof(unsigned long long) * (E.numrows - D.disk_cap));
+		D.disk_cap = E.numrows;
+		D.disk = realloc(D.disk, sizeof(unsigned long long) * D.disk_cap);
+	}
+	reserve_rows(E.numrows);
+	for (int i = 0; i < E.numrows; ++i)
+	{
+		D.disk[i] = hash_row(i);
+		D.base[i] = i;
+	}
+	memset(D.marks, 0, E.numrows + 1);
+	D.ndisk = D.n = E.numrows;
+	D.active = 1;
+	D.dirty_lo = -1;
+	++D.generation;
+	event_on_wake(collect);
+	E.gutter = DIFF_GUTTER_COLS;
+	trace_end("diff_set_baseline", span);
+}
+
+// the rows from `from` on were read from the end of the file. When
+// `continued` the first of them continues the last line on disk, which had
+// no newline, and the hash of that line is taken again.
+void diff_disk_appended(int from, int continued)
+{
+	if (!D.active || from >= E.numrows) return;
+	int need = D.ndisk + E.numrows - from;
+	if (need > D.disk_cap)
+	{
+		int cap = D.disk_cap ? D.disk_cap : 1024;
+		while (cap < need) cap *= 2;
+		mem_add(MEM_ROWS, (long long) sizeof(unsigned long long) * (cap - D.disk_cap));
+		D.disk_cap = cap;
+		D.disk = realloc(D.disk, sizeof(unsigned long long) * D.disk_cap);
+	}
+	if (continued && D.ndisk > 0) --D.ndisk;
+	for (int i = from; i < E.numrows; ++i)
+	{
+		D.disk[D.ndisk] = hash_row(i);
+		D.base[i] = D.ndisk++;
+		D.marks[i] = 0;
+	}
+	D.marks[E.numrows] = 0;
+	touch(from, E.numrows);
+}
+
+// until the next diff an edited row shows as changed, unless it was added
+void diff_edit_row(int at)
+{
+	if (!D.active) return;
+	D.base[at] = -1;
+	D.marks[at] = (D.marks[at] & ~DIFF_CHANGED) | (D.marks[at] & DIFF_ADDED ? 0 : DIFF_CHANGED);
+	touch(at, at + 1);
+}
+
+void diff_insert_rows(int at, int n)
+{
+	if (!D.active) return;
+	reserve_rows(D.n + n);
+	memmove(&D.base[at + n], &D.base[at], sizeof(int) * (D.n - at));
+	memmove(&D.marks[at + n], &D.marks[at], D.n - at + 1);
+	for (int i = at; i < at + n; ++i)
+	{
+		D.base[i] = -1;
+		D.marks[i] = DIFF_ADDED;
+	}
+	D.n += n;
+	if (D.dirty_lo != -1)
+	{
+		if (D.dirty_lo > at) D.dirty_lo += n;
+		if (D.dirty_hi > at) D.dirty_hi += n;
+	}
+	touch(at, at + n);
+}
+
+void diff_delete_rows(int at, int n)
+{
+	if (!D.active) return;
+	memmove(&D.base[at], &D.base[at + n], sizeof(int) * (D.n - at - n));
+	memmove(&D.marks[at], &D.marks[at + n], D.n - at - n + 1);
+	D.n -= n;
+	D.marks[at] |= DIFF_DELETED;
+	if (D.dirty_lo != -1)
+	{
+		if (D.dirty_lo >= at + n) D.dirty_lo -= n;
+		else if (D.dirty_lo > at) D.dirty_lo = at;
+		if (D.dirty_hi >= at + n) D.dirty_hi -= n;
+		else if (D.dirty_hi > at) D.dirty_hi = at;
+	}
+	touch(at, at + 1);
+}
+
+void diff_clear()
+{
+	mem_add(MEM_ROWS, -(long long) ((sizeof(int) + 1) * D.cap + sizeof(unsigned long long) * D.disk_cap));
+	free(D.disk);
+	free(D.base);
+	free(D.marks);
+	D.disk = NULL;
+	D.base = NULL;
+	D.marks = NULL;
+	D.ndisk = D.disk_cap = D.n = D.cap = 0;
+	D.active = 0;
+	D.dirty_lo = -1;
+	++D.generation;
+	E.gutter = 0;
+}
+
+// the marks of a row, E.numrows for lines deleted at the end
+int diff_mark(int at)
+{
+	return D.active && at <= D.n ? D.marks[at] : 0;
+}
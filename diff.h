@@ -0,0 +1,33 @@
+#ifndef DIFF_H_
+#define DIFF_H_
+
+#include "editor.h"
+
+// Change gutter. The hashes of the lines on disk are taken when a file is
+// read or saved, and every row keeps the disk line it matches, or -1 once
+// edited or inserted. The rows between two matched ones are diffed against
+// the disk lines between theirs with Myers' algorithm, so an edit is only
+// ever diffed against the lines around it. Small windows are diffed right
+// away on the main thread, big ones by a worker thread; until a window is
+// diffed its edited rows show as changed. Not kept for paged files.
+
+#define DIFF_GUTTER_COLS 1
+#define DIFF_SYNC_LINES 2048 // rows and lines of a window diffed without the worker
+#define DIFF_MAX_COST 1024 // edit distance Myers gives up at, the rest pairs up by position
+
+enum diff_mark
+{
+	DIFF_ADDED = 1,
+	DIFF_CHANGED = 2,
+	DIFF_DELETED = 4 // lines on disk were deleted above the row
+};
+
+void diff_set_baseline();
+void diff_disk_appended(int from, int continued);
+void diff_edit_row(int at);
+void diff_insert_rows(int at, int n);
+void diff_delete_rows(int at, int n);
+void diff_clear();
+int diff_mark(int at);
+
+#endif
@@ -1,93 +1,229 @@
 #include "editor.h"
-
-static void enable_raw_mode();
-static void disable_raw_mode();
-static int get_window_size(int *rows, int *cols);
-static int get_cursor_position(int* rows, int* cols);
-static void init_editor();
-
-void init()
+#include "clip.h"
+#include "diff.h"
+#include "event.h"
+#include "fold.h"
+#include "longline.h"
+#include "pager.h"
+#include "trace.h"
+#include "utf8.h"
+
+// The view: scrolling and drawing into an abuf, headless like the buffer.
+// terminal.c sends the result to the screen.
+
+// columns left for the text next to the change gutter
+static int text_cols()
 {
-	enable_raw_mode();
-	init_editor();
-}
-
-int editor_row_cx_to_rx(erow *row, int cx)
-{
-	int i, rx = 0;
-
-	for (i=0; i < cx; ++i)
-	{
-		if (row->chars[i] == '\t')
-			rx += (TAB_LEN - 1) - (rx % TAB_LEN);
-		++rx;
-	}
-	return rx;
+	return E.screen_cols - E.gutter;
 }
 
 void editor_scroll()
 {
 	E.rx = 0;
 	if (E.cy < E.numrows)
-		E.rx = editor_row_cx_to_rx(&E.row[E.cy], E.cx);
+		E.rx = editor_row_cx_to_rx(editor_row_at(E.cy), E.cx);
 
-	if (E.cy < E.rowoff)
+	// rows are kept apart by screen lines, which skip the hidden ones. A
+	// jump into a fold (search, goto, undo) opens it.
+	fold_reveal(E.cy);
+	int line = fold_line(E.cy);
+	if (line < fold_line(E.rowoff))
 	{
 		E.rowoff = E.cy;
 	}
-	if (E.cy >= E.rowoff + E.screen_rows)
+	if (line >= fold_line(E.rowoff) + E.screen_rows)
 	{
-		E.rowoff = E.cy - E.screen_rows + 1;
+		E.rowoff = fold_row(line - E.screen_rows + 1);
 	}
+	E.rowoff = fold_row(fold_line(E.rowoff));
 
 	if (E.rx < E.coloff)
 	{
 		E.coloff = E.rx;
 	}
-	if (E.rx >= E.coloff + E.screen_cols)
+	if (E.rx >= E.coloff + text_cols())
 	{
-		E.coloff = E.rx - E.screen_cols + 1;
+		E.coloff = E.rx - text_cols() + 1;
 	}
 }
 
-void refresh_screen()
+// a control character or a byte the terminal can't show, in reverse video
+static void draw_symbol(struct abuf* ab, char sym, int current_color)
 {
-	editor_scroll();
+	ab_append(ab, "\x1b[7m", 4);
+	ab_append(ab, &sym, 1);
+	ab_append(ab, "\x1b[m", 3);
+	if (current_color != -1)
+	{
+		char buf[16];
+		int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
+		ab_append(ab, buf, clen);
+	}
+}
 
-	struct abuf ab = ABUF_INIT;
+// screen columns of the row inside the selection, [from, to)
+struct selected
+{
+	int from;
+	int to;
+	int newline; // the selection goes on past the end of the row
+	int on; // reverse video is on
+};
 
-	ab_append(&ab, "\x1b[?25l", 6);  // hide cursor
-	ab_append(&ab, "\x1b[H", 3);     // move cursor to col:1, row:1
+static void find_selected(struct selected* sel, int filerow, erow* row)
+{
+	memset(sel, 0, sizeof(*sel));
+	int r0, c0, r1, c1;
+	if (!clip_selection(&r0, &c0, &r1, &c1) || filerow < r0 || filerow > r1) return;
+	int from = filerow == r0 ? c0 : 0;
+	int to = filerow == r1 ? c1 : row->size;
+	if (from > row->size) from = row->size;
+	if (to > row->size) to = row->size;
+	sel->from = editor_row_cx_to_rx(row, from) - E.coloff;
+	sel->to = editor_row_cx_to_rx(row, to) - E.coloff;
+	sel->newline = filerow < r1;
+}
 
-	draw_rows(&ab);
-	draw_status_bar(&ab);
-	draw_message_bar(&ab);
+// turns reverse video on or off for the column about to be drawn
+static void draw_selected(struct abuf* ab, struct selected* sel, int col)
+{
+	int in = col >= sel->from && col < sel->to;
+	if (in == sel->on) return;
+	sel->on = in;
+	if (in) ab_append(ab, "\x1b[7m", 4);
+	else ab_append(ab, "\x1b[27m", 5);
+}
 
-	// move cursor
-	char buf[32];
-	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy-E.rowoff)+1, (E.rx-E.coloff)+1);
-	ab_append(&ab, buf, strlen(buf));
+// draws a row that isn't pure ASCII a cluster at a time, a wide character
+// cut by the edge of the screen shows as spaces. Returns the columns drawn.
+static int draw_utf8(struct abuf* ab, erow* row, int len, int base, struct selected* sel)
+{
+	int cut;
+	int o = utf8_render_at(row, len, base, E.coloff, &cut);
+	int col = 0;
+	int current_color = -1;
+	while (o < len && col < text_cols())
+	{
+		char* c = &row->render[o];
+		unsigned char hl = row->hl[o];
+		int width;
+		int n = utf8_cluster(c, len - o, &width);
+		o += n;
+
+		draw_selected(ab, sel, col);
+		if (cut || col + width > text_cols())
+		{
+			width -= cut;
+			cut = 0;
+			if (col + width > text_cols()) width = text_cols() - col;
+			for (int i = 0; i < width; ++i) ab_append(ab, " ", 1);
+			col += width;
+			continue;
+		}
+
+		int color = hl == HL_NORMAL ? -1 : editor_syntax_to_color(hl);
+		if (color != current_color)
+		{
+			current_color = color;
+			char buf[16];
+			int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color == -1 ? 39 : color);
+			ab_append(ab, buf, clen);
+		}
+		if (!(c[0] & 0x80) && iscntrl(c[0])) draw_symbol(ab, (c[0] < 26) ? '@' + c[0] : '?', current_color);
+		else if (!utf8_printable(c, n)) draw_symbol(ab, '?', current_color);
+		else ab_append(ab, c, n);
+		if ((!(c[0] & 0x80) && iscntrl(c[0])) || !utf8_printable(c, n)) sel->on = 0; // draw_symbol reset it
+		col += width;
+	}
+	return col;
+}
+
+// draws a pure ASCII row, a byte per column
+static int draw_ascii(struct abuf* ab, erow* row, int base, struct selected* sel)
+{
+	int len = row->rsize - E.coloff;
+	if (len < 0) len = 0;
+	if (len > text_cols()) len = text_cols();
+
+	int from = E.coloff - base;
+	char* c = &row->render[from];
+	unsigned char* hl = &row->hl[from];
+	int current_color = -1;
+	int j;
+	for (j = 0; j < len; ++j)
+	{
+		draw_selected(ab, sel, j);
+		if (iscntrl(c[j]))
+		{
+			draw_symbol(ab, (c[j] < 26) ? '@' + c[j] : '?', current_color);
+			sel->on = 0; // draw_symbol reset it
+		}
+		else if (hl[j] == HL_NORMAL)
+		{
+			if (current_color != -1)
+			{
+				ab_append(ab, "\x1b[39m", 5);
+				current_color = -1;
+			}
+			ab_append(ab, &c[j], 1);
+		}
+		else
+		{
+			int color = editor_syntax_to_color(hl[j]);
+			if (color != current_color)
+			{
+				current_color = color;
+				char buf[16];
+				int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+				ab_append(ab, buf, clen);
+			}
+			ab_append(ab, &c[j], 1);
+		}
+	}
+	return len;
+}
 
-	ab_append(&ab, "\x1b[?25h", 6); // show cursor
-	write(STDIN_FILENO, ab.b, ab.len);
-	ab_free(&ab);
+// the change mark of a row, lines deleted at the end show past the last row
+static void draw_gutter(struct abuf* ab, int filerow)
+{
+	int mark = diff_mark(filerow);
+	if (mark & DIFF_ADDED) ab_append(ab, "\x1b[32m+\x1b[39m", 11);
+	else if (mark & DIFF_CHANGED) ab_append(ab, "\x1b[33m~\x1b[39m", 11);
+	else if (mark & DIFF_DELETED) ab_append(ab, "\x1b[31m-\x1b[39m", 11);
+	else ab_append(ab, " ", 1);
+}
+
+// marks the header of a collapsed fold after its text
+static void draw_fold(struct abuf* ab, int hidden, int col)
+{
+	char buf[32];
+	int len = snprintf(buf, sizeof(buf), " +%d lines ", hidden);
+	if (col < text_cols()) ab_append(ab, " ", 1);
+	if (len > text_cols() - col - 1) len = text_cols() - col - 1;
+	if (len <= 0) return;
+	ab_append(ab, "\x1b[7m", 4);
+	ab_append(ab, buf, len);
+	ab_append(ab, "\x1b[m", 3);
 }
 
 void draw_rows(struct abuf *ab)
 {
+	long long span = trace_begin();
+	int top = fold_line(E.rowoff);
 	int y;
 	for (y = 0; y < E.screen_rows; ++y)
 	{
-		int filerow = y + E.rowoff;
+		int filerow = fold_row(top + y);
+		if (E.gutter) draw_gutter(ab, filerow);
 		if (filerow >= E.numrows)
 		{
 			if (E.numrows == 0 && y == E.screen_rows / 3)
 			{
 				char welcome[80];
 				int welcome_len = snprintf(welcome, sizeof(welcome), "Yolo editor -- version %s", YOLO_VERSION);
-				if (welcome_len > E.screen_cols)
-					welcome_len = E.screen_cols;
-				int padding = (E.screen_cols - welcome_len) / 2;
+				if (welcome_len > text_cols())
+					welcome_len = text_cols();
+				int padding = (text_cols() - welcome_len) / 2;
 				if (padding)
 				{
 					ab_append(ab, "~", 1);
@@ -104,56 +240,31 @@ void draw_rows(struct abuf *ab)
 		}
 		else
 		{
-			int len = E.row[filerow].rsize - E.coloff;
-			if (len < 0) len = 0;
-			if (len > E.screen_cols) len = E.screen_cols;
-
-			char* c = &E.row[filerow].render[E.coloff];
-			unsigned char* hl = &E.row[filerow].hl[E.coloff];
-			int current_color = -1;
-			int j;
-			for (j = 0; j < len; ++j)
+			erow* row = editor_row_at(filerow);
+			int bytes = row->rsize;
+			int base = row->wide ? longline_window(row, E.coloff, text_cols(), &bytes) : 0;
+			struct selected sel;
+			find_selected(&sel, filerow, row);
+			int col;
+			if (row->cols || (row->wide && !utf8_is_ascii(row->render, bytes))) col = draw_utf8(ab, row, bytes, base, &sel);
+			else col = draw_ascii(ab, row, base, &sel);
+			// a selected line break shows as a reverse space
+			if (sel.newline && sel.to == col && col < text_cols())
 			{
-				if (iscntrl(c[j]))
-				{
-					char sym = (c[j] < 26) ? '@' + c[j] : '?';
-					ab_append(ab, "\x1b[7m", 4);
-					ab_append(ab, &sym, 1);
-					ab_append(ab, "\x1b[m", 3);
-					if (current_color != -1)
-					{
-						char buf[16];
-						int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-						ab_append(ab, buf, clen);
-					}
-				}
-				else if (hl[j] == HL_NORMAL)
-				{
-					if (current_color != -1)
-					{
-						ab_append(ab, "\x1b[39m", 5);
-						current_color = -1;
-					}
-					ab_append(ab, &c[j], 1);
-				}
-				else
-				{
-					int color = editor_syntax_to_color(hl[j]);
-					if (color != current_color)
-					{
-						current_color = color;
-						char buf[16];
-						int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-						ab_append(ab, buf, clen);
-					}
-					ab_append(ab, &c[j], 1);
-				}
+				if (!sel.on) ab_append(ab, "\x1b[7m", 4);
+				ab_append(ab, " ", 1);
+				sel.on = 1;
+				++col;
 			}
+			if (sel.on) ab_append(ab, "\x1b[27m", 5);
 			ab_append(ab, "\x1b[39m", 5);
+			int hidden = fold_hidden(filerow);
+			if (hidden) draw_fold(ab, hidden, col);
 		}
 		ab_append(ab, "\x1b[K", 3); // clear line
 		ab_append(ab, "\r\n", 2);
 	}
+	trace_end("draw_rows", span);
 }
 
 
@@ -161,19 +272,30 @@ void draw_status_bar(struct abuf* ab)
 {
 	ab_append(ab, "\x1b[7m", 4);
 
-	char status[80], rstatus[80];
+	char status[80], rstatus[160], mode[40] = "";
+	if (E.paged)
+	{
+		int progress = pager_progress();
+		if (progress < 0) snprintf(mode, sizeof(mode), "[paged] ");
+		else snprintf(mode, sizeof(mode), "[paged, indexing %d%%] ", progress);
+	}
+	if (E.following)
+		strcat(mode, "[follow] ");
 	int len = snprintf(
 		status,
 		sizeof(status),
-		"%.20s - %d lines %s",
+		"%.20s - %d lines %s%s",
 		E.filename ? E.filename : "[No Name]",
 		E.numrows,
+		mode,
 		E.is_dirty ? "(modified)": "");
-	int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
+	int rlen = snprintf(rstatus, sizeof(rstatus), "%s%s%s | %d/%d",
+						E.hud ? E.hud : "", E.hud ? " | " : "",
 						E.syntax ? E.syntax->filetype : "no ft", E.cy + 1, E.numrows);
 
 
-	if (len > E.screen_cols) len = E.screen_cols;
+	if (rlen > E.screen_cols) rlen = E.screen_cols;
+	if (len > E.screen_cols - rlen) len = E.screen_cols - rlen; // the right side carries the HUD
 	ab_append(ab, status, len);
 
 	// int rlen = snprintf(
@@ -203,109 +325,64 @@ void draw_message_bar(struct abuf* ab)
 	ab_append(ab, "\x1b[K", 3);
 	int msg_len = strlen(E.status_msg);
 	if (msg_len > E.screen_cols) msg_len = E.screen_cols;
-	if (msg_len && time(NULL) - E.status_msg_time < 5)
+	if (msg_len && time(NULL) - E.status_msg_time < STATUS_MSG_TIMEOUT)
 		ab_append(ab, E.status_msg, msg_len);
 }
 
-void set_status_message(const char* fmt, ...)
-{
-	va_list ap;
-	va_start(ap, fmt);
-	vsnprintf(E.status_msg, sizeof(E.status_msg), fmt, ap);
-	va_end(ap);
-	E.status_msg_time = time(NULL);
-}
 
-static void enable_raw_mode()
+static int text_width(const char* s)
 {
-	if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1)
-		die("tcgetattr");
-	atexit(disable_raw_mode);
-
-	struct termios config = E.orig_termios;
-	config.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
-	config.c_oflag &= ~OPOST;
-	config.c_cflag |= CS8;
-	config.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
-	config.c_cc[VMIN] = 0;
-	config.c_cc[VTIME] = 1;
-
-	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &config) == -1)
-		die("tcsetattr");
-}
-
-static void disable_raw_mode()
-{
-	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
-		die("tcsetattr");
+	int len = strlen(s), width = 0, cols;
+	for (int i = 0; i < len; i += utf8_cluster(&s[i], len - i, &cols)) width += cols;
+	return width;
 }
 
-static int get_window_size(int *rows, int *cols)
+// the completion list, drawn over the rows under the cursor or above it
+// when there is no room below, with the pick highlighted
+void draw_popup(struct abuf* ab)
 {
-	struct winsize ws;
+	if (E.popup_len == 0 || E.cy >= E.numrows) return;
 
-	if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+	int width = 0;
+	for (int i = 0; i < E.popup_len; ++i)
 	{
-		// plan b to get the screensize
-		if (write(STDIN_FILENO, "\x1b[999C\x1b[999B", 12) != 12)
-			return -1;
-		return get_cursor_position(rows, cols);
+		int w = text_width(E.popup[i]);
+		if (w > width) width = w;
 	}
-	else
+	width += 2;
+	if (width > E.screen_cols) width = E.screen_cols;
+	int col = E.gutter + editor_row_cx_to_rx(editor_row_at(E.cy), E.popup_cx) - E.coloff;
+	if (col + width > E.screen_cols) col = E.screen_cols - width;
+	if (col < 0) col = 0;
+
+	int line = fold_line(E.cy) - fold_line(E.rowoff);
+	int n = E.popup_len;
+	int top = line + 1;
+	if (top + n > E.screen_rows)
 	{
-		*cols = ws.ws_col;
-		*rows = ws.ws_row;
-		return 0;
+		if (line >= n) top = line - n;
+		else n = E.screen_rows - top;
 	}
-}
-
-// helper for plan b to get the screensize
-static int get_cursor_position(int* rows, int* cols)
-{
-	if (write(STDIN_FILENO, "\x1b[6n", 4) != 4)
-		return -1;
 
 	char buf[32];
-	unsigned int i = 0;
-
-	while (i < sizeof(buf)-1)
+	for (int i = 0; i < n; ++i)
 	{
-		if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
-		if (buf[i] == 'R') break;
-		++i;
+		int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", top + i + 1, col + 1);
+		ab_append(ab, buf, len);
+		ab_append(ab, i == E.popup_pick ? "\x1b[44;97m " : "\x1b[47;30m ", 9);
+		// a word wider than the screen is cut at a cluster
+		int left = width - 1;
+		int bytes = strlen(E.popup[i]), cols;
+		int used = 0;
+		for (int at = 0; at < bytes; )
+		{
+			int step = utf8_cluster(&E.popup[i][at], bytes - at, &cols);
+			if (used + cols > left) break;
+			ab_append(ab, &E.popup[i][at], step);
+			used += cols;
+			at += step;
+		}
+		while (used++ < left) ab_append(ab, " ", 1);
+		ab_append(ab, "\x1b[m", 3);
 	}
-	buf[i] = '\0';
-	printf("\r\n&buf[1]: '%s'\r\n", &buf[1]);
-
-	if (buf[0] != '\x1b' || buf[1] != '[') return -1;
-	if (sscanf(&buf[2], "%d;%d", rows, cols) != 2) return -1;
-
-	return 0;
-}
-
-static void init_editor()
-{
-	E.cx = 0;
-	E.cy = 0;
-	E.rx = 0;
-	E.rowoff = 0;
-	E.coloff = 0;
-	E.numrows = 0;
-	E.row = NULL;
-	if (get_window_size(&E.screen_rows, &E.screen_cols) == -1)
-		die("get_window_size");
-	E.screen_rows -= 2; // status bar height
-	E.filename = NULL;
-	E.status_msg[0] = '\0';
-	E.status_msg_time = 0;
-	E.is_dirty = 0;
-	E.syntax = NULL;
-}
-
-void die(const char *s)
-{
-	write(STDIN_FILENO, "\x1b[2J", 4); // clear entire screen
-	write(STDIN_FILENO, "\x1b[H", 3);  // move cursor to col:1, row:1
-	perror(s);
-	exit(1);
 }
@@ -6,6 +6,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <termios.h>
 #include <time.h>
@@ -24,14 +25,21 @@ typedef struct erow
 	int idx;
 	int size;
 	int rsize;
+	int cap; // bytes of the block holding chars, render and hl
+	unsigned int pin; // see rowmem_pin
 	char* chars;
 	char* render;
 	unsigned char* hl;
 	int hl_open_comment;
+	int chars_cap;
+	int cold_off;
+	unsigned int last_use; // E.row_clock when the row was last accessed
+	struct cold_block* cold; // compressed text while the row is cold
+	struct long_line* wide; // chunk index while the row is in long-line mode
+	struct row_cols* cols; // column stops while the render isn't pure ASCII
 
 } erow;
 
-struct termios original_term_config;
 struct editor_config
 {
 	int key_pressed; // debug
@@ -41,26 +49,82 @@ struct editor_config
 	int coloff;
 	int screen_rows;
 	int screen_cols;
+	int gutter; // columns of the change gutter left of the text
 	struct editor_syntax* syntax;
 	struct termios orig_termios;
 	int numrows;
+	int row_capacity;
 	erow* row;
+	unsigned int row_clock;
+	int paged;
+	int following;
 	int is_dirty;
 	char* filename;
+	long long file_size; // bytes of the file on disk that the buffer was read from
 	char status_msg[80];
 	time_t status_msg_time;
+	const char* hud; // set by the front end, shown in the status bar
+	const char** popup; // completions listed under the cursor, set by the front end
+	int popup_len;
+	int popup_pick;
+	int popup_cx; // where the word being completed starts on the cursor row
+	int sel_active;
+	int sel_cx, sel_cy; // where the selection started, the cursor is its other end
 };
 extern struct editor_config E;
 
+// terminal front end (terminal.c, main.c)
 void init();
-void editor_scroll();
 void refresh_screen();
+void editor_update_window_size();
+void editor_recover();
+
+// view (editor.c)
+void editor_scroll();
 void draw_rows(struct abuf* ab);
 void draw_status_bar(struct abuf* ab);
 void draw_message_bar(struct abuf* ab);
-void set_status_message(const char* fmt, ...);
+void draw_popup(struct abuf* ab);
 
+// buffer (buffer.c), usable without a terminal
+void editor_core_init(int rows, int cols);
+void editor_on_die(void (*callback)());
+void set_status_message(const char* fmt, ...);
 int editor_row_cx_to_rx(erow* row, int cx);
+int editor_row_rx_to_cx(erow* row, int rx);
+
+// row operations
+erow* editor_row_at(int at);
+erow* editor_row_peek(int at);
+erow* editor_row_lexable(int at);
+erow* editor_row_mut(int at);
+void editor_update_row(erow* row);
+void editor_insert_rows(int at, int n, char** lines, size_t* lens);
+void editor_insert_row(int at, char* s, size_t len);
+void editor_free_row(erow* row);
+void editor_del_rows(int at, int n);
+void editor_del_row(int at);
+void editor_row_insert_string(erow* row, int at, char* s, size_t len);
+void editor_row_append_string(erow* row, char* s, size_t len);
+void editor_row_del_char(erow* row, int at);
+void editor_row_del_string(erow* row, int at, size_t len);
+void editor_row_set_text(erow* row, const char* s, size_t len);
+
+// edits at the cursor
+void insert_char(int c);
+void insert_lines(char** lines, size_t* lens, int n);
+void insert_text(char* s, size_t len);
+void insert_new_line();
+void del_char();
+
+// file i/o and search
+char* editor_rows_to_string(int* buffer_len);
+void editor_open(char* filename);
+void editor_close();
+void editor_reload();
+long long editor_write_file();
+int editor_search(const char* query, int from, int direction, int* cx, int* rx);
+long long editor_replace_all(const char* query, const char* with, int* rows, int undoable);
 
 // utils
 void die(const char *s);
@@ -0,0 +1,223 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+
+#include "event.h"
+
+struct watch
+{
+	int fd;
+	void (*callback)();
+};
+
+struct timer
+{
+	long long deadline;
+	void (*callback)();
+};
+
+static struct
+{
+	int pipe[2];
+	struct watch watches[EVENT_MAX_WATCHES];
+	int nwatches;
+	struct timer timers[EVENT_MAX_TIMERS];
+	int ntimers;
+	void (*wake[EVENT_MAX_WATCHES])();
+	int nwake;
+	int redraw;
+	long long last_frame;
+	int (*frame)();
+	void (*resize)();
+} EV;
+
+long long event_now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void on_sigwinch(int sig)
+{
+	(void) sig;
+	int saved = errno;
+	write(EV.pipe[1], "r", 1);
+	errno = saved;
+}
+
+void event_init()
+{
+	if (pipe2(EV.pipe, O_NONBLOCK | O_CLOEXEC) == -1) die("pipe2");
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_sigwinch;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGWINCH, &sa, NULL) == -1) die("sigaction");
+}
+
+// the front end: frame draws the screen and returns 0 when it had to drop
+// the frame, resize picks up a new terminal size. Without a front end the
+// loop doesn't draw and doesn't watch stdin, which is how it runs headless.
+void event_on_frame(int (*callback)())
+{
+	EV.frame = callback;
+}
+
+void event_on_resize(void (*callback)())
+{
+	EV.resize = callback;
+}
+
+void event_watch(int fd, void (*callback)())
+{
+	if (EV.nwatches == EVENT_MAX_WATCHES) return;
+	EV.watches[EV.nwatches].fd = fd;
+	EV.watches[EV.nwatches].callback = callback;
+	++EV.nwatches;
+}
+
+void event_unwatch(int fd)
+{
+	for (int i = 0; i < EV.nwatches; ++i)
+	{
+		if (EV.watches[i].fd != fd) continue;
+		EV.watches[i] = EV.watches[--EV.nwatches];
+		return;
+	}
+}
+
+// callbacks run on the main thread whenever a background thread calls event_wakeup
+void event_on_wake(void (*callback)())
+{
+	for (int i = 0; i < EV.nwake; ++i)
+		if (EV.wake[i] == callback) return;
+	if (EV.nwake < EVENT_MAX_WATCHES) EV.wake[EV.nwake++] = callback;
+}
+
+// safe to call from any thread
+void event_wakeup()
+{
+	write(EV.pipe[1], "w", 1);
+}
+
+// arms a one-shot timer, re-arming moves the deadline of the same callback
+void event_timer(long ms, void (*callback)())
+{
+	long long deadline = event_now_ms() + ms;
+	int i;
+	for (i = 0; i < EV.ntimers; ++i)
+		if (EV.timers[i].callback == callback) break;
+	if (i == EV.ntimers)
+	{
+		if (EV.ntimers == EVENT_MAX_TIMERS) return;
+		++EV.ntimers;
+	}
+	EV.timers[i].deadline = deadline;
+	EV.timers[i].callback = callback;
+}
+
+void event_redraw()
+{
+	EV.redraw = 1;
+}
+
+static void run_timers(long long now)
+{
+	int i = 0;
+	while (i < EV.ntimers)
+	{
+		if (EV.timers[i].deadline > now)
+		{
+			++i;
+			continue;
+		}
+		void (*callback)() = EV.timers[i].callback;
+		EV.timers[i] = EV.timers[--EV.ntimers];
+		callback();
+	}
+}
+
+static void drain_pipe()
+{
+	char buf[64];
+	ssize_t n;
+	int resized = 0;
+	int woken = 0;
+
+	while ((n = read(EV.pipe[0], buf, sizeof(buf))) > 0)
+	{
+		for (ssize_t i = 0; i < n; ++i)
+		{
+			if (buf[i] == 'r') resized = 1;
+			else woken = 1;
+		}
+	}
+
+	if (resized && EV.resize)
+	{
+		EV.resize();
+		EV.redraw = 1;
+	}
+	if (woken)
+		for (int i = 0; i < EV.nwake; ++i) EV.wake[i]();
+}
+
+// runs timers, callbacks and frames until stdin is readable (returns 1) or
+// timeout_ms passes (returns 0). A negative timeout waits for input.
+int event_wait(int timeout_ms)
+{
+	long long deadline = timeout_ms < 0 ? -1 : event_now_ms() + timeout_ms;
+	struct pollfd fds[EVENT_MAX_WATCHES + 2];
+
+	while (1)
+	{
+		long long now = event_now_ms();
+		run_timers(now);
+
+		if (EV.redraw && !EV.frame) EV.redraw = 0;
+		if (EV.redraw && now - EV.last_frame >= FRAME_INTERVAL_MS)
+		{
+			// a dropped frame stays pending for the next interval
+			EV.last_frame = now;
+			if (EV.frame()) EV.redraw = 0;
+		}
+
+		long long wake = deadline;
+		for (int i = 0; i < EV.ntimers; ++i)
+			if (wake == -1 || EV.timers[i].deadline < wake) wake = EV.timers[i].deadline;
+		if (EV.redraw && (wake == -1 || EV.last_frame + FRAME_INTERVAL_MS < wake))
+			wake = EV.last_frame + FRAME_INTERVAL_MS;
+		int timeout = wake == -1 ? -1 : (wake > now ? (int) (wake - now) : 0);
+
+		fds[0].fd = EV.frame ? STDIN_FILENO : -1; // poll skips negative fds
+		fds[0].events = POLLIN;
+		fds[1].fd = EV.pipe[0];
+		fds[1].events = POLLIN;
+		int nwatches = EV.nwatches;
+		for (int i = 0; i < nwatches; ++i)
+		{
+			fds[i + 2].fd = EV.watches[i].fd;
+			fds[i + 2].events = POLLIN;
+		}
+
+		int n = poll(fds, nwatches + 2, timeout);
+		if (n == -1 && errno != EINTR) die("poll");
+		if (n > 0)
+		{
+			if (fds[1].revents) drain_pipe();
+			for (int i = 0; i < nwatches; ++i)
+				if (fds[i + 2].revents && i < EV.nwatches && EV.watches[i].fd == fds[i + 2].fd)
+					EV.watches[i].callback();
+			if (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL)) die("stdin");
+			if (fds[0].revents) return 1;
+		}
+
+		if (deadline != -1 && event_now_ms() >= deadline) return 0;
+	}
+}
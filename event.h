@@ -0,0 +1,28 @@
+#ifndef EVENT_H_
+#define EVENT_H_
+
+#include "editor.h"
+
+// poll(2) based event loop. Stdin, a self-pipe fed by SIGWINCH and by
+// background threads, watched descriptors and one-shot timers are all
+// waited on together, and redraw requests are coalesced into at most one
+// frame per FRAME_INTERVAL_MS.
+
+#define FRAME_INTERVAL_MS 16
+#define STATUS_MSG_TIMEOUT 5 // seconds
+#define EVENT_MAX_WATCHES 8
+#define EVENT_MAX_TIMERS 16
+
+void event_init();
+void event_on_frame(int (*callback)());
+void event_on_resize(void (*callback)());
+void event_watch(int fd, void (*callback)());
+void event_unwatch(int fd);
+void event_on_wake(void (*callback)());
+void event_wakeup();
+void event_timer(long ms, void (*callback)());
+void event_redraw();
+int event_wait(int timeout_ms);
+long long event_now_ms();
+
+#endif
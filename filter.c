@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include "cold.h"
+#include "filter.h"
+#include "trace.h"
+
+static struct
+{
+	int in; // next row to send
+	size_t off; // bytes of it sent, counting its newline
+	int out; // next row an output line takes the place of
+	int end; // one past the last row of the range
+	char* pend; // output not placed yet, ends with a partial line
+	size_t pend_len;
+	size_t pend_cap;
+	char** lines; // output lines inserted together
+	size_t* lens;
+	int lines_cap;
+	int produced; // the command wrote something to stdout
+} X;
+
+static void add_line(int n, char* s, size_t len)
+{
+	if (n == X.lines_cap)
+	{
+		X.lines_cap = X.lines_cap ? X.lines_cap * 2 : 256;
+		X.lines = realloc(X.lines, sizeof(char*) * X.lines_cap);
+		X.lens = realloc(X.lens, sizeof(size_t) * X.lines_cap);
+	}
+	X.lines[n] = s;
+	X.lens[n] = len;
+}
+
+// puts the complete lines of the output in place, and the partial one too
+// once the output ended
+static void place_lines(int final)
+{
+	char* p = X.pend;
+	char* end = X.pend + X.pend_len;
+	int n = 0;
+	while (p < end)
+	{
+		char* nl = memchr(p, '\n', end - p);
+		if (!nl && !final) break;
+		size_t len = (nl ? nl : end) - p;
+		if (len > 0 && p[len - 1] == '\r') --len;
+		if (X.out < X.in) editor_row_set_text(editor_row_mut(X.out++), p, len);
+		else add_line(n++, p, len);
+		p = nl ? nl + 1 : end;
+	}
+
+	// no rows sent are left to replace, the rest goes in before the unsent ones
+	if (n > 0)
+	{
+		editor_insert_rows(X.out, n, X.lines, X.lens);
+		X.out += n;
+		X.in += n;
+		X.end += n;
+	}
+	X.pend_len = end - p;
+	memmove(X.pend, p, X.pend_len);
+}
+
+// one writev of the rows from X.in on: 1 when some went out, 0 when the
+// pipe is full and -1 when the command stopped reading
+static int send_batch(int fd)
+{
+	struct iovec iov[2 * FILTER_WRITE_ROWS];
+	int n = 0;
+	for (int at = X.in; at < X.end && n + 2 <= 2 * FILTER_WRITE_ROWS; ++at)
+	{
+		erow* row = &E.row[at];
+		const char* text = row->cold ? cold_text(row) : row->chars;
+		size_t skip = at == X.in ? X.off : 0;
+		if (skip < (size_t) row->size)
+		{
+			iov[n].iov_base = (char*) text + skip;
+			iov[n++].iov_len = row->size - skip;
+		}
+		iov[n].iov_base = "\n";
+		iov[n++].iov_len = 1;
+		// the text of a cold row is only good until another block is decompressed
+		if (row->cold) break;
+	}
+
+	ssize_t w = writev(fd, iov, n);
+	if (w == -1) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	size_t left = w;
+	while (left > 0)
+	{
+		size_t row_left = E.row[X.in].size + 1 - X.off;
+		if (left < row_left)
+		{
+			X.off += left;
+			break;
+		}
+		left -= row_left;
+		X.off = 0;
+		++X.in;
+	}
+	return 1;
+}
+
+// writes rows until the pipe is full, returns 0 once there's no more to
+// write or the command stopped reading
+static int send_rows(int fd)
+{
+	for (;;)
+	{
+		int sent = send_batch(fd);
+		if (sent <= 0) return sent == 0;
+		if (X.in >= X.end) return 0;
+	}
+}
+
+// reads until the pipe is empty, returns 0 at the end of the output
+static int read_output(int fd)
+{
+	for (;;)
+	{
+		if (X.pend_cap - X.pend_len < FILTER_READ_BLOCK)
+		{
+			X.pend_cap = X.pend_len + FILTER_READ_BLOCK;
+			X.pend = realloc(X.pend, X.pend_cap);
+		}
+		ssize_t n = read(fd, &X.pend[X.pend_len], FILTER_READ_BLOCK);
+		if (n == -1) return errno == EAGAIN || errno == EINTR;
+		if (n == 0) return 0;
+		X.pend_len += n;
+		X.produced = 1;
+		place_lines(0);
+	}
+}
+
+static int read_errors(int fd, char* err)
+{
+	char buf[512];
+	ssize_t n = read(fd, buf, sizeof(buf));
+	if (n == -1) return errno == EAGAIN || errno == EINTR;
+	if (n == 0) return 0;
+	size_t len = strlen(err);
+	size_t take = FILTER_ERR_LEN - 1 - len < (size_t) n ? FILTER_ERR_LEN - 1 - len : (size_t) n;
+	memcpy(&err[len], buf, take);
+	err[len + take] = '\0';
+	return 1;
+}
+
+static void close_fd(int* fd)
+{
+	if (*fd != -1) close(*fd);
+	*fd = -1;
+}
+
+// runs `sh -c command` with rows [from, to) on its stdin and puts its
+// output in their place. Returns the exit status of the command, or -1
+// if it couldn't be run; *out_rows gets the number of rows the output
+// made, -1 when the command failed without any output and the rows were
+// left as they were, and err (FILTER_ERR_LEN bytes) the start of what
+// went to stderr
+int editor_filter(int from, int to, const char* command, int* out_rows, char* err)
+{
+	*out_rows = -1;
+	err[0] = '\0';
+	if (E.paged)
+	{
+		snprintf(err, FILTER_ERR_LEN, "can't filter a paged file");
+		return -1;
+	}
+
+	// stdin, stdout and stderr of the command, and the errno of a failed
+	// exec, closed by a successful one
+	int fds[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+	for (int i = 0; i < 8; i += 2)
+	{
+		if (pipe2(&fds[i], O_CLOEXEC) == -1)
+		{
+			snprintf(err, FILTER_ERR_LEN, "pipe: %s", strerror(errno));
+			for (int j = 0; j < i; ++j) close(fds[j]);
+			return -1;
+		}
+	}
+
+	// a command that stops reading early must not kill the editor
+	struct sigaction ignore, old;
+	memset(&ignore, 0, sizeof(ignore));
+	ignore.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &ignore, &old);
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		signal(SIGPIPE, SIG_DFL);
+		dup2(fds[0], STDIN_FILENO);
+		dup2(fds[3], STDOUT_FILENO);
+		dup2(fds[5], STDERR_FILENO);
+		execl("/bin/sh", "sh", "-c", command, (char*) NULL);
+		int e = errno;
+		write(fds[7], &e, sizeof(e));
+		_exit(127);
+	}
+	close(fds[0]);
+	close(fds[3]);
+	close(fds[5]);
+	close(fds[7]);
+	int exec_errno = 0;
+	if (pid != -1)
+	{
+		ssize_t n;
+		while ((n = read(fds[6], &exec_errno, sizeof(exec_errno))) == -1 && errno == EINTR);
+		if (n != sizeof(exec_errno)) exec_errno = 0;
+	}
+	close(fds[6]);
+	if (pid == -1 || exec_errno)
+	{
+		if (pid == -1) snprintf(err, FILTER_ERR_LEN, "fork: %s", strerror(errno));
+		else snprintf(err, FILTER_ERR_LEN, "can't run /bin/sh: %s", strerror(exec_errno));
+		if (pid != -1) while (waitpid(pid, NULL, 0) == -1 && errno == EINTR);
+		close(fds[1]);
+		close(fds[2]);
+		close(fds[4]);
+		sigaction(SIGPIPE, &old, NULL);
+		return -1;
+	}
+
+	long long span = trace_begin();
+	int fd[3] = { fds[1], fds[2], fds[4] };
+	for (int i = 0; i < 3; ++i) fcntl(fd[i], F_SETFL, fcntl(fd[i], F_GETFL) | O_NONBLOCK);
+	// bigger pipes mean fewer switches between the editor and the command
+	fcntl(fd[0], F_SETPIPE_SZ, FILTER_PIPE_SIZE);
+	fcntl(fd[1], F_SETPIPE_SZ, FILTER_PIPE_SIZE);
+
+	X.in = X.out = from;
+	X.end = to;
+	X.off = 0;
+	X.pend_len = 0;
+	X.produced = 0;
+	editor_syntax_defer();
+	if (X.in >= X.end) close_fd(&fd[0]);
+	while (fd[0] != -1 || fd[1] != -1 || fd[2] != -1)
+	{
+		struct pollfd p[3] = {
+			{ fd[0], POLLOUT, 0 },
+			{ fd[1], POLLIN, 0 },
+			{ fd[2], POLLIN, 0 }
+		};
+		if (poll(p, 3, -1) == -1)
+		{
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (p[0].revents && !send_rows(fd[0])) close_fd(&fd[0]);
+		if (p[1].revents && !read_output(fd[1])) close_fd(&fd[1]);
+		if (p[2].revents && !read_errors(fd[2], err)) close_fd(&fd[2]);
+	}
+	for (int i = 0; i < 3; ++i) close_fd(&fd[i]);
+
+	int status;
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+	sigaction(SIGPIPE, &old, NULL);
+	int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+	// output only ever takes the place of rows, so a command that failed
+	// before writing anything (not found, bad arguments) changed nothing.
+	// Otherwise what it didn't read is dropped with the rows it replaced.
+	if (X.produced || code == 0)
+	{
+		place_lines(1);
+		editor_del_rows(X.out, X.end - X.out);
+		*out_rows = X.out - from;
+	}
+	editor_syntax_flush();
+
+	free(X.pend);
+	free(X.lines);
+	free(X.lens);
+	X.pend = NULL;
+	X.lines = NULL;
+	X.lens = NULL;
+	X.pend_cap = 0;
+	X.lines_cap = 0;
+	trace_end("filter", span);
+	return code;
+}
@@ -0,0 +1,24 @@
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include "editor.h"
+
+// Filtering rows through a shell command. The rows are written to the
+// command's stdin while its stdout is read, both non-blocking under one
+// poll, so neither side waits on a full pipe. Each output line takes the
+// place of a row already sent, in place and without moving the rows below;
+// lines beyond the rows sent so far are inserted together once per read,
+// and the rows left over are deleted in one go at the end. The range is
+// never held twice: at any time it is the output so far and the input not
+// replaced yet. A command that fails before writing anything, not found
+// or given bad arguments, leaves the rows as they were. Not available for
+// paged files.
+
+#define FILTER_READ_BLOCK (64 * 1024)
+#define FILTER_WRITE_ROWS 512 // rows per writev
+#define FILTER_PIPE_SIZE (1024 * 1024)
+#define FILTER_ERR_LEN 160   // stderr kept for the status message
+
+int editor_filter(int from, int to, const char* command, int* out_rows, char* err);
+
+#endif
@@ -0,0 +1,322 @@
+#include "fold.h"
+
+struct fold
+{
+	int start; // the header, left on screen
+	int end; // last hidden row
+	int before; // rows hidden by the folds before this one
+};
+
+static struct
+{
+	struct fold* f; // collapsed folds sorted by start, none overlapping
+	int n;
+	int cap;
+} F;
+
+// index of the last fold starting above row, -1 for none
+static int fold_above(int row)
+{
+	int lo = 0, hi = F.n;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (F.f[mid].start < row) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo - 1;
+}
+
+static void reindex(int from)
+{
+	if (from < 0) from = 0;
+	for (int i = from; i < F.n; ++i)
+		F.f[i].before = i == 0 ? 0 : F.f[i - 1].before + F.f[i - 1].end - F.f[i - 1].start;
+}
+
+static void remove_fold(int i)
+{
+	memmove(&F.f[i], &F.f[i + 1], sizeof(struct fold) * (F.n - i - 1));
+	--F.n;
+}
+
+// screen line of a row counting from the top of the buffer, a hidden row
+// is on the line of its header
+int fold_line(int row)
+{
+	int i = fold_above(row);
+	if (i < 0) return row;
+	struct fold* f = &F.f[i];
+	if (row <= f->end) return f->start - f->before;
+	return row - f->before - (f->end - f->start);
+}
+
+// row shown on a screen line, E.numrows and up past the end of the buffer
+int fold_row(int line)
+{
+	// header lines increase with the folds, so the last one above line is
+	// found by the same search
+	int lo = 0, hi = F.n;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (F.f[mid].start - F.f[mid].before < line) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == 0) return line;
+	struct fold* f = &F.f[lo - 1];
+	return line + f->before + f->end - f->start;
+}
+
+// rows hidden under row, 0 when it isn't the header of a collapsed fold
+int fold_hidden(int row)
+{
+	int i = fold_above(row + 1);
+	return i >= 0 && F.f[i].start == row ? F.f[i].end - F.f[i].start : 0;
+}
+
+static int open_comment(int at)
+{
+	return E.paged ? editor_row_at(at)->hl_open_comment : E.row[at].hl_open_comment;
+}
+
+// braces of a row outside of comments and strings: the closing ones with no
+// match on the row and, after them, the opening ones left open at its end
+static void count_braces(int at, int* closes, int* opens)
+{
+	struct editor_syntax* syn = E.syntax;
+	char* scs = syn ? syn->single_line_comment_start : NULL;
+	char* mcs = syn ? syn->multiline_comment_start : NULL;
+	char* mce = syn ? syn->multiline_comment_end : NULL;
+	int scs_len = scs ? strlen(scs) : 0;
+	int mcs_len = mcs && mce ? strlen(mcs) : 0;
+	int mce_len = mcs && mce ? strlen(mce) : 0;
+	int strings = syn && (syn->flags & HL_HIGHLIGHT_STRINGS);
+
+	int in_comment = mcs_len && at > 0 && open_comment(at - 1);
+	erow* row = editor_row_at(at);
+	const char* s = row->chars;
+	int depth = 0, low = 0;
+	for (int i = 0; i < row->size; ++i)
+	{
+		if (in_comment)
+		{
+			if (!strncmp(&s[i], mce, mce_len))
+			{
+				in_comment = 0;
+				i += mce_len - 1;
+			}
+		}
+		else if (scs_len && !strncmp(&s[i], scs, scs_len))
+		{
+			break;
+		}
+		else if (mcs_len && !strncmp(&s[i], mcs, mcs_len))
+		{
+			in_comment = 1;
+			i += mcs_len - 1;
+		}
+		else if (strings && (s[i] == '"' || s[i] == '\''))
+		{
+			char quote = s[i];
+			for (++i; i < row->size && s[i] != quote; ++i)
+				if (s[i] == '\\') ++i;
+		}
+		else if (s[i] == '{')
+		{
+			++depth;
+		}
+		else if (s[i] == '}' && --depth < low)
+		{
+			low = depth;
+		}
+	}
+	*closes = -low;
+	*opens = depth - low;
+}
+
+// the first non-blank of the row is {, as in a block on a line of its own
+static int starts_block(int at)
+{
+	erow* row = editor_row_at(at);
+	int i = 0;
+	while (i < row->size && isspace((unsigned char) row->chars[i])) ++i;
+	return i < row->size && row->chars[i] == '{';
+}
+
+static int is_blank(int at)
+{
+	erow* row = editor_row_at(at);
+	for (int i = 0; i < row->size; ++i)
+		if (!isspace((unsigned char) row->chars[i])) return 0;
+	return 1;
+}
+
+// row where the block left open `need` deep at the end of `from` closes
+static int block_end(int from, int need)
+{
+	for (int at = from + 1; at < E.numrows && at - from < FOLD_SCAN_ROWS; ++at)
+	{
+		int closes, opens;
+		count_braces(at, &closes, &opens);
+		if (closes >= need) return at;
+		need += opens - closes;
+	}
+	return -1;
+}
+
+// row opening the block that `need` closes seen from the end of `from`
+static int block_start(int from, int need)
+{
+	for (int at = from; at >= 0 && from - at < FOLD_SCAN_ROWS; --at)
+	{
+		int closes, opens;
+		count_braces(at, &closes, &opens);
+		if (opens >= need) return at;
+		need += closes - opens;
+	}
+	return -1;
+}
+
+// the region a fold at row would cover: a comment spanning rows, the block
+// opened on the row (or on the next one, brace on its own line) or else
+// the innermost block around it
+static int find_region(int row, int* start, int* end)
+{
+	if (E.syntax && (open_comment(row) || (row > 0 && open_comment(row - 1))))
+	{
+		int s = row, e = row;
+		while (s > 0 && row - s < FOLD_SCAN_ROWS && open_comment(s - 1)) --s;
+		while (e + 1 < E.numrows && e - row < FOLD_SCAN_ROWS && open_comment(e)) ++e;
+		*start = s;
+		*end = e;
+		return e > s;
+	}
+
+	int closes, opens;
+	int open = -1, close = -1;
+	count_braces(row, &closes, &opens);
+	if (opens == 0 && closes == 0 && row + 1 < E.numrows && starts_block(row + 1))
+	{
+		int next_closes, next_opens;
+		count_braces(row + 1, &next_closes, &next_opens);
+		if (next_opens > 0)
+		{
+			++row;
+			closes = next_closes;
+			opens = next_opens;
+		}
+	}
+
+	if (opens > 0)
+	{
+		open = row;
+		close = block_end(row, opens);
+	}
+	else if (closes > 0)
+	{
+		close = row;
+		open = block_start(row - 1, 1);
+	}
+	else
+	{
+		open = block_start(row - 1, 1);
+		if (open != -1) close = block_end(row, 1);
+	}
+	if (open == -1 || close == -1) return 0;
+
+	// keep the line naming the block on screen rather than its brace
+	if (open > 0 && starts_block(open) && !is_blank(open - 1)) --open;
+	*start = open;
+	*end = close;
+	return close > open;
+}
+
+// opens the fold headed by row, or collapses the region around it. Returns
+// the rows hidden, 0 when a fold was opened and -1 when there is nothing
+// to fold at row.
+int fold_toggle(int row)
+{
+	if (row < 0 || row >= E.numrows) return -1;
+	int i = fold_above(row + 1);
+	if (i >= 0 && F.f[i].start == row)
+	{
+		remove_fold(i);
+		reindex(i);
+		return 0;
+	}
+
+	int start, end;
+	if (!find_region(row, &start, &end)) return -1;
+
+	// folds inside the region are taken into it
+	i = fold_above(start + 1);
+	if (i < 0 || F.f[i].end < start) ++i;
+	while (i < F.n && F.f[i].start <= end)
+	{
+		if (F.f[i].start < start) start = F.f[i].start;
+		if (F.f[i].end > end) end = F.f[i].end;
+		remove_fold(i);
+	}
+
+	if (F.n == F.cap)
+	{
+		F.cap = F.cap ? F.cap * 2 : 16;
+		F.f = realloc(F.f, sizeof(struct fold) * F.cap);
+	}
+	memmove(&F.f[i + 1], &F.f[i], sizeof(struct fold) * (F.n - i));
+	F.f[i].start = start;
+	F.f[i].end = end;
+	++F.n;
+	reindex(i);
+	return end - start;
+}
+
+// opens the fold hiding row, if any
+void fold_reveal(int row)
+{
+	int i = fold_above(row);
+	if (i < 0 || row > F.f[i].end) return;
+	remove_fold(i);
+	reindex(i);
+}
+
+// n rows were inserted at `at`: folds below move down, one that had the
+// rows put inside it opens
+void fold_insert_rows(int at, int n)
+{
+	if (F.n == 0) return;
+	int i = fold_above(at);
+	if (i >= 0 && at <= F.f[i].end) remove_fold(i);
+	else ++i;
+	for (int j = i; j < F.n; ++j)
+	{
+		F.f[j].start += n;
+		F.f[j].end += n;
+	}
+	reindex(i);
+}
+
+// n rows were deleted from `at`: folds losing rows open, the ones below
+// move up
+void fold_delete_rows(int at, int n)
+{
+	if (F.n == 0) return;
+	int i = fold_above(at);
+	if (i < 0 || F.f[i].end < at) ++i;
+	int from = i;
+	while (i < F.n && F.f[i].start < at + n) remove_fold(i);
+	for (int j = i; j < F.n; ++j)
+	{
+		F.f[j].start -= n;
+		F.f[j].end -= n;
+	}
+	reindex(from);
+}
+
+void fold_clear()
+{
+	free(F.f);
+	F.f = NULL;
+	F.n = F.cap = 0;
+}
@@ -0,0 +1,25 @@
+#ifndef FOLD_H_
+#define FOLD_H_
+
+#include "editor.h"
+
+// Code folding. A collapsed fold keeps its first row on screen as a header
+// and hides the rows after it. The collapsed folds form a sorted index of
+// row intervals with a running count of the rows hidden before each one, so
+// mapping between buffer rows and screen lines is a binary search and a
+// hidden region costs nothing to draw or scroll past. Regions come from
+// the braces of a block or from a comment spanning several rows, as
+// tracked by hl_open_comment.
+
+#define FOLD_SCAN_ROWS (1 << 20) // rows looked at to find the block around the cursor
+
+int fold_line(int row);
+int fold_row(int line);
+int fold_hidden(int row);
+int fold_toggle(int row);
+void fold_reveal(int row);
+void fold_insert_rows(int at, int n);
+void fold_delete_rows(int at, int n);
+void fold_clear();
+
+#endif
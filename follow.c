@@ -0,0 +1,236 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "diff.h"
+#include "event.h"
+#include "follow.h"
+#include "journal.h"
+#include "pager.h"
+#include "undo.h"
+
+#define FOLLOW_READ_BLOCK (64 * 1024)
+
+static struct
+{
+	int fd;
+	int file_wd;
+	int dir_wd;
+	dev_t dev;
+	ino_t ino;
+	int partial; // last row has no newline on disk yet
+} F = { -1, -1, -1, 0, 0, 0 };
+
+static int watch_file()
+{
+	struct stat st;
+	if (stat(E.filename, &st) == -1) return -1;
+
+	if (F.file_wd != -1) inotify_rm_watch(F.fd, F.file_wd);
+	F.file_wd = inotify_add_watch(F.fd, E.filename, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+	F.dev = st.st_dev;
+	F.ino = st.st_ino;
+
+	F.partial = 0;
+	int fd = open(E.filename, O_RDONLY);
+	if (fd != -1)
+	{
+		char last;
+		if (E.file_size > 0 && pread(fd, &last, 1, E.file_size - 1) == 1)
+			F.partial = (last != '\n');
+		close(fd);
+	}
+	return F.file_wd;
+}
+
+static void follow_on_event()
+{
+	if (follow_poll()) event_redraw();
+}
+
+int follow_start()
+{
+	if (E.filename == NULL)
+	{
+		set_status_message("Follow mode needs a file on disk");
+		return 0;
+	}
+
+	F.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (F.fd == -1)
+	{
+		set_status_message("Can't follow: %s", strerror(errno));
+		return 0;
+	}
+
+	// the directory watch notices a new file being created or moved in on rotation
+	char* dir = strdup(E.filename);
+	char* slash = strrchr(dir, '/');
+	if (slash == dir) slash[1] = '\0';
+	else if (slash) *slash = '\0';
+	else strcpy(dir, ".");
+	F.dir_wd = inotify_add_watch(F.fd, dir, IN_CREATE | IN_MOVED_TO);
+	free(dir);
+
+	if (watch_file() == -1)
+	{
+		set_status_message("Can't follow: %s", strerror(errno));
+		follow_stop();
+		return 0;
+	}
+
+	event_watch(F.fd, follow_on_event);
+	E.following = 1;
+	return 1;
+}
+
+void follow_stop()
+{
+	if (F.fd != -1)
+	{
+		event_unwatch(F.fd);
+		close(F.fd);
+	}
+	F.fd = F.file_wd = F.dir_wd = -1;
+	E.following = 0;
+}
+
+void follow_toggle()
+{
+	if (E.following)
+	{
+		follow_stop();
+		set_status_message("Follow mode off");
+	}
+	else if (follow_start())
+	{
+		set_status_message("Following %s", E.filename);
+	}
+}
+
+// re-reads the identity of the file after the editor itself rewrote it
+void follow_reset()
+{
+	if (E.following) watch_file();
+}
+
+static void add_text(char* s, size_t len)
+{
+	while (len > 0 && s[len - 1] == '\r') --len;
+	if (F.partial && E.numrows > 0)
+		editor_row_append_string(editor_row_mut(E.numrows - 1), s, len);
+	else
+		editor_insert_row(E.numrows, s, len);
+}
+
+static int append_rows(long long size)
+{
+	int fd = open(E.filename, O_RDONLY);
+	if (fd == -1) return 0;
+
+	char* buf = malloc(FOLLOW_READ_BLOCK);
+	char* carry = NULL;
+	size_t carry_len = 0;
+	long long off = E.file_size;
+
+	while (off < size)
+	{
+		long long want = size - off < FOLLOW_READ_BLOCK ? size - off : FOLLOW_READ_BLOCK;
+		ssize_t n = pread(fd, buf, want, off);
+		if (n <= 0) break;
+		off += n;
+
+		char* p = buf;
+		char* end = buf + n;
+		char* nl;
+		while ((nl = memchr(p, '\n', end - p)) != NULL)
+		{
+			if (carry_len)
+			{
+				carry = realloc(carry, carry_len + (nl - p));
+				memcpy(&carry[carry_len], p, nl - p);
+				add_text(carry, carry_len + (nl - p));
+				carry_len = 0;
+			}
+			else
+			{
+				add_text(p, nl - p);
+			}
+			F.partial = 0;
+			p = nl + 1;
+		}
+		if (p < end)
+		{
+			carry = realloc(carry, carry_len + (end - p));
+			memcpy(&carry[carry_len], p, end - p);
+			carry_len += end - p;
+		}
+	}
+
+	// an unterminated tail becomes the last row and is continued on the next growth
+	if (carry_len)
+	{
+		add_text(carry, carry_len);
+		F.partial = 1;
+	}
+
+	free(carry);
+	free(buf);
+	close(fd);
+	E.file_size = off;
+	return 1;
+}
+
+static int reload(const char* why)
+{
+	if (E.is_dirty)
+	{
+		follow_stop();
+		set_status_message("%s %s on disk, follow mode stopped to keep your changes", E.filename, why);
+		return 1;
+	}
+
+	editor_reload();
+	watch_file();
+	set_status_message("%s %s, reloaded", E.filename, why);
+	return 1;
+}
+
+// drains inotify events, returns 1 when the buffer changed
+int follow_poll()
+{
+	if (!E.following) return 0;
+
+	char events[4096];
+	int seen = 0;
+	while (read(F.fd, events, sizeof(events)) > 0) seen = 1;
+	if (!seen) return 0;
+
+	struct stat st;
+	if (stat(E.filename, &st) == -1) return 0; // rotated away, wait for the new file
+	if (st.st_dev != F.dev || st.st_ino != F.ino) return reload("was rotated");
+	if (st.st_size < E.file_size) return reload("was truncated");
+	if (st.st_size == E.file_size) return 0;
+
+	int at_end = E.cy >= E.numrows - 1;
+	int dirty = E.is_dirty;
+	int continued = F.partial && E.numrows > 0;
+	int from = continued ? E.numrows - 1 : E.numrows;
+	// lines written by someone else are not edits that can be undone
+	undo_suspend();
+	journal_suspend();
+	int changed = E.paged ? pager_extend(st.st_size) : append_rows(st.st_size);
+	journal_resume();
+	undo_resume();
+	E.is_dirty = dirty;
+	if (changed && !E.paged) diff_disk_appended(from, continued);
+
+	if (changed && at_end && E.numrows > 0)
+	{
+		E.cy = E.numrows - 1;
+		E.cx = 0;
+	}
+	return changed;
+}
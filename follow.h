@@ -0,0 +1,16 @@
+#ifndef FOLLOW_H_
+#define FOLLOW_H_
+
+#include "editor.h"
+
+// Follow mode: watches E.filename with inotify and appends whatever the
+// writer adds to the end of the file, like `tail -f`. Truncation and
+// rotation (a new inode at the same path) reload the buffer.
+
+int follow_start();
+void follow_stop();
+void follow_toggle();
+void follow_reset();
+int follow_poll();
+
+#endif
@@ -0,0 +1,67 @@
+#include "event.h"
+#include "frame.h"
+#include "latency.h"
+
+static struct frame_stats S;
+static long long second_start;
+static int second_frames;
+
+// asks the terminal whether it knows mode 2026, the DECRPM answer is
+// decoded by input.c and lands in frame_set_sync_support
+void frame_init()
+{
+	write(STDIN_FILENO, "\x1b[?2026$p", 9);
+}
+
+// 1 and 2 mean the mode is known and settable, 3 means it is always on
+void frame_set_sync_support(int mode)
+{
+	S.sync = (mode >= 1 && mode <= 3);
+}
+
+// a frame is dropped while the previous ones still sit in the tty output
+// queue, the caller keeps the redraw pending and tries again later
+int frame_ready()
+{
+	int pending = 0;
+	if (ioctl(STDIN_FILENO, TIOCOUTQ, &pending) == 0 && pending > FRAME_BACKLOG_BYTES)
+	{
+		++S.dropped;
+		return 0;
+	}
+	return 1;
+}
+
+void frame_begin(struct abuf* ab)
+{
+	if (S.sync) ab_append(ab, "\x1b[?2026h", 8);
+	ab_append(ab, "\x1b[?25l", 6);  // hide cursor
+}
+
+void frame_end(struct abuf* ab)
+{
+	ab_append(ab, "\x1b[?25h", 6); // show cursor
+	if (S.sync) ab_append(ab, "\x1b[?2026l", 8);
+	latency_frame_write(ab->len);
+	write(STDIN_FILENO, ab->b, ab->len);
+	latency_frame_end();
+
+	++S.frames;
+	S.bytes += ab->len;
+	S.last_bytes = ab->len;
+
+	long long now = event_now_ms();
+	if (now - second_start >= 1000)
+	{
+		S.fps = now - second_start < 2000 ? second_frames : 0;
+		second_start = now;
+		second_frames = 0;
+	}
+	++second_frames;
+}
+
+const struct frame_stats* frame_stats()
+{
+	return &S;
+}
+
@@ -0,0 +1,29 @@
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#include "editor.h"
+
+// Frame scheduling for refresh_screen. Frames are wrapped in synchronized
+// update mode (DEC private mode 2026) when the terminal reports support
+// for it, and skipped while the tty still has a backlog of unsent output.
+
+#define FRAME_BACKLOG_BYTES 8192
+
+struct frame_stats
+{
+	long long frames;
+	long long dropped;
+	long long bytes;
+	int last_bytes;
+	int fps;
+	int sync;
+};
+
+void frame_init();
+void frame_set_sync_support(int mode);
+int frame_ready();
+void frame_begin(struct abuf* ab);
+void frame_end(struct abuf* ab);
+const struct frame_stats* frame_stats();
+
+#endif
@@ -0,0 +1,360 @@
+#define _DEFAULT_SOURCE
+
+#include <poll.h>
+
+#include "input.h"
+#include "event.h"
+#include "frame.h"
+#include "latency.h"
+
+#define RING_MASK (INPUT_RING_SIZE - 1)
+
+struct key_event
+{
+	int key;
+	char* text;
+	size_t len;
+};
+
+static struct
+{
+	char ring[INPUT_RING_SIZE];
+	unsigned int head; // next byte to decode
+	unsigned int tail; // next free byte
+
+	struct key_event queue[INPUT_QUEUE_SIZE];
+	unsigned int qhead;
+	unsigned int qtail;
+
+	// when the queued keys were read and how long decoding them took
+	long long read_at;
+	long long decode_ns;
+
+	// bracketed paste being collected, and the one handed out last
+	int in_paste;
+	char* paste;
+	size_t paste_len;
+	size_t paste_cap;
+	char* taken;
+	size_t taken_len;
+	int taken_played; // taken belongs to the macro
+
+	// keyboard macro, the keys read_key handed out while recording
+	struct key_event* macro;
+	int macro_len;
+	int macro_cap;
+	int recording;
+	int play_at; // next key to play
+	long long plays; // runs left, the one under way included
+} I;
+
+static unsigned int buffered()
+{
+	return I.tail - I.head;
+}
+
+static int byte_at(unsigned int i)
+{
+	return (unsigned char) I.ring[(I.head + i) & RING_MASK];
+}
+
+// reads whatever is available into the ring, a blocking fill gives the
+// rest of an escape sequence INPUT_ESC_TIMEOUT_MS to arrive
+static int fill(int blocking)
+{
+	unsigned int space = INPUT_RING_SIZE - buffered();
+	if (space == 0) return 0;
+
+	struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+	if (poll(&pfd, 1, blocking ? INPUT_ESC_TIMEOUT_MS : 0) <= 0) return 0;
+
+	// the free area may wrap, read only its contiguous part
+	unsigned int at = I.tail & RING_MASK;
+	unsigned int n = INPUT_RING_SIZE - at;
+	if (n > space) n = space;
+
+	ssize_t nread = read(STDIN_FILENO, &I.ring[at], n);
+	if (nread == -1 && errno != EAGAIN && errno != EINTR)
+		die("read");
+	if (nread <= 0) return 0;
+	I.tail += nread;
+	return nread;
+}
+
+static void push(int key, char* text, size_t len)
+{
+	if (I.qtail - I.qhead == INPUT_QUEUE_SIZE) return;
+	struct key_event* ev = &I.queue[I.qtail++ % INPUT_QUEUE_SIZE];
+	ev->key = key;
+	ev->text = text;
+	ev->len = len;
+}
+
+static void paste_byte(int c)
+{
+	if (I.paste_len == I.paste_cap)
+	{
+		I.paste_cap = I.paste_cap ? I.paste_cap * 2 : 4096;
+		I.paste = realloc(I.paste, I.paste_cap);
+	}
+	I.paste[I.paste_len++] = c;
+}
+
+// makes sure n bytes are buffered
+static int want(unsigned int n)
+{
+	while (buffered() < n)
+		if (fill(1) == 0) return 0;
+	return 1;
+}
+
+// decodes one CSI sequence at the head of the ring, returns the key or 0
+static int decode_csi(unsigned int* used)
+{
+	unsigned int i = 2;
+	int params[4] = { 0 };
+	int nparams = 0;
+	int private = 0;
+	int intermediate = 0;
+
+	while (want(i + 1) && byte_at(i) >= 0x30 && byte_at(i) <= 0x3f)
+	{
+		int c = byte_at(i);
+		if (isdigit(c) && nparams < 4) params[nparams] = params[nparams] * 10 + c - '0';
+		else if (c == ';' && nparams < 3) ++nparams;
+		else if (c == '?') private = 1;
+		++i;
+	}
+	while (want(i + 1) && byte_at(i) >= 0x20 && byte_at(i) <= 0x2f)
+		intermediate = byte_at(i++);
+	if (!want(i + 1))
+	{
+		*used = i;
+		return 0;
+	}
+	int final = byte_at(i);
+	int param = params[0];
+	*used = i + 1;
+
+	// DECRPM, the answer to the synchronized output query sent by frame_init
+	if (final == 'y' && private && intermediate == '$')
+	{
+		if (param == 2026) frame_set_sync_support(params[1]);
+		return 0;
+	}
+
+	if (final == '~')
+	{
+		switch (param)
+		{
+			case 1: return HOME_KEY;
+			case 3: return DEL_KEY;
+			case 4: return END_KEY;
+			case 5: return PAGE_UP;
+			case 6: return PAGE_DOWN;
+			case 7: return HOME_KEY;
+			case 8: return END_KEY;
+			case 200:
+				I.in_paste = 1;
+				I.paste_len = 0;
+				return 0;
+		}
+		return 0;
+	}
+
+	switch (final)
+	{
+		case 'A': return ARROW_UP;
+		case 'B': return ARROW_DOWN;
+		case 'C': return ARROW_RIGHT;
+		case 'D': return ARROW_LEFT;
+		case 'H': return HOME_KEY;
+		case 'F': return END_KEY;
+	}
+	return 0;
+}
+
+static int is_paste_end()
+{
+	static const char end[] = "\x1b[201~";
+	for (unsigned int i = 0; i < sizeof(end) - 1; ++i)
+		if (!want(i + 1) || byte_at(i) != end[i]) return 0;
+	return 1;
+}
+
+// turns every complete sequence in the ring into key events
+static void decode()
+{
+	while (buffered() > 0 && I.qtail - I.qhead < INPUT_QUEUE_SIZE)
+	{
+		int c = byte_at(0);
+
+		if (I.in_paste)
+		{
+			if (c == '\x1b' && is_paste_end())
+			{
+				I.head += 6;
+				I.in_paste = 0;
+				push(PASTE_KEY, I.paste, I.paste_len);
+				I.paste = NULL;
+				I.paste_len = I.paste_cap = 0;
+			}
+			else
+			{
+				paste_byte(c);
+				++I.head;
+			}
+			continue;
+		}
+
+		if (c != '\x1b')
+		{
+			push(c, NULL, 0);
+			++I.head;
+			continue;
+		}
+
+		if (!want(2))
+		{
+			push('\x1b', NULL, 0);
+			++I.head;
+			continue;
+		}
+
+		int seq = byte_at(1);
+		if (seq == '[')
+		{
+			unsigned int used;
+			int key = decode_csi(&used);
+			I.head += used;
+			if (key) push(key, NULL, 0);
+		}
+		else if (seq == 'O' && want(3))
+		{
+			int key = byte_at(2) == 'H' ? HOME_KEY : byte_at(2) == 'F' ? END_KEY : '\x1b';
+			I.head += (key == '\x1b') ? 1 : 3;
+			push(key, NULL, 0);
+		}
+		else
+		{
+			push('\x1b', NULL, 0);
+			++I.head;
+		}
+	}
+}
+
+static void record(struct key_event* ev)
+{
+	if (I.macro_len == I.macro_cap)
+	{
+		I.macro_cap = I.macro_cap ? I.macro_cap * 2 : 64;
+		I.macro = realloc(I.macro, sizeof(struct key_event) * I.macro_cap);
+	}
+	struct key_event* key = &I.macro[I.macro_len++];
+	*key = *ev;
+	if (ev->text)
+	{
+		key->text = malloc(ev->len);
+		memcpy(key->text, ev->text, ev->len);
+	}
+}
+
+// the next key of a macro being played, without waiting on the terminal
+static int play()
+{
+	struct key_event* ev = &I.macro[I.play_at];
+	if (++I.play_at == I.macro_len)
+	{
+		I.play_at = 0;
+		--I.plays;
+	}
+	if (ev->key == PASTE_KEY)
+	{
+		I.taken = ev->text;
+		I.taken_len = ev->len;
+		I.taken_played = 1;
+	}
+	return ev->key;
+}
+
+int read_key()
+{
+	if (!I.taken_played) free(I.taken);
+	I.taken = NULL;
+	I.taken_played = 0;
+	if (I.plays > 0) return play();
+
+	while (I.qhead == I.qtail)
+	{
+		long long start = latency_now();
+		// bytes left in the ring by a burst longer than the queue come
+		// first, only an empty ring waits for the terminal
+		if (fill(0) == 0 && buffered() == 0)
+		{
+			event_wait(-1);
+			continue;
+		}
+		decode();
+		I.read_at = start;
+		I.decode_ns = latency_now() - start;
+	}
+
+	struct key_event* ev = &I.queue[I.qhead++ % INPUT_QUEUE_SIZE];
+	latency_key(ev->key, I.read_at, I.decode_ns);
+	I.decode_ns = 0; // the rest of the burst was decoded along with this key
+	if (I.recording) record(ev);
+	if (ev->key == PASTE_KEY)
+	{
+		I.taken = ev->text;
+		I.taken_len = ev->len;
+	}
+	return ev->key;
+}
+
+// text of the PASTE_KEY returned last, valid until the next read_key
+char* input_paste(size_t* len)
+{
+	*len = I.taken ? I.taken_len : 0;
+	return I.taken;
+}
+
+// starts recording a new macro, or stops the recording
+void input_macro_record(int on)
+{
+	if (on)
+	{
+		while (I.macro_len > 0) free(I.macro[--I.macro_len].text);
+		I.play_at = 0;
+		I.plays = 0;
+	}
+	I.recording = on;
+}
+
+int input_macro_recording()
+{
+	return I.recording;
+}
+
+// leaves the last key out of the macro, as the one stopping the recording
+void input_macro_unrecord()
+{
+	if (I.macro_len > 0) free(I.macro[--I.macro_len].text);
+}
+
+int input_macro_length()
+{
+	return I.macro_len;
+}
+
+// makes read_key hand out the macro `times` times before reading the terminal again
+void input_macro_play(long long times)
+{
+	if (I.recording || I.macro_len == 0) return;
+	I.play_at = 0;
+	I.plays = times;
+}
+
+int input_macro_playing()
+{
+	return I.plays > 0;
+}
@@ -0,0 +1,40 @@
+#ifndef INPUT_H_
+#define INPUT_H_
+
+#include "editor.h"
+
+// Terminal input is read in large chunks into a ring buffer and decoded
+// into a queue of key events, so a burst of keys costs one read(2) and the
+// whole burst is applied before the event loop draws the next frame. A
+// keyboard macro is recorded as the keys read_key hands out and played
+// back through it too.
+
+#define INPUT_RING_SIZE (64 * 1024) // must be a power of two
+#define INPUT_QUEUE_SIZE 1024
+#define INPUT_ESC_TIMEOUT_MS 100
+
+enum keys
+{
+	BACKSPACE = 127,
+	ARROW_LEFT = 1000,
+	ARROW_RIGHT,
+	ARROW_UP,
+	ARROW_DOWN,
+	PAGE_UP,
+	PAGE_DOWN,
+	HOME_KEY,
+	END_KEY,
+	DEL_KEY,
+	PASTE_KEY // a bracketed paste, its text is fetched with input_paste()
+};
+
+int read_key();
+char* input_paste(size_t* len);
+void input_macro_record(int on);
+int input_macro_recording();
+void input_macro_unrecord();
+int input_macro_length();
+void input_macro_play(long long times);
+int input_macro_playing();
+
+#endif
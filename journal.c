@@ -0,0 +1,637 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include "event.h"
+#include "journal.h"
+#include "cold.h"
+#include "pager.h"
+#include "trace.h"
+#include "undo.h"
+
+#define JOURNAL_MAGIC "YOLOJRN1"
+
+enum journal_op
+{
+	OP_INSERT_TEXT = 1,
+	OP_DELETE_TEXT,
+	OP_INSERT_ROWS,
+	OP_DELETE_ROWS,
+	OP_RESET // drops every row, a compacted journal starts with it
+};
+
+// identifies the file version the journal applies to
+struct header
+{
+	char magic[8];
+	long long size;
+	long long mtime;
+};
+
+// inserts carry their bytes, row inserts as n (length, bytes) pairs, text
+// deletes carry the number of bytes removed
+struct record
+{
+	unsigned char op;
+	unsigned char pad[3];
+	int a; // row, or first row for row ops
+	int b; // column, or row count for row ops
+	unsigned int len; // payload bytes
+};
+
+static struct
+{
+	char* path;
+	int fd;
+	struct header header;
+	long long size; // bytes in the swap file
+	long long limit; // size at which compaction is considered
+	int gen; // bumped when the swap file is replaced
+	int busy; // see enter(), -1 once the crash handler took over
+	int suspended;
+	int armed; // a commit timer is pending
+	char* buf; // records not handed to the writer yet
+	size_t len;
+	size_t cap;
+	long long last; // offset in buf of the newest record, -1 if none
+	char* out; // records being written by the writer
+	size_t out_cap;
+	int commit; // the writer has work to do
+	int running;
+	pthread_t writer;
+	pthread_mutex_t lock; // guards the pending buffer
+	pthread_mutex_t io; // guards fd
+	pthread_cond_t cond;
+} J = {
+	.fd = -1,
+	.limit = JOURNAL_COMPACT_BYTES,
+	.last = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.io = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER
+};
+
+// "dir/name" -> "dir/.name.swp"
+static char* journal_path(const char* filename)
+{
+	const char* slash = strrchr(filename, '/');
+	size_t dir = slash ? (size_t) (slash - filename + 1) : 0;
+	char* path = malloc(strlen(filename) + 6);
+	memcpy(path, filename, dir);
+	sprintf(&path[dir], ".%s.swp", &filename[dir]);
+	return path;
+}
+
+static int write_all(int fd, const char* s, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write(fd, s, len);
+		if (n <= 0) return 0;
+		s += n;
+		len -= n;
+	}
+	return 1;
+}
+
+// marks a stretch that changes the pending records or writes to J.fd. The
+// crash handler only writes when no thread is inside one, so it never sees
+// a buffer halfway through a change; after a crash nobody gets in anymore.
+static void enter()
+{
+	int n = __atomic_load_n(&J.busy, __ATOMIC_ACQUIRE);
+	do
+	{
+		while (n < 0) pause(); // the process is going down
+	} while (!__atomic_compare_exchange_n(&J.busy, &n, n + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+static void leave()
+{
+	__atomic_sub_fetch(&J.busy, 1, __ATOMIC_RELEASE);
+}
+
+static void* writer_main(void* arg)
+{
+	(void) arg;
+	trace_name_thread("journal");
+	pthread_mutex_lock(&J.lock);
+	while (1)
+	{
+		while (!J.commit) pthread_cond_wait(&J.cond, &J.lock);
+		J.commit = 0;
+		enter();
+		int gen = J.gen;
+
+		// swap buffers so edits keep appending while this batch is written
+		char* data = J.buf;
+		size_t len = J.len;
+		size_t cap = J.cap;
+		J.buf = J.out;
+		J.cap = J.out_cap;
+		J.len = 0;
+		J.last = -1;
+		J.out = data;
+		J.out_cap = cap;
+
+		pthread_mutex_lock(&J.io);
+		pthread_mutex_unlock(&J.lock);
+		// a compaction in between already covers these records
+		if (J.fd != -1 && len > 0 && gen == J.gen)
+		{
+			long long span = trace_begin();
+			write_all(J.fd, data, len);
+			__atomic_add_fetch(&J.size, len, __ATOMIC_RELAXED);
+			leave();
+			fdatasync(J.fd);
+			trace_end("journal_write", span);
+		}
+		else
+		{
+			leave();
+		}
+		pthread_mutex_unlock(&J.io);
+		pthread_mutex_lock(&J.lock);
+	}
+	return NULL;
+}
+
+// last chance to keep the pending records. Only write(2) and fdatasync(2) on
+// the open swap file, and only when no thread is in the middle of changing
+// the records; otherwise what the writer already put on disk has to do.
+static void on_crash(int sig)
+{
+	int idle = 0;
+	if (__atomic_compare_exchange_n(&J.busy, &idle, -1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) && J.fd != -1)
+	{
+		if (J.len > 0) write_all(J.fd, J.buf, J.len);
+		fdatasync(J.fd);
+	}
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+static void start_writer()
+{
+	if (J.running) return;
+	if (pthread_create(&J.writer, NULL, writer_main, NULL) != 0) die("pthread_create");
+	pthread_detach(J.writer);
+	J.running = 1;
+
+	int signals[] = { SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGILL, SIGTERM, SIGHUP };
+	for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); ++i)
+		signal(signals[i], on_crash);
+}
+
+static int ready()
+{
+	if (J.suspended || E.filename == NULL) return 0;
+	if (J.fd != -1) return 1;
+
+	struct header h;
+	struct stat st;
+	memcpy(h.magic, JOURNAL_MAGIC, sizeof(h.magic));
+	h.size = stat(E.filename, &st) == 0 ? st.st_size : -1;
+	h.mtime = h.size >= 0 ? st.st_mtime : -1;
+
+	if (!J.path) J.path = journal_path(E.filename);
+	int fd = open(J.path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+	if (fd == -1) return 0;
+	write_all(fd, (char*) &h, sizeof(h));
+
+	pthread_mutex_lock(&J.io);
+	enter();
+	J.fd = fd;
+	J.header = h;
+	J.size = sizeof(h);
+	leave();
+	pthread_mutex_unlock(&J.io);
+	start_writer();
+	return 1;
+}
+
+// one OP_INSERT_ROWS record for rows [from, to)
+static int write_rows(int fd, char* buf, int from, int to, size_t bytes)
+{
+	struct record r = { OP_INSERT_ROWS, { 0, 0, 0 }, from, to - from, bytes };
+	memcpy(buf, &r, sizeof(r));
+	char* p = buf + sizeof(r);
+	for (int i = from; i < to; ++i)
+	{
+		erow* row = &E.row[i];
+		unsigned int len = row->size;
+		memcpy(p, &len, sizeof(len));
+		memcpy(p + sizeof(len), row->cold ? cold_text(row) : row->chars, len);
+		p += sizeof(len) + len;
+	}
+	return write_all(fd, buf, p - buf);
+}
+
+// rewrites the swap file as the buffer its records lead to once it has grown
+// past twice that, so a long session between saves stays bounded. Runs from
+// the event loop, where the rows and the records agree. A paged buffer is
+// left alone, its snapshot would be the whole file.
+static void compact()
+{
+	if (E.paged || J.suspended || J.fd == -1) return;
+	long long size = __atomic_load_n(&J.size, __ATOMIC_RELAXED) + J.len;
+	if (size < J.limit) return;
+
+	long long bytes = sizeof(struct header) + sizeof(struct record);
+	for (int i = 0; i < E.numrows; ++i) bytes += sizeof(struct record) + sizeof(unsigned int) + E.row[i].size;
+	J.limit = bytes * 2 > JOURNAL_COMPACT_BYTES ? bytes * 2 : JOURNAL_COMPACT_BYTES;
+	if (bytes * 2 > size) return;
+
+	size_t tmplen = strlen(J.path) + 8;
+	char* tmp = malloc(tmplen);
+	snprintf(tmp, tmplen, "%s.new", J.path);
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+	if (fd == -1)
+	{
+		free(tmp);
+		return;
+	}
+
+	long long span = trace_begin();
+	pthread_mutex_lock(&J.lock);
+	pthread_mutex_lock(&J.io);
+	enter();
+
+	struct record reset = { OP_RESET, { 0, 0, 0 }, 0, 0, 0 };
+	int ok = write_all(fd, (char*) &J.header, sizeof(J.header)) && write_all(fd, (char*) &reset, sizeof(reset));
+	size_t cap = JOURNAL_COMMIT_BYTES;
+	char* buf = malloc(cap);
+	int from = 0;
+	size_t used = 0;
+	for (int i = 0; ok && i <= E.numrows; ++i)
+	{
+		size_t len = i < E.numrows ? sizeof(unsigned int) + E.row[i].size : 0;
+		if (i == E.numrows || (used > 0 && sizeof(struct record) + used + len > cap))
+		{
+			if (used > 0) ok = write_rows(fd, buf, from, i, used);
+			from = i;
+			used = 0;
+		}
+		if (sizeof(struct record) + len > cap)
+		{
+			cap = sizeof(struct record) + len;
+			buf = realloc(buf, cap);
+		}
+		used += len;
+	}
+	free(buf);
+
+	if (ok && fdatasync(fd) == 0 && rename(tmp, J.path) == 0)
+	{
+		close(J.fd);
+		J.fd = fd;
+		J.size = lseek(fd, 0, SEEK_END);
+		++J.gen;
+		J.len = 0;
+		J.last = -1;
+	}
+	else
+	{
+		close(fd);
+		unlink(tmp);
+	}
+
+	leave();
+	pthread_mutex_unlock(&J.io);
+	pthread_mutex_unlock(&J.lock);
+	trace_end("journal_compact", span);
+	free(tmp);
+}
+
+static void on_timer()
+{
+	pthread_mutex_lock(&J.lock);
+	J.armed = 0;
+	if (J.len > 0)
+	{
+		J.commit = 1;
+		pthread_cond_signal(&J.cond);
+	}
+	pthread_mutex_unlock(&J.lock);
+	compact();
+}
+
+// called with J.lock held after a record was added; the timer also runs when
+// a batch is committed right away, it is where compaction happens
+static void schedule()
+{
+	if (J.len >= JOURNAL_COMMIT_BYTES)
+	{
+		J.commit = 1;
+		pthread_cond_signal(&J.cond);
+	}
+	if (!J.armed)
+	{
+		J.armed = 1;
+		event_timer(JOURNAL_COMMIT_MS, on_timer);
+	}
+}
+
+static char* reserve(size_t n)
+{
+	if (J.len + n > J.cap)
+	{
+		while (J.len + n > J.cap) J.cap = J.cap ? J.cap * 2 : 4096;
+		J.buf = realloc(J.buf, J.cap);
+	}
+	char* p = &J.buf[J.len];
+	J.len += n;
+	return p;
+}
+
+static char* push(int op, int a, int b, size_t len)
+{
+	struct record r = { op, { 0, 0, 0 }, a, b, len };
+	J.last = J.len;
+	char* p = reserve(sizeof(r) + len);
+	memcpy(p, &r, sizeof(r));
+	return p + sizeof(r);
+}
+
+void journal_suspend()
+{
+	++J.suspended;
+}
+
+void journal_resume()
+{
+	--J.suspended;
+}
+
+void journal_insert_text(int row, int col, const char* s, size_t len)
+{
+	if (len == 0 || !ready()) return;
+	pthread_mutex_lock(&J.lock);
+	enter();
+
+	// typing extends the newest pending record
+	struct record r;
+	if (J.last >= 0) memcpy(&r, &J.buf[J.last], sizeof(r));
+	if (J.last >= 0 && r.op == OP_INSERT_TEXT && r.a == row && r.b + (int) r.len == col)
+	{
+		memcpy(reserve(len), s, len);
+		r.len += len;
+		memcpy(&J.buf[J.last], &r, sizeof(r));
+	}
+	else
+	{
+		memcpy(push(OP_INSERT_TEXT, row, col, len), s, len);
+	}
+
+	leave();
+	schedule();
+	pthread_mutex_unlock(&J.lock);
+}
+
+void journal_delete_text(int row, int col, size_t len)
+{
+	if (len == 0 || !ready()) return;
+	pthread_mutex_lock(&J.lock);
+	enter();
+	unsigned int count = len;
+	memcpy(push(OP_DELETE_TEXT, row, col, sizeof(count)), &count, sizeof(count));
+	leave();
+	schedule();
+	pthread_mutex_unlock(&J.lock);
+}
+
+void journal_insert_rows(int at, int n, char** lines, size_t* lens)
+{
+	if (n <= 0 || !ready()) return;
+	pthread_mutex_lock(&J.lock);
+	enter();
+
+	size_t total = 0;
+	for (int i = 0; i < n; ++i) total += sizeof(unsigned int) + lens[i];
+	char* p = push(OP_INSERT_ROWS, at, n, total);
+	for (int i = 0; i < n; ++i)
+	{
+		unsigned int len = lens[i];
+		memcpy(p, &len, sizeof(len));
+		memcpy(p + sizeof(len), lines[i], len);
+		p += sizeof(len) + len;
+	}
+
+	leave();
+	schedule();
+	pthread_mutex_unlock(&J.lock);
+}
+
+void journal_delete_rows(int at, int n)
+{
+	if (n <= 0 || !ready()) return;
+	pthread_mutex_lock(&J.lock);
+	enter();
+	push(OP_DELETE_ROWS, at, n, 0);
+	leave();
+	schedule();
+	pthread_mutex_unlock(&J.lock);
+}
+
+// writes everything pending right now, used on the way out
+void journal_flush()
+{
+	pthread_mutex_lock(&J.lock);
+	pthread_mutex_lock(&J.io);
+	enter();
+	if (J.fd != -1 && J.len > 0)
+	{
+		write_all(J.fd, J.buf, J.len);
+		J.size += J.len;
+		fdatasync(J.fd);
+	}
+	J.len = 0;
+	J.last = -1;
+	leave();
+	pthread_mutex_unlock(&J.io);
+	pthread_mutex_unlock(&J.lock);
+}
+
+// the buffer matches the file on disk again, or its edits were thrown away
+void journal_discard()
+{
+	pthread_mutex_lock(&J.lock);
+	pthread_mutex_lock(&J.io);
+	enter();
+	if (J.fd != -1)
+	{
+		close(J.fd);
+		J.fd = -1;
+	}
+	if (J.path) unlink(J.path);
+	free(J.path);
+	J.path = NULL;
+	J.len = 0;
+	J.last = -1;
+	J.limit = JOURNAL_COMPACT_BYTES;
+	++J.gen;
+	leave();
+	pthread_mutex_unlock(&J.io);
+	pthread_mutex_unlock(&J.lock);
+}
+
+// bytes of records in a journal left behind for E.filename, -1 if there is none;
+// stale is set when the file changed since the journal was started
+long long journal_found(int* stale)
+{
+	if (E.filename == NULL) return -1;
+	free(J.path);
+	J.path = journal_path(E.filename);
+
+	int fd = open(J.path, O_RDONLY);
+	if (fd == -1) return -1;
+
+	struct header h;
+	struct stat st;
+	long long found = -1;
+	if (read(fd, &h, sizeof(h)) == sizeof(h) && !memcmp(h.magic, JOURNAL_MAGIC, sizeof(h.magic)) &&
+	    fstat(fd, &st) == 0)
+	{
+		found = st.st_size - sizeof(h);
+		*stale = stat(E.filename, &st) != 0 || st.st_size != h.size || st.st_mtime != h.mtime;
+	}
+	close(fd);
+	return found;
+}
+
+// applies one record, 0 if it doesn't fit the buffer (torn tail or stale journal)
+static int apply(struct record* r, char* payload)
+{
+	erow* row;
+	switch (r->op)
+	{
+		case OP_INSERT_TEXT:
+		case OP_DELETE_TEXT:
+			if (r->a < 0 || r->a >= E.numrows || r->b < 0) return 0;
+			if ((row = editor_row_mut(r->a)) == NULL) return 0;
+			if (r->op == OP_INSERT_TEXT)
+			{
+				if (r->b > row->size) return 0;
+				editor_row_insert_string(row, r->b, payload, r->len);
+			}
+			else
+			{
+				unsigned int count;
+				if (r->len != sizeof(count)) return 0;
+				memcpy(&count, payload, sizeof(count));
+				if ((size_t) r->b + count > (size_t) row->size) return 0;
+				editor_row_del_string(row, r->b, count);
+			}
+			return 1;
+
+		case OP_INSERT_ROWS:
+			{
+				if (r->a < 0 || r->a > E.numrows || r->b <= 0) return 0;
+				char** lines = malloc(sizeof(char*) * r->b);
+				size_t* lens = malloc(sizeof(size_t) * r->b);
+				size_t off = 0;
+				int i;
+				for (i = 0; i < r->b; ++i)
+				{
+					unsigned int len;
+					if (off + sizeof(len) > r->len) break;
+					memcpy(&len, &payload[off], sizeof(len));
+					off += sizeof(len);
+					if (off + len > r->len) break;
+					lines[i] = &payload[off];
+					lens[i] = len;
+					off += len;
+				}
+				int ok = (i == r->b);
+				if (ok) editor_insert_rows(r->a, r->b, lines, lens);
+				free(lens);
+				free(lines);
+				return ok;
+			}
+
+		case OP_DELETE_ROWS:
+			if (r->a < 0 || r->b <= 0 || r->a + r->b > E.numrows) return 0;
+			editor_del_rows(r->a, r->b);
+			return 1;
+
+		case OP_RESET:
+			if (r->len != 0) return 0;
+			editor_del_rows(0, E.numrows);
+			return 1;
+	}
+	return 0;
+}
+
+// replays the journal found by journal_found on top of the loaded file and
+// keeps appending to it, returns the number of records applied or -1
+int journal_replay()
+{
+	int fd = open(J.path, O_RDWR | O_APPEND);
+	if (fd == -1) return -1;
+	struct stat st;
+	if (fstat(fd, &st) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	char* data = malloc(st.st_size);
+	if (st.st_size < (off_t) sizeof(J.header) || pread(fd, data, st.st_size, 0) != st.st_size)
+	{
+		free(data);
+		close(fd);
+		return -1;
+	}
+	memcpy(&J.header, data, sizeof(J.header));
+
+	// a paged buffer can only be edited once its index is complete
+	while (E.paged && pager_progress() >= 0)
+	{
+		set_status_message("Indexing before recovery... %d%%", pager_progress());
+		event_redraw();
+		event_wait(100);
+	}
+
+	undo_suspend();
+	journal_suspend();
+	editor_syntax_defer();
+
+	int count = 0;
+	int last_row = 0;
+	size_t off = sizeof(struct header);
+	struct record r;
+	while (off + sizeof(r) <= (size_t) st.st_size)
+	{
+		memcpy(&r, &data[off], sizeof(r));
+		if (off + sizeof(r) + r.len > (size_t) st.st_size) break;
+		if (!apply(&r, &data[off + sizeof(r)])) break;
+		off += sizeof(r) + r.len;
+		last_row = r.a;
+		++count;
+	}
+
+	editor_syntax_flush();
+	journal_resume();
+	undo_resume();
+	free(data);
+
+	// drop whatever could not be applied and continue the journal from there
+	if (ftruncate(fd, off) == -1) die("ftruncate");
+	pthread_mutex_lock(&J.io);
+	enter();
+	J.fd = fd;
+	J.size = off;
+	leave();
+	pthread_mutex_unlock(&J.io);
+	start_writer();
+
+	if (count > 0)
+	{
+		E.is_dirty = 1;
+		E.cy = last_row < E.numrows ? last_row : E.numrows;
+		E.cx = 0;
+	}
+	return count;
+}
@@ -0,0 +1,32 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include "editor.h"
+
+// Crash-recovery journal. Every edit applied to the buffer is appended as
+// a compact record to a swap file next to E.filename (.name.swp); records
+// are buffered in memory and written plus fdatasync'd by a background
+// thread every JOURNAL_COMMIT_MS or once JOURNAL_COMMIT_BYTES are pending,
+// so typing never waits for the disk. Once the swap file passes
+// JOURNAL_COMPACT_BYTES and twice the size of the buffer, it is rewritten as
+// a snapshot of the buffer. The journal is removed on save.
+
+#define JOURNAL_COMMIT_MS 500
+#define JOURNAL_COMMIT_BYTES (64 * 1024)
+#define JOURNAL_COMPACT_BYTES (64LL * 1024 * 1024)
+
+void journal_suspend();
+void journal_resume();
+
+void journal_insert_text(int row, int col, const char* s, size_t len);
+void journal_delete_text(int row, int col, size_t len);
+void journal_insert_rows(int at, int n, char** lines, size_t* lens);
+void journal_delete_rows(int at, int n);
+
+void journal_flush();
+void journal_discard();
+
+long long journal_found(int* stale);
+int journal_replay();
+
+#endif
@@ -0,0 +1,191 @@
+#include "event.h"
+#include "frame.h"
+#include "latency.h"
+
+#define RING_MASK (LATENCY_RING_SIZE - 1)
+
+static struct
+{
+	// written by the main thread only, head is published with a release
+	// store so a reader on any thread sees whole samples up to it
+	struct latency_sample ring[LATENCY_RING_SIZE];
+	unsigned long long head;
+
+	struct latency_sample pending[LATENCY_PENDING];
+	long long edit_end[LATENCY_PENDING];
+	int npending;
+	int open; // the last pending key is still in its edit phase
+	long long edit_start;
+	long long highlight_start;
+
+	long long compose_start;
+	long long write_start;
+	int bytes;
+
+	const char* dump;
+	int hud;
+	char hud_text[64];
+	unsigned long long hud_head; // ring head the HUD text was computed at
+} L;
+
+long long latency_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int to_us(long long ns)
+{
+	return ns < 0 ? 0 : (int) (ns / 1000);
+}
+
+static void push(struct latency_sample* s)
+{
+	unsigned long long head = L.head;
+	L.ring[head & RING_MASK] = *s;
+	__atomic_store_n(&L.head, head + 1, __ATOMIC_RELEASE);
+}
+
+static int cmp_int(const void* a, const void* b)
+{
+	return *(const int*) a - *(const int*) b;
+}
+
+// pct-th percentile in us of a phase over the ring, LAT_PHASES for the total
+int latency_percentile(int phase, int pct)
+{
+	static int values[LATENCY_RING_SIZE];
+	unsigned long long head = __atomic_load_n(&L.head, __ATOMIC_ACQUIRE);
+	int n = head < LATENCY_RING_SIZE ? (int) head : LATENCY_RING_SIZE;
+	if (n == 0) return 0;
+
+	for (int i = 0; i < n; ++i)
+	{
+		struct latency_sample* s = &L.ring[(head - 1 - i) & RING_MASK];
+		values[i] = phase == LAT_PHASES ? s->total_us : s->us[phase];
+	}
+	qsort(values, n, sizeof(int), cmp_int);
+	return values[(long long) n * pct / 100 < n ? (long long) n * pct / 100 : n - 1];
+}
+
+static void dump()
+{
+	FILE* fp = fopen(L.dump, "w");
+	if (!fp) return;
+
+	static const char* names[] = { "decode", "edit", "highlight", "wait", "compose", "write", "total" };
+	fprintf(fp, "# us per phase of the last %d keys\n", LATENCY_RING_SIZE);
+	for (int p = 0; p <= LAT_PHASES; ++p)
+		fprintf(fp, "# %-9s p50 %d p90 %d p99 %d\n", names[p],
+			latency_percentile(p, 50), latency_percentile(p, 90), latency_percentile(p, 99));
+	fprintf(fp, "# start_ms key decode edit highlight wait compose write total frame_bytes\n");
+
+	unsigned long long head = __atomic_load_n(&L.head, __ATOMIC_ACQUIRE);
+	unsigned long long i = head > LATENCY_RING_SIZE ? head - LATENCY_RING_SIZE : 0;
+	for (; i < head; ++i)
+	{
+		struct latency_sample* s = &L.ring[i & RING_MASK];
+		fprintf(fp, "%lld %d", s->start / 1000000, s->key);
+		for (int p = 0; p < LAT_PHASES; ++p) fprintf(fp, " %d", s->us[p]);
+		fprintf(fp, " %d %d\n", s->total_us, s->bytes);
+	}
+	fclose(fp);
+}
+
+void latency_init()
+{
+	editor_syntax_timing(1);
+	L.dump = getenv("YOLO_LATENCY_DUMP");
+	if (L.dump && *L.dump) atexit(dump);
+}
+
+// ends the edit phase of the key being processed
+static void close_key()
+{
+	if (!L.open) return;
+	L.open = 0;
+
+	struct latency_sample* s = &L.pending[L.npending - 1];
+	long long now = latency_now();
+	long long highlight = editor_syntax_spent() - L.highlight_start;
+	s->us[LAT_EDIT] = to_us(now - L.edit_start - highlight);
+	s->us[LAT_HIGHLIGHT] = to_us(highlight);
+	L.edit_end[L.npending - 1] = now;
+}
+
+// called by read_key for every key it hands out
+void latency_key(int key, long long start, long long decode_ns)
+{
+	close_key();
+	if (L.npending == LATENCY_PENDING)
+	{
+		// no frame for a long while, the oldest key goes without its paint
+		memmove(&L.pending[0], &L.pending[1], sizeof(L.pending[0]) * (LATENCY_PENDING - 1));
+		memmove(&L.edit_end[0], &L.edit_end[1], sizeof(L.edit_end[0]) * (LATENCY_PENDING - 1));
+		--L.npending;
+	}
+
+	struct latency_sample* s = &L.pending[L.npending++];
+	memset(s, 0, sizeof(*s));
+	s->start = start;
+	s->key = key;
+	s->us[LAT_DECODE] = to_us(decode_ns);
+
+	L.open = 1;
+	L.edit_start = latency_now();
+	L.highlight_start = editor_syntax_spent();
+}
+
+void latency_key_done()
+{
+	close_key();
+}
+
+void latency_frame_begin()
+{
+	close_key();
+	L.compose_start = latency_now();
+
+	if (!L.hud) return;
+	if (L.hud_head != L.head)
+	{
+		L.hud_head = L.head;
+		const struct frame_stats* f = frame_stats();
+		snprintf(L.hud_text, sizeof(L.hud_text), "p50 %.1f p99 %.1f ms | %d B/f | %d fps",
+			latency_percentile(LAT_PHASES, 50) / 1000.0, latency_percentile(LAT_PHASES, 99) / 1000.0,
+			f->last_bytes, f->fps);
+	}
+	E.hud = L.hud_text;
+}
+
+void latency_frame_write(int bytes)
+{
+	L.write_start = latency_now();
+	L.bytes = bytes;
+}
+
+// every key processed before this frame is on screen now
+void latency_frame_end()
+{
+	long long now = latency_now();
+	for (int i = 0; i < L.npending; ++i)
+	{
+		struct latency_sample* s = &L.pending[i];
+		s->us[LAT_WAIT] = to_us(L.compose_start - L.edit_end[i]);
+		s->us[LAT_COMPOSE] = to_us(L.write_start - L.compose_start);
+		s->us[LAT_WRITE] = to_us(now - L.write_start);
+		s->total_us = to_us(now - s->start);
+		s->bytes = L.bytes;
+		push(s);
+	}
+	L.npending = 0;
+}
+
+void latency_show_hud(int on)
+{
+	L.hud = on;
+	L.hud_head = ~0ULL;
+	if (!L.hud) E.hud = NULL;
+	event_redraw();
+}
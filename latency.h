@@ -0,0 +1,44 @@
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include "editor.h"
+
+// Keystroke-to-paint latency. Each key is timed from the read that brought
+// it in to the write of the frame that shows it, split into phases, and the
+// samples go to a lock-free ring. ^P shows a HUD with p50/p99 in the
+// status bar, and YOLO_LATENCY_DUMP=path writes the ring there at exit.
+
+#define LATENCY_RING_SIZE 4096 // must be a power of two
+#define LATENCY_PENDING 64     // keys waiting for a frame
+
+enum latency_phase
+{
+	LAT_DECODE,    // read(2) and escape sequence decoding
+	LAT_EDIT,      // process_key_press, less highlighting
+	LAT_HIGHLIGHT,
+	LAT_WAIT,      // until the event loop starts the frame
+	LAT_COMPOSE,   // refresh_screen building the frame
+	LAT_WRITE,     // write(2) of the frame
+	LAT_PHASES
+};
+
+struct latency_sample
+{
+	long long start; // ns, when the key was read
+	int key;
+	int bytes; // of the frame that showed the key
+	int us[LAT_PHASES];
+	int total_us;
+};
+
+void latency_init();
+long long latency_now();
+void latency_key(int key, long long start, long long decode_ns);
+void latency_key_done();
+void latency_frame_begin();
+void latency_frame_write(int bytes);
+void latency_frame_end();
+void latency_show_hud(int on);
+int latency_percentile(int phase, int pct);
+
+#endif
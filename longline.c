@@ -0,0 +1,496 @@
+#include "event.h"
+#include "longline.h"
+#include "mem.h"
+#include "rowmem.h"
+#include "utf8.h"
+
+struct chunk
+{
+	int start; // offset in chars
+	int len;
+	int plain; // 1 when ASCII without tabs, -1 when not checked yet
+	int rx; // render column of the first byte
+	struct lex_state st; // lexer state at the first byte
+};
+
+struct long_line
+{
+	struct chunk* c; // n chunks and a sentinel holding the end of the row
+	int n;
+	int cap;
+	int rx_valid; // chunks whose rx is up to date
+	int st_valid; // chunks whose lexer state is up to date
+	int st_known; // states below this were right before the last edit
+	struct editor_syntax* syntax;
+
+	// the part of the row drawn last, render columns [win_rx, win_rx + win_len)
+	// in win_bytes bytes
+	int win_valid;
+	int win_rx;
+	int win_len;
+	int win_bytes;
+	char* win;
+	unsigned char* win_hl;
+	int win_cap;
+};
+
+#define STATE_UNKNOWN 255 // stored in st.skip, never produced by the lexer
+
+// a row whose end state is still being lexed in the background
+static struct long_line* pending;
+static int pending_idx;
+
+static char* scratch;
+static unsigned char* scratch_hl;
+static int scratch_cap;
+
+static void reserve(char** buf, unsigned char** hl, int* cap, int need)
+{
+	if (need <= *cap) return;
+	mem_add(MEM_RENDER, need + need / 2 - *cap);
+	mem_add(MEM_HL, need + need / 2 - *cap);
+	*cap = need + need / 2;
+	*buf = realloc(*buf, *cap);
+	*hl = realloc(*hl, *cap);
+}
+
+static int same_state(struct lex_state* a, struct lex_state* b)
+{
+	return !memcmp(a, b, sizeof(*a));
+}
+
+// last chunk starting at or before `at`
+static int find_chunk(struct long_line* L, int at)
+{
+	int lo = 0, hi = L->n - 1;
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if (L->c[mid].start <= at) lo = mid;
+		else hi = mid - 1;
+	}
+	return lo;
+}
+
+// last chunk starting at or before render column rx
+static int find_chunk_rx(struct long_line* L, int rx)
+{
+	int lo = 0, hi = L->n - 1;
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if (L->c[mid].rx <= rx) lo = mid;
+		else hi = mid - 1;
+	}
+	return lo;
+}
+
+static int expand(char c, int rx, char* out)
+{
+	int o = 0;
+	if (c != '\t')
+	{
+		out[o++] = c;
+		return o;
+	}
+	out[o++] = ' ';
+	while ((rx + o) % TAB_LEN != 0) out[o++] = ' ';
+	return o;
+}
+
+static int is_plain(erow* row, struct chunk* ch)
+{
+	if (ch->plain == -1)
+	{
+		const char* s = &row->chars[ch->start];
+		ch->plain = !memchr(s, '\t', ch->len) && utf8_is_ascii(s, ch->len);
+	}
+	return ch->plain;
+}
+
+// where the clusters of a chunk start: a character or cluster running over
+// from the chunk before belongs to that chunk
+static int chunk_first(erow* row, struct chunk* ch)
+{
+	return utf8_resync(row->chars, row->size, ch->start);
+}
+
+// renders chunks [a, b) followed by up to LEX_LOOKAHEAD bytes of what comes
+// after, returns the length without them
+static int render_chunks(erow* row, int a, int b, char* out)
+{
+	struct long_line* L = row->wide;
+	int o = 0;
+	int col = L->c[a].rx;
+	int j = chunk_first(row, &L->c[a]);
+	for (int i = a; i < b; ++i)
+	{
+		struct chunk* ch = &L->c[i];
+		if (j == ch->start && is_plain(row, ch))
+		{
+			memcpy(&out[o], &row->chars[j], ch->len);
+			o += ch->len;
+			col += ch->len;
+			j += ch->len;
+			continue;
+		}
+		while (j < ch->start + ch->len)
+		{
+			int at = j;
+			int width = utf8_step(row->chars, row->size, &j, col);
+			if (row->chars[at] == '\t')
+			{
+				memset(&out[o], ' ', width);
+				o += width;
+			}
+			else
+			{
+				memcpy(&out[o], &row->chars[at], j - at);
+				o += j - at;
+			}
+			col += width;
+		}
+	}
+	int body = o;
+	for (; j < row->size && o - body < LEX_LOOKAHEAD; ++j) o += expand(row->chars[j], col + o - body, &out[o]);
+	out[o] = '\0';
+	return body;
+}
+
+// room render_chunks may need for chunks [a, b)
+static int render_room(struct long_line* L, int a, int b)
+{
+	return (L->c[b].start - L->c[a].start) + (L->c[b].rx - L->c[a].rx) + UTF8_CLUSTER_MAX + LEX_LOOKAHEAD + TAB_LEN + 1;
+}
+
+static int chunk_width(erow* row, struct chunk* ch)
+{
+	if (is_plain(row, ch)) return ch->len;
+
+	int rx = ch->rx;
+	for (int j = chunk_first(row, ch); j < ch->start + ch->len;)
+		rx += utf8_step(row->chars, row->size, &j, rx);
+	return rx - ch->rx;
+}
+
+static void ensure_rx(erow* row, int j)
+{
+	struct long_line* L = row->wide;
+	for (; L->rx_valid <= j; ++L->rx_valid)
+	{
+		struct chunk* ch = &L->c[L->rx_valid - 1];
+		L->c[L->rx_valid].rx = ch->rx + chunk_width(row, ch);
+	}
+}
+
+// lexes chunks forward until the state at chunk j is known, stopping early
+// when a state matches the one stored before the last edit. Gives up after
+// `budget` chunks (-1 for no limit) and returns 0 then.
+static int ensure_state(erow* row, int j, int budget)
+{
+	struct long_line* L = row->wide;
+	while (L->st_valid <= j)
+	{
+		if (budget-- == 0) return 0;
+
+		int i = L->st_valid - 1;
+		ensure_rx(row, i + 1);
+		reserve(&scratch, &scratch_hl, &scratch_cap, render_room(L, i, i + 1));
+		int len = render_chunks(row, i, i + 1, scratch);
+
+		struct lex_state st = L->c[i].st;
+		editor_syntax_lex(scratch, len, scratch_hl, &st);
+		if (i + 1 < L->st_known && same_state(&st, &L->c[i + 1].st))
+		{
+			L->st_valid = L->st_known;
+			continue;
+		}
+		L->c[i + 1].st = st;
+		L->st_valid = i + 2;
+		if (L->st_known < L->st_valid) L->st_known = L->st_valid;
+	}
+	return 1;
+}
+
+static void insert_chunk(struct long_line* L, int at)
+{
+	if (L->n + 2 > L->cap)
+	{
+		mem_add(MEM_ROWS, sizeof(struct chunk) * (L->cap + 2));
+		L->cap = L->cap * 2 + 2;
+		L->c = realloc(L->c, sizeof(struct chunk) * L->cap);
+	}
+	memmove(&L->c[at + 1], &L->c[at], sizeof(struct chunk) * (L->n + 1 - at));
+	++L->n;
+	L->c[at].len = 0;
+	L->c[at].plain = -1;
+	L->c[at].st.skip = STATE_UNKNOWN;
+	if (at < L->st_known) ++L->st_known;
+}
+
+static void remove_chunk(struct long_line* L, int at)
+{
+	memmove(&L->c[at], &L->c[at + 1], sizeof(struct chunk) * (L->n - at));
+	--L->n;
+	if (at < L->st_known) --L->st_known;
+}
+
+static struct long_line* open_row(erow* row)
+{
+	struct long_line* L = calloc(1, sizeof(struct long_line));
+	int n = (row->size + LONGLINE_CHUNK - 1) / LONGLINE_CHUNK;
+	if (n == 0) n = 1;
+	L->cap = n + 1;
+	L->c = malloc(sizeof(struct chunk) * L->cap);
+	mem_add(MEM_ROWS, sizeof(struct long_line) + sizeof(struct chunk) * L->cap);
+	L->n = n;
+	for (int i = 0; i <= n; ++i)
+	{
+		L->c[i].start = i < n ? i * LONGLINE_CHUNK : row->size;
+		L->c[i].len = i < n - 1 ? LONGLINE_CHUNK : (i == n - 1 ? row->size - i * LONGLINE_CHUNK : 0);
+		L->c[i].plain = -1;
+		L->c[i].st.skip = STATE_UNKNOWN;
+	}
+	L->c[0].rx = 0;
+	L->rx_valid = 1;
+	return L;
+}
+
+// called by the row functions after chars changed at `at`
+void longline_edit(erow* row, int at, int removed, int inserted)
+{
+	struct long_line* L = row->wide;
+	if (!L) return;
+
+	int k = find_chunk(L, at);
+	int off = at - L->c[k].start;
+	int i = k;
+	while (removed > 0 && i < L->n)
+	{
+		int take = L->c[i].len - off < removed ? L->c[i].len - off : removed;
+		L->c[i].len -= take;
+		L->c[i].plain = -1;
+		removed -= take;
+		off = 0;
+		++i;
+	}
+	L->c[k].len += inserted;
+	L->c[k].plain = -1;
+
+	// drop the chunks emptied by the removal, split what grew too big and
+	// merge what got too small
+	while (k + 1 < L->n && L->c[k + 1].len == 0) remove_chunk(L, k + 1);
+	int first = k;
+	while (L->c[k].len > 2 * LONGLINE_CHUNK)
+	{
+		insert_chunk(L, k + 1);
+		L->c[k + 1].len = L->c[k].len - LONGLINE_CHUNK;
+		L->c[k].len = LONGLINE_CHUNK;
+		++k;
+	}
+	if (L->c[k].len < LONGLINE_CHUNK / 4 && L->n > 1)
+	{
+		if (k + 1 < L->n)
+		{
+			L->c[k].len += L->c[k + 1].len;
+			remove_chunk(L, k + 1);
+		}
+		else
+		{
+			L->c[k - 1].len += L->c[k].len;
+			L->c[k - 1].plain = -1;
+			remove_chunk(L, k);
+			if (first > k - 1) first = k - 1;
+		}
+	}
+
+	for (i = first + 1; i <= L->n; ++i) L->c[i].start = L->c[i - 1].start + L->c[i - 1].len;
+	L->c[L->n].len = 0;
+	if (L->rx_valid > first + 1) L->rx_valid = first + 1;
+	if (L->st_valid > first + 1) L->st_valid = first + 1;
+	L->win_valid = 0;
+}
+
+// editor_update_row for long rows, returns 0 when the row is handled the usual way
+int longline_update(erow* row)
+{
+	if (!row->wide)
+	{
+		if (row->size < LONGLINE_MIN) return 0;
+		row->wide = open_row(row);
+	}
+	else if (row->size < LONGLINE_MIN / 2)
+	{
+		longline_free(row);
+		return 0;
+	}
+
+	struct long_line* L = row->wide;
+	utf8_free(row);
+	rowmem_layout(row, 0); // the block only holds chars
+	ensure_rx(row, L->n);
+	reserve(&L->win, &L->win_hl, &L->win_cap, 1);
+	row->rsize = L->c[L->n].rx;
+	row->render = L->win;
+	row->hl = L->win_hl;
+	L->win_valid = 0;
+
+	editor_update_syntax(row);
+	return 1;
+}
+
+static erow* pending_row()
+{
+	if (pending_idx < E.numrows)
+	{
+		erow* row = editor_row_peek(pending_idx);
+		if (row && row->wide == pending) return row;
+	}
+	// rows above it were inserted or deleted since
+	for (int i = 0; i < E.numrows; ++i)
+	{
+		erow* row = editor_row_peek(i);
+		if (row && row->wide == pending) return row;
+	}
+	return NULL;
+}
+
+static void catch_up()
+{
+	if (!pending) return;
+	erow* row = pending_row();
+	if (!row)
+	{
+		pending = NULL;
+		return;
+	}
+	if (!ensure_state(row, pending->n, LONGLINE_LEX_BUDGET))
+	{
+		event_timer(0, catch_up);
+		return;
+	}
+	pending = NULL;
+	editor_update_syntax(row); // carries the end state over to the rows below
+	event_redraw();
+}
+
+// lexes towards the end of the row, returns 1 when its open comment state
+// changed. An edit that doesn't converge within LONGLINE_LEX_BUDGET chunks
+// leaves the rest to catch_up, between key presses.
+int longline_highlight(erow* row)
+{
+	struct long_line* L = row->wide;
+	struct lex_state st = editor_syntax_start(row);
+	if (L->syntax != E.syntax || L->st_valid == 0 || !same_state(&st, &L->c[0].st))
+	{
+		L->syntax = E.syntax;
+		L->c[0].st = st;
+		L->st_valid = L->st_known = 1;
+	}
+	L->win_valid = 0;
+	if (pending && pending != L)
+	{
+		// only one row catches up at a time, finish the other one now
+		erow* other = pending_row();
+		if (other) ensure_state(other, pending->n, -1);
+		pending = NULL;
+		if (other && other->hl_open_comment != other->wide->c[other->wide->n].st.in_comment)
+			editor_update_syntax(other);
+	}
+	if (!ensure_state(row, L->n, LONGLINE_LEX_BUDGET))
+	{
+		pending = L;
+		pending_idx = row->idx;
+		event_timer(0, catch_up);
+		return 0;
+	}
+	if (pending == L) pending = NULL;
+
+	int open = L->c[L->n].st.in_comment;
+	int changed = (row->hl_open_comment != open);
+	row->hl_open_comment = open;
+	return changed;
+}
+
+// points render and hl at a window covering columns [rx, rx + cols), sets
+// *len to its bytes and returns the column render starts at
+int longline_window(erow* row, int rx, int cols, int* len)
+{
+	struct long_line* L = row->wide;
+	int end = rx + cols < row->rsize ? rx + cols : row->rsize;
+	if (L->win_valid && rx >= L->win_rx && end <= L->win_rx + L->win_len)
+	{
+		*len = L->win_bytes;
+		return L->win_rx;
+	}
+
+	// a screen of margin on each side keeps short scrolls inside the window
+	int a = find_chunk_rx(L, rx > cols ? rx - cols : 0);
+	int b = find_chunk_rx(L, rx + 2 * cols);
+	if (L->st_valid == 0) longline_highlight(row);
+	ensure_state(row, a, -1);
+
+	reserve(&L->win, &L->win_hl, &L->win_cap, render_room(L, a, b + 1));
+	int bytes = render_chunks(row, a, b + 1, L->win);
+	struct lex_state st = L->c[a].st;
+	editor_syntax_lex(L->win, bytes, L->win_hl, &st);
+
+	L->win_rx = L->c[a].rx;
+	L->win_len = L->c[b + 1].rx - L->c[a].rx;
+	L->win_bytes = bytes;
+	L->win_valid = 1;
+	*len = bytes;
+	row->render = L->win;
+	row->hl = L->win_hl;
+	return L->win_rx;
+}
+
+int longline_cx_to_rx(erow* row, int cx)
+{
+	struct long_line* L = row->wide;
+	int k = find_chunk(L, cx);
+	ensure_rx(row, k);
+
+	struct chunk* ch = &L->c[k];
+	if (is_plain(row, ch)) return ch->rx + cx - ch->start;
+
+	int rx = ch->rx;
+	for (int j = chunk_first(row, ch); j < cx && j < row->size;)
+		rx += utf8_step(row->chars, row->size, &j, rx);
+	return rx;
+}
+
+int longline_rx_to_cx(erow* row, int rx)
+{
+	struct long_line* L = row->wide;
+	ensure_rx(row, L->n);
+	int k = find_chunk_rx(L, rx);
+
+	struct chunk* ch = &L->c[k];
+	if (is_plain(row, ch) && rx < ch->rx + ch->len) return ch->start + rx - ch->rx;
+
+	int cur_rx = ch->rx;
+	int cx = chunk_first(row, ch);
+	while (cx < row->size)
+	{
+		int at = cx;
+		cur_rx += utf8_step(row->chars, row->size, &cx, cur_rx);
+		if (cur_rx > rx) return at;
+	}
+	return cx;
+}
+
+void longline_free(erow* row)
+{
+	struct long_line* L = row->wide;
+	if (!L) return;
+	if (pending == L) pending = NULL;
+	mem_add(MEM_ROWS, -(long long) (sizeof(struct long_line) + sizeof(struct chunk) * L->cap));
+	mem_add(MEM_RENDER, -L->win_cap);
+	mem_add(MEM_HL, -L->win_cap);
+	free(L->c);
+	free(L->win);
+	free(L->win_hl);
+	free(L);
+	row->wide = NULL;
+}
@@ -0,0 +1,26 @@
+#ifndef LONGLINE_H_
+#define LONGLINE_H_
+
+#include "editor.h"
+
+// Long-line mode. A row of LONGLINE_MIN bytes or more keeps its text in
+// chars but is indexed in chunks of about LONGLINE_CHUNK bytes, each with
+// the render column and the lexer state at its start. render and hl then
+// only hold a window around E.coloff, lexed from the checkpoint of its first
+// chunk, so an edit or a scroll costs a few chunks rather than the line.
+
+#define LONGLINE_MIN (64 * 1024)
+#define LONGLINE_CHUNK 4096
+#define LONGLINE_LEX_BUDGET 32 // chunks lexed per edit before the rest moves to the background
+
+struct long_line;
+
+int longline_update(erow* row);
+void longline_edit(erow* row, int at, int removed, int inserted);
+int longline_highlight(erow* row);
+int longline_window(erow* row, int rx, int cols, int* len);
+int longline_cx_to_rx(erow* row, int cx);
+int longline_rx_to_cx(erow* row, int rx);
+void longline_free(erow* row);
+
+#endif
@@ -2,428 +2,437 @@
 #define _BSD_SOURCE
 #define _GNU_SOURCE
 
-#include <fcntl.h>
+#include <sys/stat.h>
 
+#include "bracket.h"
+#include "clip.h"
+#include "complete.h"
 #include "editor.h"
+#include "event.h"
+#include "filter.h"
+#include "fold.h"
+#include "follow.h"
+#include "frame.h"
+#include "input.h"
+#include "journal.h"
+#include "latency.h"
+#include "mem.h"
+#include "pager.h"
+#include "session.h"
+#include "symbol.h"
+#include "trace.h"
+#include "undo.h"
+#include "utf8.h"
 
-struct editor_config E;
-
-enum keys
-{
-	BACKSPACE = 127,
-	ARROW_LEFT = 1000,
-	ARROW_RIGHT,
-	ARROW_UP,
-	ARROW_DOWN,
-	PAGE_UP,
-	PAGE_DOWN,
-	HOME_KEY,
-	END_KEY,
-	DEL_KEY
-};
-
-void set_status_message(const char* fmt, ...);
-void refresh_screen();
 char* editor_prompt(char* prompt, void (*callback) (char*, int));
+void process_key_press();
 
-int read_key()
+// offers to replay the edits journaled by a session that didn't end cleanly
+void editor_recover()
 {
-	int nread;
-	char c;
-	while ((nread = read(STDIN_FILENO, &c, 1)) != 1)
+	int stale = 0;
+	long long found = journal_found(&stale);
+	if (found < 0) return;
+	if (found == 0)
 	{
-		if (nread == -1 && nread != EAGAIN)
-			die("read");
+		journal_discard();
+		return;
 	}
 
-	if (c == '\x1b') // escape character
+	char prompt[96];
+	snprintf(prompt, sizeof(prompt), "Unsaved edits found%s, recover them? (y/n) %%s",
+		stale ? " (file changed since)" : "");
+	char* answer = editor_prompt(prompt, NULL);
+	if (answer && (answer[0] == 'y' || answer[0] == 'Y'))
 	{
-		char seq[3];
-		if (read(STDIN_FILENO, &seq[0], 1) == -1) return '\x1b';
-		if (read(STDIN_FILENO, &seq[1], 1) == -1) return '\x1b';
-		if (seq[0] == '[')
-		{
-			if (seq[1] >= '0' && seq[1] <= '9')
-			{
-				if (read(STDIN_FILENO, &seq[2], 1) == -1) return '\x1b';
-				if (seq[2] == '~')
-				{
-					switch (seq[1])
-					{
-						case '1': return HOME_KEY;
-						case '3': return DEL_KEY;
-						case '4': return END_KEY;
-						case '5': return PAGE_UP;
-						case '6': return PAGE_DOWN;
-						case '7': return HOME_KEY;
-						case '8': return END_KEY;
-					}
-				}
-			}
-			else
-			{
-				switch (seq[1])
-				{
-					case 'A': return ARROW_UP;
-					case 'B': return ARROW_DOWN;
-					case 'C': return ARROW_RIGHT;
-					case 'D': return ARROW_LEFT;
-					case 'H': return HOME_KEY;
-					case 'F': return END_KEY;
-				}
-			}
-		}
-		else if (seq[0] == 'O')
-		{
-			switch (seq[1])
-			{
-				case 'H': return HOME_KEY;
-				case 'F': return END_KEY;
-			}
-		}
-		return '\x1b';
+		long long start = event_now_ms();
+		int count = journal_replay();
+		if (count == -1) set_status_message("Can't read the journal: %s", strerror(errno));
+		else set_status_message("Recovered %d edits in %lld ms", count, event_now_ms() - start);
 	}
 	else
 	{
-		return c;
+		journal_discard();
 	}
+	free(answer);
 }
 
-// row operation
-
-int editor_row_rx_to_cx(erow* row, int rx)
-{
-	int cur_rx = 0;
-	int cx;
-
-	for (cx = 0; cx < row->size; ++cx)
-	{
-		if (row->chars[cx] == '\t')
-			cur_rx += (TAB_LEN - 1) - (cur_rx % TAB_LEN);
-		++cur_rx;
-
-		if (cur_rx > rx) return cx;
-	}
-	return cx;
-}
-
-void editor_update_row(erow* row)
+void editor_save()
 {
-	int tabs = 0;
-	int j;
-	for (j=0; j < row->size; ++j)
-		if (row->chars[j] == '\t') tabs++;
-
-	free(row->render);
-	row->render = malloc(row->size + (tabs*(TAB_LEN-1)) + 1); // row->size already count 1 for each tab
-
-	int idx = 0;
-	for (j = 0; j < row->size; ++j)
+	if (E.filename == NULL)
 	{
-		if (row->chars[j] == '\t')
-		{
-			row->render[idx++] = ' ';
-			while (idx % TAB_LEN != 0) row->render[idx++] = ' '; // the next tab stop is the first column multiple of TAB_LEN
-		}
-		else
+		E.filename = editor_prompt("Save as: %s", NULL);
+		if (E.filename == NULL)
 		{
-			row->render[idx++] = row->chars[j];
+			set_status_message("Save aborted");
+			return;
 		}
+		editor_select_syntax_highlight();
 	}
 
-	row->render[idx] = '\0';
-	row->rsize = idx;
-
-	editor_update_syntax(row);
+	// the span leaves out the time spent at the prompt
+	long long span = trace_begin();
+	long long written = editor_write_file();
+	trace_end("editor_save", span);
+	if (written == -1)
+	{
+		set_status_message("Can't save! I/O error: %s", strerror(errno));
+		return;
+	}
+	set_status_message("%lld bytes written to disk", written);
+	symbol_file_saved();
 }
 
-void editor_insert_row(int at, char* s, size_t len)
+static void find_step(char* query, int key)
 {
-	if (at < 0 || at > E.numrows) return;
-
-	E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-	memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
-	for (int j = at + 1; j <= E.numrows; ++j) E.row[j].idx++;
-
-	E.row[at].idx = at;
+	static int last_match = -1;
+	static int direction = 1;
 
-	E.row[at].size = len;
-	E.row[at].chars = malloc(len + 1);
-	memcpy(E.row[at].chars, s, len);
-	E.row[at].chars[len] = '\0';
+	static int saved_hl_line;
+	static int saved_hl_len;
+	static char* saved_hl = NULL;
 
-	E.row[at].rsize = 0;
-	E.row[at].render = NULL;
-	E.row[at].hl = NULL;
-	E.row[at].hl_open_comment = 0;
-	editor_update_row(&E.row[at]);
+	if (saved_hl)
+	{
+		erow* row = editor_row_peek(saved_hl_line);
+		if (row) memcpy(row->hl, saved_hl, row->rsize);
+		mem_add(MEM_SEARCH, -saved_hl_len);
+		free(saved_hl);
+		saved_hl = NULL;
+	}
 
-	++E.numrows;
-	E.is_dirty = 1;
-}
+	if (key == '\r' || key == '\x1b')
+	{
+		last_match = -1;
+		direction = 1;
+		return;
+	}
+	else if (key == ARROW_RIGHT || key == ARROW_DOWN)
+	{
+		direction = 1;
+	}
+	else if (key == ARROW_LEFT || key == ARROW_UP)
+	{
+		direction = -1;
+	}
+	else
+	{
+		last_match = -1;
+		direction = 1;
+	}
 
-void editor_free_row(erow* row)
-{
-	free(row->render);
-	free(row->chars);
-	free(row->hl);
+	if (last_match == -1) direction = 1;
+	int cx, rx;
+	int current = editor_search(query, last_match, direction, &cx, &rx);
+	if (current == -1) return;
+
+	last_match = current;
+	E.cy = current;
+	E.cx = cx;
+	E.rowoff = E.numrows;
+	if (rx == -1) return;
+
+	erow* row = editor_row_at(current);
+	saved_hl_line = current;
+	saved_hl = malloc(row->rsize);
+	saved_hl_len = row->rsize;
+	mem_add(MEM_SEARCH, saved_hl_len);
+	memcpy(saved_hl, row->hl, row->rsize);
+	memset(&row->hl[rx], HL_MATCH, strlen(query));
 }
 
-void editor_del_row(int at)
+void editor_find_callback(char* query, int key)
 {
-	if (at < 0 || at >= E.numrows) return;
-	editor_free_row(&E.row[at]);
-	memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-	for (int j = at; j < E.numrows - 1; ++j) E.row[j].idx--;
-	--E.numrows;
-	E.is_dirty = 1;
+	long long span = trace_begin();
+	find_step(query, key);
+	trace_end("editor_find_callback", span);
 }
 
-void editor_row_insert_char(erow* row, int at, int c)
+// ^P cycles the status bar HUD through key latency, memory and off
+static void editor_cycle_hud()
 {
-	if (at == 0 || at > row->size) at = row->size;
-	row->chars = realloc(row->chars, row->size + 2);
-	memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-	++row->size;
-	row->chars[at] = c;
-	editor_update_row(row);
-	E.is_dirty = 1;
+	static int hud;
+	hud = (hud + 1) % 3;
+	latency_show_hud(hud == 1);
+	mem_show_hud(hud == 2);
 }
 
-void editor_row_append_string(erow* row, char* s, size_t len)
+// ^U starts tracing, the next ^U writes the trace out
+static void editor_toggle_trace()
 {
-	row->chars = realloc(row->chars, row->size + len + 1);
-	memcpy(&row->chars[row->size], s, len);
-	row->size += len;
-	row->chars[row->size] = '\0';
-	editor_update_row(row);
-	E.is_dirty = 1;
-}
+	if (!trace_on)
+	{
+		trace_start();
+		set_status_message("Tracing, ^U writes it to %s", trace_path());
+		return;
+	}
 
-void editor_row_del_char(erow* row, int at)
-{
-	if (at < 0 || at > row->size) return;
-	memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-	row->size--;
-	editor_update_row(row);
-	E.is_dirty = 1;
+	int n = trace_stop();
+	if (n == -1)
+		set_status_message("Can't write the trace: %s", strerror(errno));
+	else
+		set_status_message("%d trace events written to %s", n, trace_path());
 }
 
-// operations
-
-void insert_char(int c)
+void editor_find()
 {
-	if (E.cy == E.numrows)
-		editor_insert_row(E.numrows, "", 0);
-	editor_row_insert_char(&E.row[E.cy], E.cx, c);
-	++E.cx;
-}
+	int saved_cx = E.cx;
+	int saved_cy = E.cy;
+	int saved_coloff = E.coloff;
+	int saved_rowoff = E.rowoff;
 
-void insert_new_line()
-{
-	if (E.cx == 0)
+	char* query = editor_prompt("Search: %s (Use ESC/Arrows/Enter)", editor_find_callback);
+	if (query)
 	{
-		editor_insert_row(E.cy, "", 0);
+		free(query);
 	}
 	else
 	{
-		erow* row = &E.row[E.cy];
-		editor_insert_row(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-		row = &E.row[E.cy];
-		row->size = E.cx;
-		row->chars[row->size] = '\0';
-		editor_update_row(row);
+		E.cx = saved_cx;
+		E.cy = saved_cy;
+		E.coloff = saved_coloff;
+		E.rowoff = saved_rowoff;
 	}
-	++E.cy;
-	E.cx = 0;
 }
 
-void del_char()
+// ^R replaces every match of a query in the buffer
+void editor_replace()
 {
-	if (E.cy == E.numrows) return;
-	if (E.cx == 0 && E.cy == 0) return;
-
-	erow* row = &E.row[E.cy];
-	if (E.cx > 0)
+	char* query = editor_prompt("Replace: %s (ESC to cancel)", NULL);
+	if (query == NULL) return;
+	char* with = editor_prompt("Replace with: %s (ESC to cancel)", NULL);
+	if (with == NULL)
 	{
-		editor_row_del_char(row, E.cx);
-		--E.cx;
+		free(query);
+		return;
 	}
-	else
+
+	long long start = event_now_ms();
+	int rows;
+	long long n = editor_replace_all(query, with, &rows, 1);
+	if (n == -1)
 	{
-		E.cx = E.row[E.cy - 1].size;
-		editor_row_append_string(&E.row[E.cy - 1], row->chars, row->size);
-		editor_del_row(E.cy);
-		--E.cy;
+		char* answer = editor_prompt("Too large to undo, replace anyway? (y/N): %s", NULL);
+		if (answer && (answer[0] == 'y' || answer[0] == 'Y'))
+		{
+			start = event_now_ms();
+			n = editor_replace_all(query, with, &rows, 0);
+		}
+		free(answer);
+		if (n == -1)
+		{
+			set_status_message("Replace cancelled");
+			free(query);
+			free(with);
+			return;
+		}
 	}
+	if (n == 0)
+		set_status_message("Not found: %s", query);
+	else
+		set_status_message("Replaced %lld matches on %d lines in %lld ms", n, rows, event_now_ms() - start);
+	free(query);
+	free(with);
 }
 
-// file i/o
-
-char* editor_rows_to_string(int* buffer_len)
+// ^A sets the mark where the cursor is, the selection runs from it to the
+// cursor until it is copied, cut or dropped with ^A or ESC
+void editor_toggle_mark()
 {
-	int file_len = 0;
-	int j;
-	for (j = 0; j < E.numrows; ++j)
+	if (E.sel_active)
 	{
-		file_len += E.row[j].size + 1;
+		E.sel_active = 0;
+		set_status_message("Mark dropped");
+		return;
 	}
-	*buffer_len = file_len;
-
-	char* buf = malloc(file_len);
-	char* p = buf;
-
-	for (j = 0; j < E.numrows; ++j)
+	if (E.paged)
 	{
-		memcpy(p, E.row[j].chars, E.row[j].size);
-		p += E.row[j].size;
-		*p = '\n';
-		++p;
+		set_status_message("Can't select in a paged file");
+		return;
 	}
-	return buf;
+	E.sel_active = 1;
+	E.sel_cx = E.cx;
+	E.sel_cy = E.cy;
+	set_status_message("Mark set (^C copy | ^X cut | ^A drop)");
 }
 
-void editor_open(char* filename)
+// ^C copies and ^X cuts the selection
+void editor_copy(int cut)
 {
-	free(E.filename);
-	E.filename = strdup(filename);
-
-	editor_select_syntax_highlight();
-
-	FILE* fp = fopen(filename, "r");
-	if (!fp) die("fopen");
-
-	char* line = NULL;
-	size_t linecap = 0;
-	ssize_t linelen;
-	while ((linelen = getline(&line, &linecap, fp)) != -1)
+	int r0, c0, r1, c1;
+	if (!clip_selection(&r0, &c0, &r1, &c1))
 	{
-		while (linelen > 0 && (line[linelen-1] == '\n' || line[linelen-1] == '\r'))
-			linelen--;
-		editor_insert_row(E.numrows, line, linelen);
+		set_status_message("No selection, ^A sets the mark");
+		return;
 	}
-	free(line);
-	fclose(fp);
-	E.is_dirty = 0;
+	long long start = event_now_ms();
+	int n = cut ? clip_cut(r0, c0, r1, c1) : clip_copy(r0, c0, r1, c1);
+	E.sel_active = 0;
+	set_status_message("%s %d lines in %lld ms", cut ? "Cut" : "Copied", n, event_now_ms() - start);
 }
 
-void editor_save()
+// ^V pastes what was copied or cut last
+void editor_paste()
 {
-	if (E.filename == NULL)
-	{
-		E.filename = editor_prompt("Save as: %s", NULL);
-		if (E.filename == NULL)
-		{
-			set_status_message("Save aborted");
-			return;
-		}
-		editor_select_syntax_highlight();
-	}
-
-	int len;
-	char* buf = editor_rows_to_string(&len);
-
-	int fd = open(E.filename, O_RDWR | O_CREAT, 0644); // @todo use a temporary file and rename it after success write
-	if (fd != -1)
-	{
-		if (ftruncate(fd, len) != -1)
-		{
-			if (write(fd, buf, len) != -1)
-			{
-				close(fd);
-				free(buf);
-				E.is_dirty = 0;
-				set_status_message("%d bytes written to disk", len);
-				return;
-			}
-		}
-		close(fd);
-	}
-	free(buf);
-	set_status_message("Can't save! I/O error: %s", strerror(errno));
+	long long start = event_now_ms();
+	int n = clip_paste();
+	if (n == 0) set_status_message("Nothing to paste");
+	else set_status_message("Pasted %d lines in %lld ms", n, event_now_ms() - start);
 }
 
-void editor_find_callback(char* query, int key)
+// ^O pipes the buffer, or lines N to M when the command starts with N,M,
+// through a shell command and puts its output in their place
+void editor_filter_rows()
 {
-	static int last_match = -1;
-	static int direction = 1;
+	char* command = editor_prompt("Filter [N,M] through: %s (ESC to cancel)", NULL);
+	if (command == NULL) return;
 
-	static int saved_hl_line;
-	static char* saved_hl = NULL;
-
-	if (saved_hl)
+	int from = 1, to = E.numrows;
+	char* p = command;
+	if (isdigit((unsigned char) *p))
 	{
-		memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-		free(saved_hl);
-		saved_hl = NULL;
+		from = to = strtol(p, &p, 10);
+		if (*p == ',') to = strtol(p + 1, &p, 10);
+		while (*p == ' ') ++p;
 	}
-
-	if (key == '\r' || key == '\x1b')
+	if (to > E.numrows) to = E.numrows;
+	if (from < 1 || from > to || !*p)
 	{
-		last_match = -1;
-		direction = 1;
+		set_status_message("Nothing to filter");
+		free(command);
 		return;
 	}
-	else if (key == ARROW_RIGHT || key == ARROW_DOWN)
+
+	long long start = event_now_ms();
+	int rows;
+	char err[FILTER_ERR_LEN];
+	int status = editor_filter(from - 1, to, p, &rows, err);
+	char* nl = strchr(err, '\n');
+	if (nl) *nl = '\0';
+
+	if (status == -1)
+		set_status_message("Can't filter: %s", err);
+	else if (rows == -1)
+		set_status_message("%s exited with %d, nothing changed: %s", p, status, err);
+	else if (status != 0)
+		set_status_message("%s exited with %d: %s (^Z undoes)", p, status, err);
+	else
+		set_status_message("Filtered %d lines into %d in %lld ms", to - from + 1, rows, event_now_ms() - start);
+
+	E.cy = from - 1 < E.numrows ? from - 1 : E.numrows;
+	E.cx = 0;
+	fold_reveal(E.cy);
+	free(command);
+}
+
+// ranked matches of the symbol prompt, shown in the prompt itself
+static struct
+{
+	struct symbol_match match[SYMBOL_MATCHES];
+	int n;
+	int total;
+	int pick;
+	char prompt[160];
+} sym;
+
+// appends s to the prompt with its % doubled, as the prompt is a format
+static void prompt_append(int* len, const char* s)
+{
+	for (; *s && *len < (int) sizeof(sym.prompt) - 2; ++s)
 	{
-		direction = 1;
+		if (*s == '%') sym.prompt[(*len)++] = '%';
+		sym.prompt[(*len)++] = *s;
 	}
-	else if (key == ARROW_LEFT || key == ARROW_UP)
+	sym.prompt[*len] = '\0';
+}
+
+static void symbol_callback(char* query, int key)
+{
+	if (key == ARROW_DOWN && sym.pick + 1 < sym.n) ++sym.pick;
+	else if (key == ARROW_UP && sym.pick > 0) --sym.pick;
+	else if (key != '\r' && key != '\x1b')
 	{
-		direction = -1;
+		sym.n = symbol_lookup(query, sym.match, SYMBOL_MATCHES, &sym.total);
+		sym.pick = 0;
 	}
-	else
+
+	int len = snprintf(sym.prompt, sizeof(sym.prompt), "Symbol: %%s");
+	if (sym.n == 0)
 	{
-		last_match = -1;
-		direction = 1;
+		if (*query) prompt_append(&len, "  (no match)");
+		return;
 	}
+	struct symbol_match* m = &sym.match[sym.pick];
+	char where[32];
+	prompt_append(&len, "  ");
+	prompt_append(&len, m->name);
+	snprintf(where, sizeof(where), " %s ", symbol_kind_name(m->kind));
+	prompt_append(&len, where);
+	prompt_append(&len, m->path);
+	snprintf(where, sizeof(where), ":%d (%d/%d)", m->line, sym.pick + 1, sym.total);
+	prompt_append(&len, where);
+}
 
-	if (last_match == -1) direction = 1;
-	int current = last_match;
-	int i;
-	for (i = 0; i < E.numrows; ++i)
-	{
-		current += direction;
-		if (current == -1) current = E.numrows - 1;
-		else if (current == E.numrows) current = 0;
+static int same_file(const char* a, const char* b)
+{
+	struct stat sa, sb;
+	return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
 
-		erow* row = &E.row[current];
-		char* match = strstr(row->render, query);
-		if (match)
+static void jump_to_symbol(struct symbol_match* m)
+{
+	if (!E.filename || !same_file(E.filename, m->path))
+	{
+		if (E.is_dirty)
 		{
-			last_match = current;
-			E.cy = current;
-			E.cx = editor_row_rx_to_cx(row, match - row->render);
-			E.rowoff = E.numrows;
-
-			saved_hl_line = current;
-			saved_hl = malloc(row->rsize);
-			memcpy(saved_hl, row->hl, row->rsize);
-			memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-			break;
+			set_status_message("Save the buffer before going to %s", m->path);
+			return;
+		}
+		if (access(m->path, R_OK) != 0)
+		{
+			set_status_message("Can't open %s: %s", m->path, strerror(errno));
+			return;
 		}
+		char* path = strdup(m->path);
+		if (E.following) follow_stop();
+		editor_close();
+		editor_open(path);
+		free(path);
+		editor_recover();
 	}
-}
-
-void editor_find()
-{
-	int saved_cx = E.cx;
-	int saved_cy = E.cy;
-	int saved_coloff = E.coloff;
-	int saved_rowoff = E.rowoff;
 
-	char* query = editor_prompt("Search: %s (Use ESC/Arrows/Enter)", editor_find_callback);
-	if (query)
+	E.cy = m->line - 1 < E.numrows ? m->line - 1 : E.numrows;
+	E.cx = 0;
+	if (E.cy < E.numrows)
 	{
-		free(query);
+		erow* row = editor_row_at(E.cy);
+		E.cx = m->col < row->size ? m->col : row->size;
 	}
-	else
+	fold_reveal(E.cy);
+	int top = fold_line(E.cy) - E.screen_rows / 2;
+	E.rowoff = fold_row(top > 0 ? top : 0);
+}
+
+// ^D looks up a definition in the symbol index and goes there, the
+// arrows pick among the best matches
+void editor_find_symbol()
+{
+	long long start = event_now_ms();
+	int parsed;
+	int files = symbol_update(&parsed);
+
+	sym.n = 0;
+	snprintf(sym.prompt, sizeof(sym.prompt), "Symbol: %%s  (%d files, %d parsed in %lld ms)",
+		files, parsed, event_now_ms() - start);
+	char* query = editor_prompt(sym.prompt, symbol_callback);
+	if (query == NULL) return;
+	free(query);
+	if (sym.n == 0)
 	{
-		E.cx = saved_cx;
-		E.cy = saved_cy;
-		E.coloff = saved_coloff;
-		E.rowoff = saved_rowoff;
+		set_status_message("No symbol matches");
+		return;
 	}
+	jump_to_symbol(&sym.match[sym.pick]);
 }
 
 // output
@@ -439,12 +448,13 @@ char *editor_prompt(char *prompt, void (*callback) (char*, int))
 
 	while (1) {
 		set_status_message(prompt, buf);
-		refresh_screen();
+		event_redraw();
 
 		int c = read_key();
 		if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE)
 		{
-			if (buflen != 0) buf[--buflen] = '\0';
+			buflen = utf8_prev(buf, buflen, buflen);
+			buf[buflen] = '\0';
 		}
 		else if (c == '\x1b')
 		{
@@ -462,7 +472,23 @@ char *editor_prompt(char *prompt, void (*callback) (char*, int))
 				return buf;
 			}
 		}
-		else if (!iscntrl(c) && c < 128)
+		else if (c == PASTE_KEY)
+		{
+			size_t len;
+			char* text = input_paste(&len);
+			for (size_t i = 0; i < len; ++i)
+			{
+				if (iscntrl((unsigned char) text[i])) continue;
+				if (buflen == bufsize - 1)
+				{
+					bufsize *= 2;
+					buf = realloc(buf, bufsize);
+				}
+				buf[buflen++] = text[i];
+			}
+			buf[buflen] = '\0';
+		}
+		else if (!iscntrl(c) && c < 256) // a byte of UTF-8 text as well
 		{
 			if (buflen == bufsize - 1)
 			{
@@ -477,45 +503,296 @@ char *editor_prompt(char *prompt, void (*callback) (char*, int))
 	}
 }
 
+void editor_goto_line()
+{
+	char* query = editor_prompt("Go to line: %s (ESC to cancel)", NULL);
+	if (query == NULL) return;
+
+	int line = atoi(query);
+	free(query);
+	if (line < 1) line = 1;
+	if (line > E.numrows) line = E.numrows;
+
+	E.cy = line > 0 ? line - 1 : 0;
+	E.cx = 0;
+	fold_reveal(E.cy);
+	int top = fold_line(E.cy) - E.screen_rows / 2;
+	E.rowoff = fold_row(top > 0 ? top : 0);
+}
+
+// ^N completes the word before the cursor from the words of the buffer.
+// With more than one candidate they are listed under it: ^N and the arrows
+// pick, Tab or Enter take the pick and typing narrows the list. A lookup
+// made while the buffer is still being indexed is made again once it is.
+static struct
+{
+	const char* words[COMPLETE_MATCHES];
+	int n;
+	int pick;
+	int partial; // looked up before the index was complete
+	int cy; // and where the cursor was
+	int cx;
+} comp;
+
+static void close_completion()
+{
+	comp.n = 0;
+	comp.partial = 0;
+	E.popup = NULL;
+	E.popup_len = 0;
+}
+
+static void show_completion()
+{
+	E.popup = comp.words;
+	E.popup_len = comp.n;
+	E.popup_pick = comp.pick;
+}
+
+// looks up the word before the cursor again, returns the candidates found
+static int update_completion()
+{
+	close_completion();
+	if (E.cy >= E.numrows) return 0;
+	erow* row = editor_row_at(E.cy);
+	int from = E.cx;
+	while (from > 0 && complete_is_word_char((unsigned char) row->chars[from - 1])) --from;
+	comp.n = complete_lookup(&row->chars[from], E.cx - from, comp.words, COMPLETE_MATCHES);
+	comp.pick = 0;
+	comp.partial = complete_indexing();
+	comp.cy = E.cy;
+	comp.cx = E.cx;
+	E.popup_cx = from;
+	return comp.n;
+}
+
+static void accept_completion()
+{
+	// the edit may drop the word from the index, it is copied out first
+	char word[COMPLETE_MAX_LEN + 1];
+	int typed = E.cx - E.popup_cx;
+	int len = strlen(comp.words[comp.pick]) - typed;
+	memcpy(word, comp.words[comp.pick] + typed, len);
+	close_completion();
+	insert_text(word, len);
+}
+
+static void completion_indexed()
+{
+	if (!comp.partial) return;
+	if (E.cy != comp.cy || E.cx != comp.cx)
+	{
+		close_completion();
+		return;
+	}
+	// the list may grow, nothing is inserted without a key
+	if (update_completion()) show_completion();
+	else set_status_message("No completions");
+	event_redraw();
+}
+
+void editor_complete()
+{
+	if (E.paged)
+	{
+		set_status_message("No completion in paged mode");
+		return;
+	}
+	complete_on_indexed(completion_indexed);
+	int n = update_completion();
+	if (n == 0) set_status_message(comp.partial ? "No completions yet, still indexing" : "No completions");
+	else if (n == 1 && !comp.partial) accept_completion();
+	else show_completion();
+}
+
+// keys taken by the open list, the others close it or narrow it down
+static int completion_key(int c)
+{
+	switch (c)
+	{
+		case CTRL_KEY('n'):
+		case ARROW_DOWN:
+			comp.pick = (comp.pick + 1) % comp.n;
+			break;
+		case ARROW_UP:
+			comp.pick = (comp.pick + comp.n - 1) % comp.n;
+			break;
+		case '\t':
+		case '\r':
+			undo_begin_group(0);
+			accept_completion();
+			return 1;
+		case '\x1b':
+			close_completion();
+			return 1;
+		default:
+			return 0;
+	}
+	show_completion();
+	return 1;
+}
+
+// ^W starts recording the keys typed and stops it, ^E plays them back a
+// number of times. Played keys come out of read_key without waiting on the
+// terminal, so no frame is drawn until the last one, and the rows they
+// touch are highlighted in one pass at the end. A replay undoes at once.
+void editor_record_macro()
+{
+	if (!input_macro_recording())
+	{
+		input_macro_record(1);
+		set_status_message("Recording macro, ^W to stop");
+		return;
+	}
+	input_macro_unrecord();
+	input_macro_record(0);
+	set_status_message("Recorded %d keys, ^E to play them", input_macro_length());
+}
+
+void editor_play_macro()
+{
+	if (input_macro_recording())
+	{
+		input_macro_unrecord();
+		set_status_message("Can't play the macro while recording it");
+		return;
+	}
+	if (input_macro_playing()) return;
+	if (input_macro_length() == 0)
+	{
+		set_status_message("No macro, ^W records one");
+		return;
+	}
+	char* query = editor_prompt("Play macro how many times: %s (ESC to cancel)", NULL);
+	if (query == NULL) return;
+	long long times = atoll(query);
+	free(query);
+	if (times < 1) return;
+
+	long long start = event_now_ms();
+	editor_syntax_defer();
+	undo_begin_group(0);
+	undo_hold(1);
+	input_macro_play(times);
+	while (input_macro_playing()) process_key_press();
+	undo_hold(0);
+	editor_syntax_flush();
+	set_status_message("Played %d keys %lld times in %lld ms", input_macro_length(), times, event_now_ms() - start);
+}
+
+// ^K folds the block or comment at the cursor, or opens the fold there
+void editor_fold()
+{
+	int hidden = fold_toggle(E.cy);
+	if (hidden == -1)
+	{
+		set_status_message("No block to fold here");
+		return;
+	}
+	// folding the block around the cursor leaves it on the header
+	E.cy = fold_row(fold_line(E.cy));
+	if (hidden > 0) set_status_message("Folded %d lines", hidden);
+}
+
+// the bracket ^B jumped to, shown as a match until the next key
+static struct
+{
+	int row;
+	int at; // offset in render
+	unsigned char hl;
+} bracket_mark = { -1, 0, 0 };
+
+static void unmark_bracket()
+{
+	if (bracket_mark.row == -1) return;
+	erow* row = bracket_mark.row < E.numrows ? editor_row_peek(bracket_mark.row) : NULL;
+	if (row && !row->wide && bracket_mark.at < row->rsize) row->hl[bracket_mark.at] = bracket_mark.hl;
+	bracket_mark.row = -1;
+}
+
+// ^B jumps to the bracket matching the one at or just before the cursor
+void editor_match_bracket()
+{
+	if (E.paged)
+	{
+		set_status_message("No bracket index for paged files");
+		return;
+	}
+
+	int at, cx;
+	int found = bracket_match(E.cy, E.cx, &at, &cx);
+	if (found == -1)
+	{
+		set_status_message("No bracket at the cursor");
+		return;
+	}
+	if (found == 0)
+	{
+		set_status_message("No matching bracket");
+		return;
+	}
+	E.cy = at;
+	E.cx = cx;
+
+	// a long line's hl is laid out again with its window, so it goes unmarked
+	erow* row = editor_row_at(at);
+	if (row->wide) return;
+	int cut;
+	int rx = editor_row_cx_to_rx(row, cx);
+	bracket_mark.row = at;
+	bracket_mark.at = row->cols ? utf8_render_at(row, row->rsize, 0, rx, &cut) : rx;
+	bracket_mark.hl = row->hl[bracket_mark.at];
+	row->hl[bracket_mark.at] = HL_MATCH;
+}
+
+// keeps the cursor within its row after a vertical move
+static void snap_cursor()
+{
+	erow* row = (E.cy >= E.numrows) ? NULL : editor_row_at(E.cy);
+	int rowlen = row ? row->size : 0;
+	if (E.cx > rowlen) E.cx = rowlen;
+	// keep off the middle of a cluster when moving to a row that isn't ASCII
+	if (row && (row->cols || row->wide) && E.cx < rowlen)
+		E.cx = editor_row_rx_to_cx(row, editor_row_cx_to_rx(row, E.cx));
+}
+
 void move_cursor(int key)
 {
-	erow* row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+	erow* row = (E.cy >= E.numrows) ? NULL : editor_row_at(E.cy);
 
 	switch (key)
 	{
 		case ARROW_UP:
-			if (E.cy > 0) E.cy--;
+			if (E.cy > 0) E.cy = fold_row(fold_line(E.cy) - 1);
 			break;
 		case ARROW_LEFT:
 			if (E.cx != 0)
 			{
-				E.cx--;
+				E.cx = utf8_prev(row->chars, row->size, E.cx);
 			}
 			else if (E.cy > 0) // first column and not first line? go to previous line end
 			{
-				E.cy--;
-				E.cx = E.row[E.cy].size;
+				E.cy = fold_row(fold_line(E.cy) - 1);
+				E.cx = editor_row_at(E.cy)->size;
 			}
 			break;
 		case ARROW_DOWN:
-			if (E.cy < E.numrows) E.cy++;
+			if (E.cy < E.numrows) E.cy = fold_row(fold_line(E.cy) + 1);
 			break;
 		case ARROW_RIGHT:
 			if (row && E.cx < row->size)
 			{
-				E.cx++;
+				E.cx = utf8_next(row->chars, row->size, E.cx);
 			}
 			else if (row && E.cx == row->size) // end of line? go to next column start
 			{
 				E.cx = 0;
-				E.cy++;
+				E.cy = fold_row(fold_line(E.cy) + 1);
 			}
 			break;
 	}
 
-	row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
-	int rowlen = row ? row->size : 0;
-	if (E.cx > rowlen) E.cx = rowlen;
+	snap_cursor();
 }
 
 void process_key_press()
@@ -524,6 +801,15 @@ void process_key_press()
 
 	int c = read_key();
 	E.key_pressed = c;
+	unmark_bracket();
+	event_redraw();
+	int completing = comp.n > 0;
+	if (completing && completion_key(c))
+	{
+		latency_key_done();
+		return;
+	}
+	undo_begin_group(c != '\r' && !iscntrl(c) && c < 256);
 	
 	switch (c)
 	{
@@ -538,6 +824,8 @@ void process_key_press()
 				--quit_times;
 				return;
 			}
+			session_save();
+			journal_discard();
 			write(STDIN_FILENO, "\x1b[2J", 4);
 			write(STDIN_FILENO, "\x1b[H", 3);
 			exit(0);
@@ -547,21 +835,21 @@ void process_key_press()
 			editor_save();
 			break;
 
+		case CTRL_KEY('u'):
+			editor_toggle_trace();
+			break;
+
 		case PAGE_UP:
 		case PAGE_DOWN:
 			{
-				if (c == PAGE_UP)
-				{
-					E.cy = E.rowoff;
-				}
-				else if (c == PAGE_DOWN)
-				{
-					E.cy = E.rowoff + E.screen_rows - 1;
-					if (E.cy > E.screen_rows) E.cy = E.numrows;
-				}
-				int times = E.screen_rows;
-				while (times--)
-					c == PAGE_UP ? move_cursor(ARROW_UP) : move_cursor(ARROW_DOWN);
+				// a screen up from the top line or down from the bottom one,
+				// counted in lines so folds are skipped in one step
+				int line = fold_line(E.rowoff);
+				if (c == PAGE_UP) line -= E.screen_rows;
+				else line += 2 * E.screen_rows - 1;
+				int last = fold_line(E.numrows);
+				E.cy = fold_row(line < 0 ? 0 : line > last ? last : line);
+				snap_cursor();
 			}
 			break;
 
@@ -569,14 +857,79 @@ void process_key_press()
 			E.cx = 0;
 			break;
 		case END_KEY:
-			if (E.cx < E.numrows)
-				E.cx = E.row[E.cy].size;
+			if (E.cy < E.numrows)
+				E.cx = editor_row_at(E.cy)->size;
 			break;
 
 		case CTRL_KEY('f'):
 			editor_find();
 			break;
 
+		case CTRL_KEY('d'):
+			editor_find_symbol();
+			break;
+
+		case CTRL_KEY('g'):
+			editor_goto_line();
+			break;
+
+		case CTRL_KEY('r'):
+			editor_replace();
+			break;
+
+		case CTRL_KEY('o'):
+			editor_filter_rows();
+			break;
+
+		case CTRL_KEY('a'):
+			editor_toggle_mark();
+			break;
+
+		case CTRL_KEY('c'):
+		case CTRL_KEY('x'):
+			editor_copy(c == CTRL_KEY('x'));
+			break;
+
+		case CTRL_KEY('v'):
+			editor_paste();
+			break;
+
+		case CTRL_KEY('t'):
+			follow_toggle();
+			break;
+
+		case CTRL_KEY('b'):
+			editor_match_bracket();
+			break;
+
+		case CTRL_KEY('k'):
+			editor_fold();
+			break;
+
+		case CTRL_KEY('n'):
+			editor_complete();
+			break;
+
+		case CTRL_KEY('w'):
+			editor_record_macro();
+			break;
+
+		case CTRL_KEY('e'):
+			editor_play_macro();
+			break;
+
+		case CTRL_KEY('p'):
+			editor_cycle_hud();
+			break;
+
+		case CTRL_KEY('z'):
+			editor_undo();
+			break;
+
+		case CTRL_KEY('y'):
+			editor_redo();
+			break;
+
 		case BACKSPACE:
 		case CTRL_KEY('h'):
 		case DEL_KEY:
@@ -591,8 +944,19 @@ void process_key_press()
 			move_cursor(c);
 			break;
 
-		case CTRL_KEY('l'):
+		case PASTE_KEY:
+			{
+				size_t len;
+				char* text = input_paste(&len);
+				insert_text(text, len);
+			}
+			break;
+
 		case '\x1b':
+			E.sel_active = 0;
+			break;
+
+		case CTRL_KEY('l'):
 			break;
 
 		default:
@@ -600,24 +964,36 @@ void process_key_press()
 			break;
 	}
 
+	if (completing)
+	{
+		int narrow = (c < 256 && complete_is_word_char(c)) || c == BACKSPACE || c == CTRL_KEY('h');
+		if (narrow && update_completion()) show_completion();
+		else close_completion();
+	}
+
 	quit_times = QUIT_TIMES;
+	latency_key_done();
 }
 
 int main(int argc, char** argv)
 {
 	init();
-	if (argc >= 2)
+
+	int follow = (argc >= 3 && !strcmp(argv[1], "-f"));
+	if (argc >= 2 + follow)
 	{
-		editor_open(argv[1]);
+		editor_open(argv[1 + follow]);
+		if (follow) follow_start();
 	}
+	latency_init();
 
-	set_status_message("HELP: Ctrl-S = Save | Ctrl-Q = quit | Ctrl-F = Search");
+	set_status_message("HELP: ^S save | ^Q quit | ^F find | ^G goto | ^Z undo | ^Y redo");
+	editor_recover();
 
+	// frames are drawn by the event loop while read_key waits for input
+	event_redraw();
 	while (1)
-	{
-		refresh_screen();
 		process_key_press();
-	}
 
 	return 0;
 }
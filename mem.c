@@ -0,0 +1,178 @@
+#include "event.h"
+#include "mem.h"
+#include "rowmem.h"
+
+static const char* names[MEM_TAGS] = { "rows", "render", "hl", "search", "output", "undo", "cold", "pager", "symbols", "words" };
+
+static struct
+{
+	// added to from any thread, so updated atomically
+	long long used[MEM_TAGS];
+	long long peak[MEM_TAGS];
+
+	long long budget[MEM_TAGS]; // 0 for no budget
+	long long total_budget;
+	long long evicted; // rows whose render and hl were dropped
+	int hand; // where the next eviction pass starts
+	int armed;
+	int hud;
+	char hud_text[128];
+} M;
+
+void mem_add(int tag, long long bytes)
+{
+	long long now = __atomic_add_fetch(&M.used[tag], bytes, __ATOMIC_RELAXED);
+	if (now > __atomic_load_n(&M.peak[tag], __ATOMIC_RELAXED))
+		__atomic_store_n(&M.peak[tag], now, __ATOMIC_RELAXED);
+}
+
+long long mem_used(int tag)
+{
+	return __atomic_load_n(&M.used[tag], __ATOMIC_RELAXED);
+}
+
+long long mem_total()
+{
+	long long total = 0;
+	for (int t = 0; t < MEM_TAGS; ++t) total += mem_used(t);
+	return total;
+}
+
+static char* human(long long bytes, char* buf)
+{
+	if (bytes < 1024 * 1024) sprintf(buf, "%lldK", bytes / 1024);
+	else if (bytes < 1024LL * 1024 * 1024) sprintf(buf, "%.1fM", bytes / (1024.0 * 1024));
+	else sprintf(buf, "%.1fG", bytes / (1024.0 * 1024 * 1024));
+	return buf;
+}
+
+static int over(int tag, int slack)
+{
+	long long limit = M.budget[tag] * slack / 4;
+	return M.budget[tag] && mem_used(tag) > limit;
+}
+
+static int over_total(int slack)
+{
+	return M.total_budget && mem_total() > M.total_budget * slack / 4;
+}
+
+// a pass starts once a budget is exceeded and goes on until every budget
+// has a quarter of room again, so eviction doesn't run on every sweep
+static int needs_room(int slack)
+{
+	if (mem_used(MEM_RENDER) + mem_used(MEM_HL) == 0) return 0;
+	return over(MEM_RENDER, slack) || over(MEM_HL, slack) || over_total(slack);
+}
+
+static void evict()
+{
+	if (E.paged || E.numrows == 0 || !needs_room(4)) return;
+
+	// keep a screen of rows around the viewport laid out
+	int lo = E.rowoff - E.screen_rows;
+	int hi = E.rowoff + 2 * E.screen_rows;
+
+	int at = M.hand < E.numrows ? M.hand : 0;
+	for (int scanned = 0; scanned < E.numrows && scanned < MEM_SWEEP_ROWS && needs_room(3); ++scanned)
+	{
+		erow* row = &E.row[at];
+		if ((at < lo || at > hi) && row->render && !row->wide)
+		{
+			rowmem_strip(row);
+			++M.evicted;
+		}
+		if (++at == E.numrows) at = 0;
+	}
+	M.hand = at;
+}
+
+// "mem 52.1M: rows 20.0M render! 12.0M ...", tags holding nothing are left
+// out and a ! marks a budget that is exceeded
+static void update_hud()
+{
+	char n[16];
+	int len = snprintf(M.hud_text, sizeof(M.hud_text), "mem%s %s:", over_total(4) ? "!" : "", human(mem_total(), n));
+	for (int t = 0; t < MEM_TAGS && len < (int) sizeof(M.hud_text); ++t)
+	{
+		// the frame buffer only lives while a frame is built, show its peak
+		long long bytes = t == MEM_OUTPUT ? M.peak[t] : mem_used(t);
+		if (bytes == 0) continue;
+		len += snprintf(&M.hud_text[len], sizeof(M.hud_text) - len, " %s%s %s", names[t], over(t, 4) ? "!" : "", human(bytes, n));
+	}
+	E.hud = M.hud_text;
+}
+
+static void sweep()
+{
+	M.armed = 0;
+	evict();
+	if (M.hud)
+	{
+		update_hud();
+		event_redraw();
+	}
+	if (M.hud || M.total_budget || M.budget[MEM_RENDER] || M.budget[MEM_HL])
+	{
+		M.armed = 1;
+		event_timer(MEM_SWEEP_MS, sweep);
+	}
+}
+
+void mem_show_hud(int on)
+{
+	M.hud = on;
+	if (!on)
+	{
+		E.hud = NULL;
+		return;
+	}
+	update_hud();
+	event_redraw();
+	if (!M.armed)
+	{
+		M.armed = 1;
+		event_timer(MEM_SWEEP_MS, sweep);
+	}
+}
+
+void mem_dump(FILE* fp)
+{
+	char a[16], b[16], c[16];
+	fprintf(fp, "%-8s %10s %10s %10s\n", "tag", "used", "peak", "budget");
+	for (int t = 0; t < MEM_TAGS; ++t)
+		fprintf(fp, "%-8s %10s %10s %10s\n", names[t], human(mem_used(t), a), human(M.peak[t], b),
+			M.budget[t] ? human(M.budget[t], c) : "-");
+	fprintf(fp, "%-8s %10s %10s %10s\n", "total", human(mem_total(), a), "-",
+		M.total_budget ? human(M.total_budget, b) : "-");
+	fprintf(fp, "rows evicted %lld\n", M.evicted);
+}
+
+static void dump_at_exit()
+{
+	FILE* fp = fopen(getenv("YOLO_MEM_STATS"), "w");
+	if (!fp) return;
+	mem_dump(fp);
+	fclose(fp);
+}
+
+static long long budget_mb(const char* name)
+{
+	char* v = getenv(name);
+	return v && atoi(v) > 0 ? atoi(v) * 1024LL * 1024 : 0;
+}
+
+void mem_init()
+{
+	M.budget[MEM_RENDER] = budget_mb("YOLO_MEM_RENDER_MB");
+	M.budget[MEM_HL] = budget_mb("YOLO_MEM_HL_MB");
+	M.total_budget = budget_mb("YOLO_MEM_MB");
+	M.hand = 0;
+	M.armed = 0;
+	if (getenv("YOLO_MEM_STATS")) atexit(dump_at_exit);
+	if (M.total_budget || M.budget[MEM_RENDER] || M.budget[MEM_HL])
+	{
+		M.armed = 1;
+		event_timer(MEM_SWEEP_MS, sweep);
+	}
+}
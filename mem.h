@@ -0,0 +1,38 @@
+#ifndef MEM_H_
+#define MEM_H_
+
+#include <stdio.h>
+
+// Memory accounting. Subsystems report the bytes they hold under a tag,
+// ^P shows the breakdown in the status bar and YOLO_MEM_STATS=path writes
+// it there at exit. Budgets in MB come from YOLO_MEM_RENDER_MB,
+// YOLO_MEM_HL_MB and YOLO_MEM_MB (all tags together); going over one drops
+// the render and hl of rows away from the viewport, editor_row_at lays
+// them out again when such a row is used.
+
+#define MEM_SWEEP_MS 1000
+#define MEM_SWEEP_ROWS (1 << 20) // rows looked at per sweep
+
+enum mem_tag
+{
+	MEM_ROWS,   // row text, the row array, long-line chunk indexes, the bracket index and the change gutter
+	MEM_RENDER,
+	MEM_HL,
+	MEM_SEARCH,
+	MEM_OUTPUT, // the frame being built
+	MEM_UNDO,
+	MEM_COLD,   // compressed rows and their caches
+	MEM_PAGER,  // page cache and line index
+	MEM_SYMBOLS, // the symbol index
+	MEM_WORDS,  // the completion index
+	MEM_TAGS
+};
+
+void mem_init();
+void mem_add(int tag, long long bytes);
+long long mem_used(int tag);
+long long mem_total();
+void mem_show_hud(int on);
+void mem_dump(FILE* fp);
+
+#endif
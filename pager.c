@@ -0,0 +1,1163 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "event.h"
+#include "longline.h"
+#include "mem.h"
+#include "pager.h"
+#include "rowmem.h"
+#include "trace.h"
+#include "utf8.h"
+
+#define CHUNK_ENTRIES (1 << 16)
+#define MAX_CHUNKS (1 << 16)
+#define ROW_CACHE_SIZE 256
+#define SCAN_BLOCK (1 << 20)
+
+struct page
+{
+	long long no;
+	char* data;
+	int len;
+	struct page* prev;
+	struct page* next;
+	struct page* hnext;
+};
+
+// a run of untouched file lines, or a single overlay row when row != NULL
+struct segment
+{
+	long long first;
+	long long count;
+	erow* row;
+	long long start; // buffer row of the segment, valid below P.starts_valid
+};
+
+struct cached_row
+{
+	long long line;
+	erow row;
+};
+
+static struct
+{
+	int fd;
+	char* path;
+	long long file_size;
+
+	// sparse line index, written by the indexer thread and published
+	// through the atomic counters below
+	long long* chunks[MAX_CHUNKS];
+	long long checkpoints;
+	long long lines;
+	long long newlines;
+	int partial;
+	int done;
+	int stop;
+	int percent;
+	int indexing; // the indexer thread was started
+	long long shown_lines;
+	int shown_done;
+	pthread_t indexer;
+
+	struct page** buckets;
+	int nbuckets;
+	struct page* lru_head;
+	struct page* lru_tail;
+	int npages;
+	int max_pages;
+
+	// last resolved line, sequential lookups continue from here
+	long long cur_line;
+	long long cur_off;
+
+	struct cached_row rows[ROW_CACHE_SIZE];
+
+	struct segment* segs;
+	int nsegs;
+	int segs_cap;
+	int starts_valid;
+} P;
+
+static long long env_mb(const char* name, long long fallback)
+{
+	char* v = getenv(name);
+	if (v && atoll(v) > 0) return atoll(v);
+	return fallback;
+}
+
+int pager_should_open(const char* filename)
+{
+	struct stat st;
+	if (stat(filename, &st) == -1) return 0;
+	return st.st_size >= env_mb("YOLO_PAGED_THRESHOLD_MB", PAGER_DEFAULT_THRESHOLD_MB) * 1024 * 1024;
+}
+
+// line index
+
+static void add_checkpoint(long long n, long long off)
+{
+	long long c = n / CHUNK_ENTRIES;
+	if (c >= MAX_CHUNKS) return;
+	if (!P.chunks[c])
+	{
+		P.chunks[c] = malloc(sizeof(long long) * CHUNK_ENTRIES);
+		mem_add(MEM_PAGER, sizeof(long long) * CHUNK_ENTRIES);
+	}
+	P.chunks[c][n % CHUNK_ENTRIES] = off;
+	__atomic_store_n(&P.checkpoints, n + 1, __ATOMIC_RELEASE);
+}
+
+static long long checkpoint(long long n)
+{
+	return P.chunks[n / CHUNK_ENTRIES][n % CHUNK_ENTRIES];
+}
+
+static void* indexer_main(void* arg)
+{
+	(void) arg;
+	trace_name_thread("indexer");
+	int fd = open(P.path, O_RDONLY);
+	if (fd == -1) return NULL;
+	long long span = trace_begin();
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	char* buf = malloc(SCAN_BLOCK);
+	long long off = 0;
+	long long line = 0;
+	char last = '\n';
+	ssize_t n;
+	long long last_wake = event_now_ms();
+
+	// only the size seen at open time is indexed, growth is picked up by pager_extend
+	add_checkpoint(0, 0);
+	while (off < P.file_size && !__atomic_load_n(&P.stop, __ATOMIC_RELAXED))
+	{
+		long long want = P.file_size - off < SCAN_BLOCK ? P.file_size - off : SCAN_BLOCK;
+		if ((n = read(fd, buf, want)) <= 0) break;
+
+		char* p = buf;
+		char* end = buf + n;
+		while ((p = memchr(p, '\n', end - p)) != NULL)
+		{
+			++p;
+			++line;
+			if (line % PAGER_CHECKPOINT_LINES == 0)
+				add_checkpoint(line / PAGER_CHECKPOINT_LINES, off + (p - buf));
+		}
+		off += n;
+		last = buf[n - 1];
+		__atomic_store_n(&P.lines, line, __ATOMIC_RELEASE);
+		__atomic_store_n(&P.percent, (int) (off * 100 / P.file_size), __ATOMIC_RELAXED);
+
+		// let the status bar follow the progress without waking the main loop per block
+		if (event_now_ms() - last_wake >= 100)
+		{
+			last_wake = event_now_ms();
+			event_wakeup();
+		}
+	}
+
+	free(buf);
+	close(fd);
+	trace_end("pager_index", span);
+	P.newlines = line;
+	P.partial = (off > 0 && last != '\n');
+	__atomic_store_n(&P.lines, line + P.partial, __ATOMIC_RELEASE);
+	__atomic_store_n(&P.done, 1, __ATOMIC_RELEASE);
+	event_wakeup();
+	return NULL;
+}
+
+static long long indexed_lines()
+{
+	long long n = __atomic_load_n(&P.lines, __ATOMIC_ACQUIRE);
+	return n > INT_MAX ? INT_MAX : n;
+}
+
+static int indexing_done()
+{
+	return __atomic_load_n(&P.done, __ATOMIC_ACQUIRE);
+}
+
+// rows are ints, the lines past INT_MAX never become rows and an edited
+// buffer would be saved without them
+static int too_many_lines()
+{
+	return __atomic_load_n(&P.lines, __ATOMIC_ACQUIRE) > INT_MAX;
+}
+
+// page cache
+
+static void lru_unlink(struct page* pg)
+{
+	if (pg->prev) pg->prev->next = pg->next;
+	else P.lru_head = pg->next;
+	if (pg->next) pg->next->prev = pg->prev;
+	else P.lru_tail = pg->prev;
+	pg->prev = pg->next = NULL;
+}
+
+static void lru_push(struct page* pg)
+{
+	pg->prev = NULL;
+	pg->next = P.lru_head;
+	if (P.lru_head) P.lru_head->prev = pg;
+	P.lru_head = pg;
+	if (!P.lru_tail) P.lru_tail = pg;
+}
+
+static void hash_remove(struct page* pg)
+{
+	struct page** pp = &P.buckets[pg->no & (P.nbuckets - 1)];
+	while (*pp != pg) pp = &(*pp)->hnext;
+	*pp = pg->hnext;
+}
+
+static struct page* page_get(long long no)
+{
+	int b = no & (P.nbuckets - 1);
+	struct page* pg;
+	for (pg = P.buckets[b]; pg; pg = pg->hnext)
+	{
+		if (pg->no == no)
+		{
+			lru_unlink(pg);
+			lru_push(pg);
+			return pg;
+		}
+	}
+
+	if (P.npages >= P.max_pages)
+	{
+		pg = P.lru_tail;
+		lru_unlink(pg);
+		hash_remove(pg);
+	}
+	else
+	{
+		pg = malloc(sizeof(struct page));
+		pg->data = malloc(PAGER_PAGE_SIZE);
+		mem_add(MEM_PAGER, sizeof(struct page) + PAGER_PAGE_SIZE);
+		++P.npages;
+	}
+
+	ssize_t n = pread(P.fd, pg->data, PAGER_PAGE_SIZE, no * PAGER_PAGE_SIZE);
+	pg->no = no;
+	pg->len = n < 0 ? 0 : n;
+	pg->hnext = P.buckets[b];
+	P.buckets[b] = pg;
+	lru_push(pg);
+	return pg;
+}
+
+static void page_drop(long long no)
+{
+	struct page* pg;
+	for (pg = P.buckets[no & (P.nbuckets - 1)]; pg; pg = pg->hnext)
+	{
+		if (pg->no != no) continue;
+		lru_unlink(pg);
+		hash_remove(pg);
+		free(pg->data);
+		free(pg);
+		mem_add(MEM_PAGER, -(long long) (sizeof(struct page) + PAGER_PAGE_SIZE));
+		--P.npages;
+		return;
+	}
+}
+
+// line access
+
+static long long line_offset(long long line)
+{
+	long long cp = line / PAGER_CHECKPOINT_LINES;
+	long long at = cp * PAGER_CHECKPOINT_LINES;
+	long long off = checkpoint(cp);
+
+	if (P.cur_line >= at && P.cur_line <= line)
+	{
+		at = P.cur_line;
+		off = P.cur_off;
+	}
+
+	while (at < line && off < P.file_size)
+	{
+		struct page* pg = page_get(off / PAGER_PAGE_SIZE);
+		int in = off % PAGER_PAGE_SIZE;
+		if (in >= pg->len) break;
+
+		char* nl = memchr(&pg->data[in], '\n', pg->len - in);
+		if (nl)
+		{
+			off = pg->no * PAGER_PAGE_SIZE + (nl - pg->data) + 1;
+			++at;
+		}
+		else
+		{
+			off = (pg->no + 1) * PAGER_PAGE_SIZE;
+		}
+	}
+
+	P.cur_line = at;
+	P.cur_off = off;
+	return off;
+}
+
+// the returned text is only valid until the next call
+static char* read_line(long long line, size_t* len)
+{
+	static char* s = NULL;
+	static size_t cap = 0;
+	long long off = line_offset(line);
+	if (!s)
+	{
+		cap = 128;
+		s = malloc(cap);
+	}
+	*len = 0;
+
+	while (off < P.file_size)
+	{
+		struct page* pg = page_get(off / PAGER_PAGE_SIZE);
+		int in = off % PAGER_PAGE_SIZE;
+		if (in >= pg->len) break;
+
+		char* nl = memchr(&pg->data[in], '\n', pg->len - in);
+		size_t n = nl ? (size_t) (nl - &pg->data[in]) : (size_t) (pg->len - in);
+		if (*len + n + 1 > cap)
+		{
+			while (*len + n + 1 > cap) cap *= 2;
+			s = realloc(s, cap);
+		}
+		memcpy(&s[*len], &pg->data[in], n);
+		*len += n;
+		off += n;
+		if (nl) break;
+	}
+
+	while (*len > 0 && s[*len - 1] == '\r') --*len;
+	return s;
+}
+
+static void materialize(erow* row, long long line, int at)
+{
+	size_t len;
+	char* s = read_line(line, &len);
+
+	row->idx = at;
+	row->chars = NULL;
+	row->cap = 0;
+	row->pin = 0;
+	rowmem_set_text(row, s, len);
+	row->hl_open_comment = 0;
+	row->cold = NULL;
+	row->wide = NULL;
+	row->cols = NULL;
+	editor_update_row(row);
+}
+
+// overlay segments
+
+static void seg_reserve()
+{
+	if (P.nsegs < P.segs_cap) return;
+	P.segs_cap = P.segs_cap ? P.segs_cap * 2 : 64;
+	P.segs = realloc(P.segs, sizeof(struct segment) * P.segs_cap);
+}
+
+static void seg_insert(int i, long long first, long long count, erow* row)
+{
+	seg_reserve();
+	memmove(&P.segs[i + 1], &P.segs[i], sizeof(struct segment) * (P.nsegs - i));
+	P.segs[i].first = first;
+	P.segs[i].count = count;
+	P.segs[i].row = row;
+	++P.nsegs;
+	if (P.starts_valid > i) P.starts_valid = i;
+}
+
+static void seg_remove(int i)
+{
+	memmove(&P.segs[i], &P.segs[i + 1], sizeof(struct segment) * (P.nsegs - i - 1));
+	--P.nsegs;
+	if (P.starts_valid > i) P.starts_valid = i;
+}
+
+// finds the segment holding buffer line `at`, *k is the offset inside it.
+// Starts are recomputed from the first segment that moved, and then the
+// lookup is a binary search, so walking rows of a large overlay stays cheap.
+static int seg_find(int at, long long* k)
+{
+	for (int i = P.starts_valid; i < P.nsegs; ++i)
+		P.segs[i].start = i > 0 ? P.segs[i - 1].start + P.segs[i - 1].count : 0;
+	P.starts_valid = P.nsegs;
+
+	int lo = 0, hi = P.nsegs;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (at < P.segs[mid].start + P.segs[mid].count) hi = mid;
+		else lo = mid + 1;
+	}
+	*k = lo < P.nsegs ? at - P.segs[lo].start : 0;
+	return lo;
+}
+
+// carves line k out of file segment i, leaving an empty slot at the returned index
+static int seg_split(int i, long long k)
+{
+	struct segment s = P.segs[i];
+	seg_remove(i);
+	if (s.count - k - 1 > 0) seg_insert(i, s.first + k + 1, s.count - k - 1, NULL);
+	if (k > 0)
+	{
+		seg_insert(i, s.first, k, NULL);
+		++i;
+	}
+	return i;
+}
+
+static void renumber_overlay(int from)
+{
+	long long start = 0;
+	for (int i = 0; i < P.nsegs; ++i)
+	{
+		if (P.segs[i].row && start >= from)
+			P.segs[i].row->idx = start;
+		start += P.segs[i].count;
+	}
+}
+
+static int begin_edit()
+{
+	if (!indexing_done())
+	{
+		set_status_message("Still indexing, the buffer is read-only until it is done");
+		return 0;
+	}
+	if (too_many_lines())
+	{
+		set_status_message("More than %d lines, the buffer is read-only", INT_MAX);
+		return 0;
+	}
+	if (!P.segs)
+	{
+		E.numrows = indexed_lines();
+		if (E.numrows > 0) seg_insert(0, 0, E.numrows, NULL);
+	}
+	return 1;
+}
+
+static void pager_wake()
+{
+	if (pager_poll()) event_redraw();
+}
+
+// public api
+
+static void open_file(const char* filename)
+{
+	struct stat st;
+
+	P.fd = open(filename, O_RDONLY);
+	if (P.fd == -1 || fstat(P.fd, &st) == -1) die("open");
+	P.path = strdup(filename);
+	P.file_size = st.st_size;
+
+	long long cap = env_mb("YOLO_PAGE_CACHE_MB", PAGER_DEFAULT_CACHE_MB) * 1024 * 1024;
+	P.max_pages = cap / PAGER_PAGE_SIZE;
+	if (P.max_pages < 4) P.max_pages = 4;
+	P.nbuckets = 1;
+	while (P.nbuckets < P.max_pages * 2) P.nbuckets <<= 1;
+	P.buckets = calloc(P.nbuckets, sizeof(struct page*));
+	mem_add(MEM_PAGER, sizeof(struct page*) * P.nbuckets);
+
+	for (int i = 0; i < ROW_CACHE_SIZE; ++i) P.rows[i].line = -1;
+	P.cur_line = -1;
+
+	E.paged = 1;
+	E.numrows = 0;
+	E.file_size = P.file_size;
+}
+
+void pager_open(const char* filename)
+{
+	open_file(filename);
+	event_on_wake(pager_wake);
+	if (pthread_create(&P.indexer, NULL, indexer_main, NULL) != 0) die("pthread_create");
+	P.indexing = 1;
+}
+
+// opens the file with the line index it had before, see session.h. The
+// checkpoints are one every PAGER_CHECKPOINT_LINES lines, the first at 0.
+void pager_open_indexed(const char* filename, const long long* checkpoints, long long n, long long newlines, int partial)
+{
+	open_file(filename);
+	for (long long i = 0; i < n; ++i) add_checkpoint(i, checkpoints[i]);
+	P.newlines = newlines;
+	P.partial = partial;
+	P.lines = newlines + partial;
+	P.done = 1;
+	P.percent = 100;
+	pager_poll();
+}
+
+// the line index of a file that wasn't edited, 0 checkpoints otherwise.
+// The checkpoints are read with pager_checkpoint.
+long long pager_index(long long* newlines, int* partial)
+{
+	if (!E.paged || !indexing_done() || P.segs) return 0;
+	*newlines = P.newlines;
+	*partial = P.partial;
+	return P.checkpoints;
+}
+
+long long pager_checkpoint(long long n)
+{
+	return checkpoint(n);
+}
+
+void pager_close()
+{
+	int i;
+
+	__atomic_store_n(&P.stop, 1, __ATOMIC_RELAXED);
+	if (P.indexing) pthread_join(P.indexer, NULL);
+	close(P.fd);
+	free(P.path);
+
+	for (i = 0; i < MAX_CHUNKS && P.chunks[i]; ++i)
+	{
+		free(P.chunks[i]);
+		mem_add(MEM_PAGER, -(long long) sizeof(long long) * CHUNK_ENTRIES);
+	}
+
+	struct page* pg = P.lru_head;
+	while (pg)
+	{
+		struct page* next = pg->next;
+		free(pg->data);
+		free(pg);
+		mem_add(MEM_PAGER, -(long long) (sizeof(struct page) + PAGER_PAGE_SIZE));
+		pg = next;
+	}
+	free(P.buckets);
+	mem_add(MEM_PAGER, -(long long) sizeof(struct page*) * P.nbuckets);
+
+	// cached and overlay rows are the only rows alive, their buffers go at once
+	for (i = 0; i < ROW_CACHE_SIZE; ++i)
+	{
+		if (P.rows[i].line < 0) continue;
+		longline_free(&P.rows[i].row);
+		utf8_free(&P.rows[i].row);
+	}
+	for (i = 0; i < P.nsegs; ++i)
+	{
+		if (P.segs[i].row)
+		{
+			longline_free(P.segs[i].row);
+			utf8_free(P.segs[i].row);
+		}
+		free(P.segs[i].row);
+	}
+	free(P.segs);
+	rowmem_release();
+
+	memset(&P, 0, sizeof(P));
+	E.paged = 0;
+	E.numrows = 0;
+}
+
+// indexes bytes appended to the file since it was opened, returns 1 when
+// the visible text changed
+int pager_extend(long long size)
+{
+	if (!indexing_done() || size <= P.file_size) return 0;
+
+	long long old_lines = P.lines;
+	long long off = P.file_size;
+	char* buf = malloc(SCAN_BLOCK);
+	char last = '\n';
+
+	while (off < size)
+	{
+		long long want = size - off < SCAN_BLOCK ? size - off : SCAN_BLOCK;
+		ssize_t n = pread(P.fd, buf, want, off);
+		if (n <= 0) break;
+
+		char* p = buf;
+		char* end = buf + n;
+		while ((p = memchr(p, '\n', end - p)) != NULL)
+		{
+			++p;
+			++P.newlines;
+			if (P.newlines % PAGER_CHECKPOINT_LINES == 0)
+				add_checkpoint(P.newlines / PAGER_CHECKPOINT_LINES, off + (p - buf));
+		}
+		off += n;
+		last = buf[n - 1];
+	}
+	free(buf);
+
+	// the page and row that held the old end of file are stale now
+	page_drop(P.file_size / PAGER_PAGE_SIZE);
+	if (old_lines > 0)
+	{
+		struct cached_row* c = &P.rows[(old_lines - 1) % ROW_CACHE_SIZE];
+		if (c->line == old_lines - 1)
+		{
+			editor_free_row(&c->row);
+			c->line = -1;
+		}
+	}
+	P.cur_line = -1;
+
+	P.file_size = off;
+	P.partial = last != '\n';
+	P.lines = P.newlines + P.partial;
+	E.file_size = off;
+
+	long long added = indexed_lines() - old_lines;
+	if (added <= 0) return 1; // only the unterminated last line grew
+	if (!P.segs)
+	{
+		E.numrows = indexed_lines();
+		return 1;
+	}
+
+	// a continued last line that was already edited stays as it is
+	struct segment* last_seg = P.nsegs ? &P.segs[P.nsegs - 1] : NULL;
+	if (last_seg && !last_seg->row && last_seg->first + last_seg->count == old_lines)
+		last_seg->count += added;
+	else
+		seg_insert(P.nsegs, old_lines, added, NULL);
+	E.numrows += added;
+	return 1;
+}
+
+// syncs E.numrows with the indexer, returns 1 when the screen needs a redraw
+int pager_poll()
+{
+	if (!E.paged || P.shown_done) return 0;
+
+	int done = indexing_done();
+	long long lines = indexed_lines();
+	if (!P.segs) E.numrows = lines;
+	if (lines == P.shown_lines && done == P.shown_done) return 0;
+
+	P.shown_lines = lines;
+	P.shown_done = done;
+	return 1;
+}
+
+// indexing progress in percent, -1 once the whole file is indexed
+int pager_progress()
+{
+	return indexing_done() ? -1 : __atomic_load_n(&P.percent, __ATOMIC_RELAXED);
+}
+
+erow* pager_row_peek(int at)
+{
+	long long line = at;
+	if (P.segs)
+	{
+		long long k;
+		int i = seg_find(at, &k);
+		if (i == P.nsegs) return NULL;
+		if (P.segs[i].row) return P.segs[i].row;
+		line = P.segs[i].first + k;
+	}
+
+	struct cached_row* c = &P.rows[line % ROW_CACHE_SIZE];
+	if (c->line != line) return NULL;
+	c->row.idx = at;
+	return &c->row;
+}
+
+erow* pager_row(int at)
+{
+	if (at < 0 || at >= E.numrows) return NULL;
+
+	long long line = at;
+	if (P.segs)
+	{
+		long long k;
+		int i = seg_find(at, &k);
+		if (i == P.nsegs) return NULL;
+		if (P.segs[i].row) return P.segs[i].row;
+		line = P.segs[i].first + k;
+	}
+
+	struct cached_row* c = &P.rows[line % ROW_CACHE_SIZE];
+	if (c->line != line)
+	{
+		if (c->line >= 0) editor_free_row(&c->row);
+		c->line = -1;
+		materialize(&c->row, line, at);
+		c->line = line;
+	}
+	c->row.idx = at;
+	return &c->row;
+}
+
+erow* pager_row_mut(int at)
+{
+	if (!begin_edit()) return NULL;
+
+	long long k;
+	int i = seg_find(at, &k);
+	if (i == P.nsegs) return NULL;
+	if (P.segs[i].row) return P.segs[i].row;
+
+	erow* row = malloc(sizeof(erow));
+	materialize(row, P.segs[i].first + k, at);
+	i = seg_split(i, k);
+	seg_insert(i, -1, 1, row);
+	return row;
+}
+
+int pager_insert_row(int at, char* s, size_t len)
+{
+	if (!begin_edit()) return 0;
+
+	long long k;
+	int i = seg_find(at, &k);
+	if (i < P.nsegs && k > 0)
+	{
+		struct segment seg = P.segs[i];
+		seg_remove(i);
+		seg_insert(i, seg.first + k, seg.count - k, NULL);
+		seg_insert(i, seg.first, k, NULL);
+		++i;
+	}
+
+	erow* row = malloc(sizeof(erow));
+	row->idx = at;
+	row->chars = NULL;
+	row->cap = 0;
+	row->pin = 0;
+	rowmem_set_text(row, s, len);
+	row->hl_open_comment = 0;
+	row->cold = NULL;
+	row->wide = NULL;
+	row->cols = NULL;
+	seg_insert(i, -1, 1, row);
+
+	++E.numrows;
+	renumber_overlay(at);
+	editor_update_row(row);
+	return 1;
+}
+
+int pager_del_row(int at)
+{
+	if (!begin_edit()) return 0;
+
+	long long k;
+	int i = seg_find(at, &k);
+	if (i == P.nsegs) return 0;
+
+	if (P.segs[i].row)
+	{
+		editor_free_row(P.segs[i].row);
+		free(P.segs[i].row);
+		seg_remove(i);
+	}
+	else
+	{
+		seg_split(i, k);
+	}
+
+	--E.numrows;
+	renumber_overlay(at);
+	return 1;
+}
+
+// search
+
+static long long line_of_offset(long long off)
+{
+	long long lo = 0;
+	long long hi = __atomic_load_n(&P.checkpoints, __ATOMIC_ACQUIRE) - 1;
+	while (lo < hi)
+	{
+		long long mid = (lo + hi + 1) / 2;
+		if (checkpoint(mid) <= off) lo = mid;
+		else hi = mid - 1;
+	}
+
+	long long line = lo * PAGER_CHECKPOINT_LINES;
+	long long pos = checkpoint(lo);
+	while (pos < off)
+	{
+		struct page* pg = page_get(pos / PAGER_PAGE_SIZE);
+		int in = pos % PAGER_PAGE_SIZE;
+		long long page_end = pg->no * PAGER_PAGE_SIZE + pg->len;
+		int n = (off < page_end ? off : page_end) - pos;
+		if (n <= 0) break;
+
+		char* p = &pg->data[in];
+		char* end = p + n;
+		while ((p = memchr(p, '\n', end - p)) != NULL)
+		{
+			++p;
+			++line;
+		}
+		pos += n;
+	}
+	return line;
+}
+
+// returns the offset of the first (direction 1) or last (direction -1)
+// match inside [from, to), or -1
+static long long scan_range(const char* query, long long from, long long to, int direction)
+{
+	size_t qlen = strlen(query);
+	char* buf = malloc(SCAN_BLOCK + qlen);
+	long long found = -1;
+	long long end = to; // matches end by here, backward scans move `to` down
+	mem_add(MEM_SEARCH, SCAN_BLOCK + qlen);
+
+	while (from < to && found == -1)
+	{
+		// matches starting in [lo, hi); each read runs qlen - 1 bytes past hi
+		// so a match across a block boundary is seen from either side
+		long long lo = direction > 0 ? from : (to - SCAN_BLOCK > from ? to - SCAN_BLOCK : from);
+		long long hi = direction > 0 ? (from + SCAN_BLOCK < to ? from + SCAN_BLOCK : to) : to;
+		long long want = hi - lo + (long long) qlen - 1;
+		if (lo + want > end) want = end - lo;
+
+		ssize_t n = pread(P.fd, buf, want, lo);
+		if (n <= 0) break;
+
+		char* p = buf;
+		char* m;
+		while ((m = memmem(p, buf + n - p, query, qlen)) != NULL && lo + (m - buf) < hi)
+		{
+			found = lo + (m - buf);
+			if (direction > 0) break;
+			p = m + 1;
+		}
+
+		if (direction > 0) from = hi;
+		else to = lo;
+	}
+
+	free(buf);
+	mem_add(MEM_SEARCH, -(long long) (SCAN_BLOCK + qlen));
+	return found;
+}
+
+// looks for `query` starting at line `from` and wrapping once. Returns the
+// matching line, -1 when there is none and -2 when the buffer has edits or
+// is still being indexed and the caller has to walk the rows itself.
+int pager_find(const char* query, int from, int direction)
+{
+	if (P.segs || !indexing_done()) return -2;
+	if (E.numrows == 0 || !*query) return -1;
+
+	long long off;
+	long long at;
+	if (direction > 0)
+	{
+		at = line_offset(from);
+		off = scan_range(query, at, P.file_size, 1);
+		if (off == -1) off = scan_range(query, 0, at, 1);
+	}
+	else
+	{
+		at = from + 1 < E.numrows ? line_offset(from + 1) : P.file_size;
+		off = scan_range(query, 0, at, -1);
+		if (off == -1) off = scan_range(query, at, P.file_size, -1);
+	}
+	return off == -1 ? -1 : line_of_offset(off);
+}
+
+static long long count_newlines(const char* s, long long len)
+{
+	long long n = 0;
+	const char* end = s + len;
+	while ((s = memchr(s, '\n', end - s)) != NULL)
+	{
+		++n;
+		++s;
+	}
+	return n;
+}
+
+static void seg_push(long long first, long long count, erow* row)
+{
+	seg_reserve();
+	P.segs[P.nsegs].first = first;
+	P.segs[P.nsegs].count = count;
+	P.segs[P.nsegs].row = row;
+	++P.nsegs;
+}
+
+// turns every file line holding query into an overlay row, rebuilding the
+// segment list in one pass over the file. Returns -1 when the buffer can't
+// be edited yet.
+int pager_find_matches(const char* query)
+{
+	if (!begin_edit()) return -1;
+	long long qlen = strlen(query);
+	if (qlen == 0) return 0;
+
+	struct segment* old = P.segs;
+	int nold = P.nsegs;
+	P.segs = NULL;
+	P.nsegs = 0;
+	P.segs_cap = 0;
+	P.starts_valid = 0;
+
+	char* buf = malloc(SCAN_BLOCK + qlen);
+	mem_add(MEM_SEARCH, SCAN_BLOCK + qlen);
+	long long at = 0; // buffer row of the segment being copied
+	for (int i = 0; i < nold; ++i)
+	{
+		struct segment s = old[i];
+		if (s.row)
+		{
+			seg_push(s.first, s.count, s.row);
+			at += s.count;
+			continue;
+		}
+
+		long long end = line_offset(s.first + s.count);
+		long long counted = line_offset(s.first); // newlines before this offset are counted
+		long long line = s.first;
+		long long from = s.first; // first line not pushed yet
+		for (long long lo = counted; lo < end; lo += SCAN_BLOCK)
+		{
+			long long want = end - lo < SCAN_BLOCK + qlen - 1 ? end - lo : SCAN_BLOCK + qlen - 1;
+			ssize_t n = pread(P.fd, buf, want, lo);
+			if (n <= 0) break;
+			long long stop = lo + (n < SCAN_BLOCK ? n : SCAN_BLOCK); // matches start below it
+
+			char* p = buf;
+			char* m;
+			while ((m = memmem(p, buf + n - p, query, qlen)) != NULL && lo + (m - buf) < stop)
+			{
+				line += count_newlines(&buf[counted - lo], lo + (m - buf) - counted);
+				counted = lo + (m - buf);
+				p = m + 1;
+				if (line < from) continue; // the line is a row already
+
+				if (line > from) seg_push(from, line - from, NULL);
+				erow* row = malloc(sizeof(erow));
+				materialize(row, line, at + (line - s.first));
+				seg_push(-1, 1, row);
+				from = line + 1;
+			}
+			line += count_newlines(&buf[counted - lo], stop - counted);
+			counted = stop;
+		}
+		if (s.first + s.count > from) seg_push(from, s.first + s.count - from, NULL);
+		at += s.count;
+	}
+	free(buf);
+	mem_add(MEM_SEARCH, -(SCAN_BLOCK + qlen));
+	free(old);
+	return 0;
+}
+
+// calls edit on each overlay row holding query in buffer order, after
+// pager_find_matches made them. Returns how many.
+int pager_each_match(const char* query, void (*edit)(erow* row))
+{
+	size_t qlen = strlen(query);
+	int edited = 0;
+	for (int i = 0; i < P.nsegs; ++i)
+	{
+		erow* row = P.segs[i].row;
+		if (!row || !memmem(row->chars, row->size, query, qlen)) continue;
+		edit(row);
+		++edited;
+	}
+	return edited;
+}
+
+// save
+
+// line index of the file being written, built as it goes out
+static struct
+{
+	long long* checkpoints;
+	long long n;
+	long long cap;
+	long long lines;
+	long long off;
+} W;
+
+static int save_write(int out, const char* s, size_t len)
+{
+	if (write(out, s, len) != (ssize_t) len) return 0;
+	const char* p = s;
+	const char* end = s + len;
+	while ((p = memchr(p, '\n', end - p)) != NULL)
+	{
+		++p;
+		if (++W.lines % PAGER_CHECKPOINT_LINES) continue;
+		if (W.n == W.cap)
+		{
+			W.cap = W.cap ? W.cap * 2 : 1024;
+			W.checkpoints = realloc(W.checkpoints, sizeof(long long) * W.cap);
+		}
+		W.checkpoints[W.n++] = W.off + (p - s);
+	}
+	W.off += len;
+	return 1;
+}
+
+static int copy_range(int out, long long from, long long to)
+{
+	char* buf = malloc(SCAN_BLOCK);
+	int ok = 1;
+	char last = '\n';
+
+	while (from < to)
+	{
+		long long want = to - from < SCAN_BLOCK ? to - from : SCAN_BLOCK;
+		ssize_t n = pread(P.fd, buf, want, from);
+		if (n <= 0 || !save_write(out, buf, n))
+		{
+			ok = 0;
+			break;
+		}
+		last = buf[n - 1];
+		from += n;
+	}
+	// every row is written with a trailing newline, like editor_rows_to_string
+	if (ok && last != '\n' && !save_write(out, "\n", 1)) ok = 0;
+
+	free(buf);
+	return ok;
+}
+
+static int write_file_lines(int out, long long first, long long count)
+{
+	long long from = line_offset(first);
+	long long to = first + count >= P.lines ? P.file_size : line_offset(first + count);
+	return copy_range(out, from, to);
+}
+
+// once saved, the file on disk holds the buffer: the pager reads the new
+// file with the index made while writing it, which lets go of the overlay
+// rows and lets follow mode see what gets appended to the new file
+static void adopt_saved(const char* filename, long long size)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1 || W.lines != E.numrows)
+	{
+		// the old descriptor still reads the same text
+		if (fd != -1) close(fd);
+		return;
+	}
+	close(P.fd);
+	P.fd = fd;
+	free(P.path);
+	P.path = strdup(filename);
+	P.file_size = size;
+
+	while (P.lru_head) page_drop(P.lru_head->no);
+	for (int i = 0; i < ROW_CACHE_SIZE; ++i)
+	{
+		if (P.rows[i].line < 0) continue;
+		editor_free_row(&P.rows[i].row);
+		P.rows[i].line = -1;
+	}
+	for (int i = 0; i < P.nsegs; ++i)
+	{
+		if (!P.segs[i].row) continue;
+		editor_free_row(P.segs[i].row);
+		free(P.segs[i].row);
+	}
+	free(P.segs);
+	P.segs = NULL;
+	P.nsegs = 0;
+	P.segs_cap = 0;
+	P.starts_valid = 0;
+	P.cur_line = -1;
+
+	__atomic_store_n(&P.checkpoints, 0, __ATOMIC_RELEASE);
+	add_checkpoint(0, 0);
+	for (long long i = 0; i < W.n; ++i) add_checkpoint(i + 1, W.checkpoints[i]);
+	P.newlines = W.lines;
+	P.partial = 0;
+	__atomic_store_n(&P.lines, W.lines, __ATOMIC_RELEASE);
+	P.shown_lines = W.lines;
+}
+
+// streams the untouched file ranges and the overlay rows into a temporary
+// file and renames it over `filename`, then reads the new file instead
+long long pager_save(const char* filename)
+{
+	if (!indexing_done())
+	{
+		errno = EBUSY;
+		return -1;
+	}
+	// follow mode can grow an edited buffer past the last row
+	if (P.segs && too_many_lines())
+	{
+		errno = EFBIG;
+		return -1;
+	}
+
+	size_t tmplen = strlen(filename) + 16;
+	char* tmp = malloc(tmplen);
+	snprintf(tmp, tmplen, "%s.yolo-save", filename);
+
+	int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out == -1)
+	{
+		free(tmp);
+		return -1;
+	}
+
+	W.n = 0;
+	W.lines = 0;
+	W.off = 0;
+	int ok = 1;
+	if (!P.segs)
+	{
+		if (P.lines > 0) ok = write_file_lines(out, 0, P.lines);
+	}
+	else
+	{
+		for (int i = 0; ok && i < P.nsegs; ++i)
+		{
+			struct segment* s = &P.segs[i];
+			if (s->row)
+			{
+				ok = save_write(out, s->row->chars, s->row->size) && save_write(out, "\n", 1);
+			}
+			else
+			{
+				ok = write_file_lines(out, s->first, s->count);
+			}
+		}
+	}
+
+	struct stat st;
+	// the rename replaces the file, the new one keeps the old one's mode
+	if (ok && stat(filename, &st) == 0 && fchmod(out, st.st_mode & 07777) == -1) ok = 0;
+	long long written = -1;
+	if (ok && fsync(out) != -1 && fstat(out, &st) != -1)
+		written = st.st_size;
+	close(out);
+	if (written != -1 && rename(tmp, filename) == -1) written = -1;
+	if (written == -1) unlink(tmp);
+	else adopt_saved(filename, written);
+	free(W.checkpoints);
+	W.checkpoints = NULL;
+	W.cap = 0;
+	free(tmp);
+	return written;
+}
@@ -0,0 +1,36 @@
+#ifndef PAGER_H_
+#define PAGER_H_
+
+#include "editor.h"
+
+// Paged view for files too large to hold in E.row. Rows are read on demand
+// through a sparse line index and an LRU page cache, edits live in an
+// overlay that is streamed together with the untouched file ranges on save.
+
+#define PAGER_CHECKPOINT_LINES 1024         // one index entry every K lines
+#define PAGER_PAGE_SIZE (64 * 1024)
+#define PAGER_DEFAULT_CACHE_MB 64           // override with YOLO_PAGE_CACHE_MB
+#define PAGER_DEFAULT_THRESHOLD_MB 256      // override with YOLO_PAGED_THRESHOLD_MB
+
+int pager_should_open(const char* filename);
+void pager_open(const char* filename);
+void pager_open_indexed(const char* filename, const long long* checkpoints, long long n, long long newlines, int partial);
+long long pager_index(long long* newlines, int* partial);
+long long pager_checkpoint(long long n);
+void pager_close();
+int pager_extend(long long size);
+int pager_poll();
+int pager_progress();
+
+erow* pager_row(int at);
+erow* pager_row_peek(int at);
+erow* pager_row_mut(int at);
+int pager_insert_row(int at, char* s, size_t len);
+int pager_del_row(int at);
+
+int pager_find(const char* query, int from, int direction);
+int pager_find_matches(const char* query);
+int pager_each_match(const char* query, void (*edit)(erow* row));
+long long pager_save(const char* filename);
+
+#endif
@@ -0,0 +1,452 @@
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "mem.h"
+#include "rowmem.h"
+#include "utf8.h"
+
+// 16 byte granularity up to 128, then four classes per power of two
+static const int classes[] = {
+	32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256, 320, 384, 448, 512,
+	640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+	2560, 3072, 3584, 4096
+};
+#define NCLASSES ((int) (sizeof(classes) / sizeof(classes[0])))
+
+// slabs are mapped ROWMEM_SLAB_SIZE aligned so a block finds its slab by
+// masking its address, and a slab whose blocks are all free is unmapped
+struct slab
+{
+	struct slab* prev;
+	struct slab* next;
+	size_t used;
+	long live; // blocks handed out and not freed
+	char data[];
+};
+
+#define SLAB_DATA (ROWMEM_SLAB_SIZE - offsetof(struct slab, data))
+
+// free blocks are linked both ways so a dying slab can take its own out
+struct free_block
+{
+	struct free_block* prev;
+	struct free_block* next;
+	int size;
+};
+
+// blocks above ROWMEM_MAX_CLASS, linked so that rowmem_release finds them
+struct large
+{
+	struct large* prev;
+	struct large* next;
+	char data[];
+};
+
+static struct
+{
+	struct slab* slabs; // the first one is the slab being carved
+	struct large* large;
+	struct free_block* free_lists[NCLASSES];
+	struct rowmem_stats stats;
+	unsigned int pin_gen; // rows pinned since the last rowmem_unpin_all have pin == pin_gen + 1
+	struct orphan* orphans; // pinned blocks their rows moved away from
+	int norphans;
+	int orphans_cap;
+} R;
+
+struct orphan
+{
+	char* block;
+	int size;
+};
+
+static int class_of(size_t n)
+{
+	int lo = 0, hi = NCLASSES - 1;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if ((size_t) classes[mid] < n) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// rounds n up to the capacity that block_alloc will actually hand out
+static int block_size(size_t n)
+{
+	if (n > ROWMEM_MAX_CLASS) return n;
+	return classes[class_of(n)];
+}
+
+static struct slab* slab_of(void* p)
+{
+	return (struct slab*) ((uintptr_t) p & ~(uintptr_t) (ROWMEM_SLAB_SIZE - 1));
+}
+
+static struct slab* slab_map()
+{
+	// map twice the size and trim it down to an aligned slab
+	char* p = mmap(NULL, 2 * ROWMEM_SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) die("mmap");
+	char* start = (char*) slab_of(p + ROWMEM_SLAB_SIZE - 1);
+	if (start > p) munmap(p, start - p);
+	munmap(start + ROWMEM_SLAB_SIZE, p + ROWMEM_SLAB_SIZE - start);
+	R.stats.mallocs++;
+	R.stats.slabs++;
+	return (struct slab*) start;
+}
+
+static void list_unlink(struct free_block* b)
+{
+	if (b->prev) b->prev->next = b->next;
+	else R.free_lists[class_of(b->size)] = b->next;
+	if (b->next) b->next->prev = b->prev;
+}
+
+static void slab_unmap(struct slab* s)
+{
+	for (size_t off = 0; off < s->used; off += ((struct free_block*) &s->data[off])->size)
+		list_unlink((struct free_block*) &s->data[off]);
+
+	if (s->prev) s->prev->next = s->next;
+	else R.slabs = s->next;
+	if (s->next) s->next->prev = s->prev;
+	munmap(s, ROWMEM_SLAB_SIZE);
+	R.stats.slabs--;
+}
+
+static char* block_alloc(int size)
+{
+	R.stats.blocks++;
+	R.stats.block_bytes += size;
+	mem_add(MEM_ROWS, size);
+
+	if (size > ROWMEM_MAX_CLASS)
+	{
+		R.stats.large++;
+		R.stats.large_bytes += size;
+		R.stats.mallocs++;
+		struct large* l = malloc(sizeof(struct large) + size);
+		if (!l) die("malloc");
+		l->prev = NULL;
+		l->next = R.large;
+		if (R.large) R.large->prev = l;
+		R.large = l;
+		return l->data;
+	}
+
+	int c = class_of(size);
+	struct free_block* b = R.free_lists[c];
+	if (b)
+	{
+		list_unlink(b);
+		slab_of(b)->live++;
+		R.stats.reused++;
+		return (char*) b;
+	}
+
+	if (!R.slabs || R.slabs->used + size > SLAB_DATA)
+	{
+		if (R.slabs && R.slabs->live == 0) slab_unmap(R.slabs);
+		struct slab* s = slab_map();
+		s->prev = NULL;
+		s->next = R.slabs;
+		s->used = 0;
+		s->live = 0;
+		if (R.slabs) R.slabs->prev = s;
+		R.slabs = s;
+	}
+	char* p = &R.slabs->data[R.slabs->used];
+	R.slabs->used += size;
+	R.slabs->live++;
+	return p;
+}
+
+static void block_free(char* p, int size)
+{
+	if (!p) return;
+	R.stats.blocks--;
+	R.stats.block_bytes -= size;
+	mem_add(MEM_ROWS, -size);
+
+	if (size > ROWMEM_MAX_CLASS)
+	{
+		R.stats.large--;
+		R.stats.large_bytes -= size;
+		struct large* l = (struct large*) (p - offsetof(struct large, data));
+		if (l->prev) l->prev->next = l->next;
+		else R.large = l->next;
+		if (l->next) l->next->prev = l->prev;
+		free(l);
+		return;
+	}
+
+	int c = class_of(size);
+	struct free_block* b = (struct free_block*) p;
+	b->size = size;
+	b->prev = NULL;
+	b->next = R.free_lists[c];
+	if (b->next) b->next->prev = b;
+	R.free_lists[c] = b;
+
+	struct slab* s = slab_of(p);
+	if (--s->live == 0 && s != R.slabs) slab_unmap(s);
+}
+
+static int pinned(erow* row)
+{
+	return row->chars && row->pin == R.pin_gen + 1;
+}
+
+// frees the block of a row, unless the clipboard still holds its text
+static void drop_block(erow* row)
+{
+	if (!pinned(row))
+	{
+		block_free(row->chars, row->cap);
+		return;
+	}
+	if (R.norphans == R.orphans_cap)
+	{
+		R.orphans_cap = R.orphans_cap ? R.orphans_cap * 2 : 64;
+		R.orphans = realloc(R.orphans, sizeof(struct orphan) * R.orphans_cap);
+	}
+	R.orphans[R.norphans].block = row->chars;
+	R.orphans[R.norphans++].size = row->cap;
+}
+
+// render columns laid out in the block, 0 when render lives elsewhere
+// (long-line mode) or was stripped
+static int block_rsize(erow* row)
+{
+	if (!row->chars || row->render != row->chars + row->chars_cap) return 0;
+	return (char*) row->hl - row->render - 1;
+}
+
+// moves the bytes of the render and hl in the block from MEM_ROWS to
+// their own tags (sign 1) or back (sign -1)
+static void track(erow* row, int sign)
+{
+	long long n = (long long) sign * block_rsize(row);
+	if (!n) return;
+	R.stats.render_bytes += n;
+	mem_add(MEM_RENDER, n);
+	mem_add(MEM_HL, n);
+	mem_add(MEM_ROWS, -2 * n);
+}
+
+// gives the row a block of `cap` bytes with room for `chars_cap` chars,
+// keeping the current text and the render size laid out in the block
+static void relocate(erow* row, int chars_cap, int cap)
+{
+	int rsize = block_rsize(row);
+	track(row, -1);
+	char* block = block_alloc(cap);
+	if (row->chars) memcpy(block, row->chars, row->size + 1);
+	drop_block(row);
+
+	row->pin = 0;
+	row->chars = block;
+	row->chars_cap = chars_cap;
+	row->cap = cap;
+	row->render = block + chars_cap;
+	row->hl = (unsigned char*) row->render + rsize + 1;
+	track(row, 1);
+}
+
+// replaces the text of a row, render and hl are laid out by editor_update_row
+void rowmem_set_text(erow* row, const char* s, size_t len)
+{
+	int chars_cap = len + 1;
+	int need = chars_cap + 2 * len + 1; // room for a tab free render and its hl
+	track(row, -1);
+	if (!row->chars || row->cap < need || row->cap > 2 * block_size(need) || pinned(row))
+	{
+		drop_block(row);
+		row->chars = NULL;
+		relocate(row, chars_cap, block_size(need));
+	}
+	else
+	{
+		row->chars_cap = row->cap - 2 * len - 1;
+	}
+	row->rsize = 0;
+	row->render = row->chars + row->chars_cap;
+	row->hl = (unsigned char*) row->render + 1;
+	memcpy(row->chars, s, len);
+	row->chars[len] = '\0';
+	row->size = len;
+}
+
+// like rowmem_set_text, but the row is left stripped: editor_row_at lays
+// it out when it is first used
+void rowmem_set_chars(erow* row, const char* s, size_t len)
+{
+	track(row, -1);
+	drop_block(row);
+	row->chars = NULL;
+	relocate(row, len + 1, block_size(len + 1));
+	memcpy(row->chars, s, len);
+	row->chars[len] = '\0';
+	row->size = len;
+	row->rsize = 0;
+	row->render = NULL;
+	row->hl = NULL;
+}
+
+// makes room for `size` chars plus the terminator, growing by half the
+// current capacity so that typing doesn't move the block on every key
+void rowmem_reserve(erow* row, int size)
+{
+	if (size + 1 <= row->chars_cap)
+	{
+		rowmem_own(row);
+		return;
+	}
+
+	int chars_cap = row->chars_cap + row->chars_cap / 2;
+	if (chars_cap < size + 1) chars_cap = size + 1;
+	int rsize = row->wide ? 0 : row->rsize; // long rows render outside the block
+	relocate(row, chars_cap, block_size(chars_cap + 2 * rsize + 1));
+}
+
+// places render (rsize + 1 bytes) and hl (rsize bytes) after the chars
+void rowmem_layout(erow* row, int rsize)
+{
+	int need = row->chars_cap + 2 * rsize + 1;
+	track(row, -1);
+	if (need > row->cap)
+	{
+		// large blocks are sized exactly, leave room so typing doesn't move them each time
+		if (need > ROWMEM_MAX_CLASS) need += need / 2;
+		relocate(row, row->chars_cap, block_size(need));
+	}
+	else if (row->cap > 2 * block_size(need))
+	{
+		relocate(row, row->chars_cap, block_size(need)); // long-line mode dropped the render
+	}
+
+	row->rsize = rsize;
+	row->render = row->chars + row->chars_cap;
+	row->hl = (unsigned char*) row->render + rsize + 1;
+	track(row, 1);
+}
+
+// shrinks the block to the chars and drops render and hl, editor_row_at
+// lays them out again the next time the row is used
+void rowmem_strip(erow* row)
+{
+	if (!row->chars || !row->render || row->wide) return;
+	utf8_free(row);
+	track(row, -1);
+	row->render = NULL;
+	row->rsize = 0;
+	relocate(row, row->size + 1, block_size(row->size + 1));
+	row->render = NULL;
+	row->hl = NULL;
+}
+
+void rowmem_free(erow* row)
+{
+	utf8_free(row);
+	track(row, -1);
+	drop_block(row);
+	row->chars = NULL;
+	row->render = NULL;
+	row->hl = NULL;
+	row->cap = row->chars_cap = 0;
+}
+
+// the clipboard holds the text of the row: its block stays as it is until
+// rowmem_unpin_all, and the row moves to a new one before its text changes
+void rowmem_pin(erow* row)
+{
+	row->pin = R.pin_gen + 1;
+}
+
+// a pinned row that is about to change its text in place gets a block of
+// its own first
+void rowmem_own(erow* row)
+{
+	if (pinned(row)) relocate(row, row->chars_cap, row->cap);
+}
+
+// the clipboard let go of the rows it held, the blocks they left are freed
+void rowmem_unpin_all()
+{
+	for (int i = 0; i < R.norphans; ++i) block_free(R.orphans[i].block, R.orphans[i].size);
+	free(R.orphans);
+	R.orphans = NULL;
+	R.norphans = R.orphans_cap = 0;
+	++R.pin_gen;
+}
+
+// frees every row block at once, only valid when no row is alive anymore
+void rowmem_release()
+{
+	while (R.slabs)
+	{
+		struct slab* next = R.slabs->next;
+		munmap(R.slabs, ROWMEM_SLAB_SIZE);
+		R.slabs = next;
+	}
+	while (R.large)
+	{
+		struct large* next = R.large->next;
+		free(R.large);
+		R.large = next;
+	}
+	memset(R.free_lists, 0, sizeof(R.free_lists));
+	free(R.orphans);
+	R.orphans = NULL;
+	R.norphans = R.orphans_cap = 0;
+	++R.pin_gen;
+	mem_add(MEM_ROWS, -(R.stats.block_bytes - 2 * R.stats.render_bytes));
+	mem_add(MEM_RENDER, -R.stats.render_bytes);
+	mem_add(MEM_HL, -R.stats.render_bytes);
+	R.stats.render_bytes = 0;
+	R.stats.slabs = R.stats.large = R.stats.large_bytes = 0;
+	R.stats.blocks = R.stats.block_bytes = 0;
+}
+
+static void dump_at_exit()
+{
+	FILE* fp = fopen(getenv("YOLO_ROWMEM_STATS"), "w");
+	if (!fp) return;
+	rowmem_dump(fp);
+	fclose(fp);
+}
+
+// YOLO_ROWMEM_STATS=path writes the allocator statistics there on exit
+void rowmem_init()
+{
+	if (getenv("YOLO_ROWMEM_STATS")) atexit(dump_at_exit);
+}
+
+struct rowmem_stats rowmem_stats()
+{
+	return R.stats;
+}
+
+void rowmem_dump(FILE* fp)
+{
+	struct rowmem_stats s = R.stats;
+	fprintf(fp, "row blocks       %lld (%lld bytes)\n", s.blocks, s.block_bytes);
+	fprintf(fp, "render and hl    %lld bytes each\n", s.render_bytes);
+	fprintf(fp, "slabs            %lld (%lld bytes)\n", s.slabs, s.slabs * (long long) ROWMEM_SLAB_SIZE);
+	fprintf(fp, "large blocks     %lld (%lld bytes)\n", s.large, s.large_bytes);
+	fprintf(fp, "free list reuses %lld\n", s.reused);
+	fprintf(fp, "malloc calls     %lld\n", s.mallocs);
+
+	for (int c = 0; c < NCLASSES; ++c)
+	{
+		int n = 0;
+		for (struct free_block* b = R.free_lists[c]; b; b = b->next) ++n;
+		if (n) fprintf(fp, "free %4d-byte    %d\n", classes[c], n);
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef ROWMEM_H_
+#define ROWMEM_H_
+
+#include "editor.h"
+
+// Row buffers. The chars, render and hl of a row share one block laid out
+// as [chars | render | hl], so drawing a row touches a single allocation.
+// Blocks up to ROWMEM_MAX_CLASS bytes are carved from ROWMEM_SLAB_SIZE
+// slabs and recycled through per size class free lists, larger blocks go
+// to malloc. Rows loaded together end up next to each other in memory,
+// and a slab is unmapped as soon as all of its blocks are free. The
+// clipboard pins the blocks whose text it holds instead of copying it, a
+// pinned row changing its text moves to a new block and leaves the old
+// one to be freed by rowmem_unpin_all.
+
+#define ROWMEM_SLAB_SIZE (1024 * 1024)
+#define ROWMEM_MAX_CLASS 4096
+
+struct rowmem_stats
+{
+	long long slabs;
+	long long large; // blocks too big for a size class
+	long long large_bytes;
+	long long blocks; // blocks in use
+	long long block_bytes;
+	long long render_bytes; // of the blocks holding render, the same for hl
+	long long reused; // allocations served from a free list
+	long long mallocs; // slabs mapped and large blocks malloc'd
+};
+
+void rowmem_init();
+void rowmem_set_text(erow* row, const char* s, size_t len);
+void rowmem_set_chars(erow* row, const char* s, size_t len);
+void rowmem_reserve(erow* row, int size);
+void rowmem_layout(erow* row, int rsize);
+void rowmem_strip(erow* row);
+void rowmem_free(erow* row);
+void rowmem_pin(erow* row);
+void rowmem_own(erow* row);
+void rowmem_unpin_all();
+void rowmem_release();
+
+struct rowmem_stats rowmem_stats();
+void rowmem_dump(FILE* fp);
+
+#endif
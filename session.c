@@ -0,0 +1,275 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "pager.h"
+#include "session.h"
+#include "trace.h"
+
+#define MAGIC "yolo-session-1\n"
+
+// what tells a file apart from an edited version of it
+struct identity
+{
+	long long size;
+	long long mtime_sec;
+	long long mtime_nsec;
+	unsigned long long sample; // hash of the first and last SESSION_SAMPLE bytes
+};
+
+struct header
+{
+	char magic[16];
+	struct identity file;
+	int cx, cy;
+	int rowoff, coloff;
+	long long rows; // comment states that follow, a bit per row, -1 for none
+	long long checkpoints; // line index of a paged file that follows them
+	long long newlines;
+	int partial;
+	int path_len; // the absolute path follows the header
+};
+
+static struct
+{
+	int loaded; // h and what follows it match the file being opened
+	struct header h;
+	unsigned char* states;
+	long long* checkpoints;
+	int tracked; // the buffer was read from or written to a file that is still `file`
+	struct identity file;
+} S;
+
+static int enabled()
+{
+	char* v = getenv("YOLO_SESSION");
+	return !v || strcmp(v, "0");
+}
+
+static unsigned long long hash(unsigned long long h, const unsigned char* s, ssize_t len)
+{
+	for (ssize_t i = 0; i < len; ++i) h = (h ^ s[i]) * 1099511628211ull;
+	return h;
+}
+
+static int identify(const char* filename, struct identity* id)
+{
+	memset(id, 0, sizeof(*id));
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) return 0;
+	struct stat st;
+	if (fstat(fd, &st) == -1)
+	{
+		close(fd);
+		return 0;
+	}
+	id->size = st.st_size;
+	id->mtime_sec = st.st_mtim.tv_sec;
+	id->mtime_nsec = st.st_mtim.tv_nsec;
+
+	unsigned char* buf = malloc(SESSION_SAMPLE);
+	unsigned long long h = 14695981039346656037ull;
+	h = hash(h, buf, pread(fd, buf, SESSION_SAMPLE, 0));
+	if (st.st_size > SESSION_SAMPLE)
+		h = hash(h, buf, pread(fd, buf, SESSION_SAMPLE, st.st_size - SESSION_SAMPLE));
+	id->sample = h;
+	free(buf);
+	close(fd);
+	return 1;
+}
+
+static int same_file(const struct identity* a, const struct identity* b)
+{
+	return a->size == b->size && a->mtime_sec == b->mtime_sec &&
+	       a->mtime_nsec == b->mtime_nsec && a->sample == b->sample;
+}
+
+// record of the file at the absolute path, the directory is made when asked
+static char* record_path(const char* path, int make_dir)
+{
+	char dir[PATH_MAX];
+	char* v = getenv("YOLO_SESSION_DIR");
+	char* xdg = getenv("XDG_CACHE_HOME");
+	char* home = getenv("HOME");
+	if (v && *v) snprintf(dir, sizeof(dir), "%s", v);
+	else if (xdg && *xdg) snprintf(dir, sizeof(dir), "%s/yolo", xdg);
+	else if (home && *home) snprintf(dir, sizeof(dir), "%s/.cache/yolo", home);
+	else return NULL;
+
+	if (make_dir)
+	{
+		// every missing directory on the way, like mkdir -p
+		for (char* p = dir + 1; *p; ++p)
+		{
+			if (*p != '/') continue;
+			*p = '\0';
+			mkdir(dir, 0700);
+			*p = '/';
+		}
+		mkdir(dir, 0700);
+	}
+
+	unsigned long long h = hash(14695981039346656037ull, (const unsigned char*) path, strlen(path));
+	size_t len = strlen(dir) + 32;
+	char* record = malloc(len);
+	snprintf(record, len, "%s/%016llx", dir, h);
+	return record;
+}
+
+static void discard()
+{
+	free(S.states);
+	free(S.checkpoints);
+	S.states = NULL;
+	S.checkpoints = NULL;
+	S.loaded = 0;
+}
+
+// reads the record of filename, kept only if the file is still the one
+// it was written for
+void session_load(const char* filename)
+{
+	discard();
+	if (!enabled()) return;
+	char* path = realpath(filename, NULL);
+	if (!path) return;
+	long long span = trace_begin();
+	char* record = record_path(path, 0);
+	FILE* fp = record ? fopen(record, "r") : NULL;
+	free(record);
+	if (!fp)
+	{
+		free(path);
+		return;
+	}
+
+	struct identity file;
+	struct header* h = &S.h;
+	int ok = fread(h, sizeof(*h), 1, fp) == 1 && !memcmp(h->magic, MAGIC, sizeof(MAGIC)) &&
+	         h->path_len == (int) strlen(path) && h->rows <= INT_MAX && h->checkpoints >= 0 &&
+	         identify(path, &file) && same_file(&file, &h->file);
+	if (ok)
+	{
+		char* saved = malloc(h->path_len);
+		ok = fread(saved, h->path_len, 1, fp) == 1 && !memcmp(saved, path, h->path_len);
+		free(saved);
+	}
+	if (ok && h->rows >= 0)
+	{
+		S.states = malloc(h->rows / 8 + 1);
+		ok = fread(S.states, 1, h->rows / 8 + 1, fp) == (size_t) (h->rows / 8 + 1);
+	}
+	if (ok && h->checkpoints > 0)
+	{
+		S.checkpoints = malloc(sizeof(long long) * h->checkpoints);
+		ok = fread(S.checkpoints, sizeof(long long), h->checkpoints, fp) == (size_t) h->checkpoints;
+	}
+	S.loaded = ok;
+	if (!ok) discard();
+	fclose(fp);
+	free(path);
+	trace_end("session_load", span);
+}
+
+// rows the record has the comment states of, -1 when it has none
+int session_rows()
+{
+	return S.loaded ? S.h.rows : -1;
+}
+
+// opens a paged file with the line index of the record, 0 when it has none
+int session_open_pager(const char* filename)
+{
+	if (!S.loaded || S.h.checkpoints == 0) return 0;
+	pager_open_indexed(filename, S.checkpoints, S.h.checkpoints, S.h.newlines, S.h.partial);
+	return 1;
+}
+
+// puts back the comment state at the end of each row, 0 when the rows
+// read aren't the ones of the record
+int session_restore_rows()
+{
+	if (!S.loaded || S.h.rows != E.numrows) return 0;
+	for (int i = 0; i < E.numrows; ++i) E.row[i].hl_open_comment = (S.states[i / 8] >> (i % 8)) & 1;
+	return 1;
+}
+
+// puts the cursor back where it was and drops the record
+void session_restore_position()
+{
+	if (S.loaded)
+	{
+		E.cy = S.h.cy < E.numrows ? S.h.cy : E.numrows;
+		E.rowoff = S.h.rowoff < E.cy ? S.h.rowoff : E.cy;
+		E.coloff = S.h.coloff;
+		E.cx = E.cy < E.numrows ? S.h.cx : 0;
+		if (E.cy < E.numrows && E.cx > editor_row_at(E.cy)->size) E.cx = editor_row_at(E.cy)->size;
+	}
+	discard();
+}
+
+// the buffer now holds what E.filename has on disk
+void session_track()
+{
+	S.tracked = E.filename && identify(E.filename, &S.file);
+}
+
+// writes the record of the open file. The comment states and the line
+// index only go in while the buffer holds what the file has on disk.
+void session_save()
+{
+	if (!enabled() || !E.filename || !S.tracked) return;
+	struct identity file;
+	if (!identify(E.filename, &file) || !same_file(&file, &S.file)) return;
+	char* path = realpath(E.filename, NULL);
+	if (!path) return;
+	char* record = record_path(path, 1);
+	if (!record)
+	{
+		free(path);
+		return;
+	}
+	long long span = trace_begin();
+
+	struct header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, MAGIC, sizeof(MAGIC));
+	h.file = file;
+	h.cx = E.cx;
+	h.cy = E.cy;
+	h.rowoff = E.rowoff;
+	h.coloff = E.coloff;
+	h.rows = E.paged || E.is_dirty ? -1 : E.numrows;
+	h.checkpoints = E.is_dirty ? 0 : pager_index(&h.newlines, &h.partial);
+	h.path_len = strlen(path);
+
+	// written next to the record and renamed over it, so a reader never sees half of one
+	size_t tmp_len = strlen(record) + 8;
+	char* tmp = malloc(tmp_len);
+	snprintf(tmp, tmp_len, "%s.tmp", record);
+	FILE* fp = fopen(tmp, "w");
+	int ok = fp && fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(path, h.path_len, 1, fp) == 1;
+	if (ok && h.rows >= 0)
+	{
+		unsigned char* states = calloc(h.rows / 8 + 1, 1);
+		for (int i = 0; i < E.numrows; ++i)
+			if (E.row[i].hl_open_comment) states[i / 8] |= 1 << (i % 8);
+		ok = fwrite(states, 1, h.rows / 8 + 1, fp) == (size_t) (h.rows / 8 + 1);
+		free(states);
+	}
+	for (long long i = 0; ok && i < h.checkpoints; ++i)
+	{
+		long long off = pager_checkpoint(i);
+		ok = fwrite(&off, sizeof(off), 1, fp) == 1;
+	}
+	if (fp && fclose(fp) != 0) ok = 0;
+	if (ok) ok = rename(tmp, record) == 0;
+	if (!ok) unlink(tmp);
+
+	free(tmp);
+	free(record);
+	free(path);
+	trace_end("session_save", span);
+}
@@ -0,0 +1,26 @@
+#ifndef SESSION_H_
+#define SESSION_H_
+
+#include "editor.h"
+
+// Session cache. Quitting writes a record of the file to the cache
+// directory ($YOLO_SESSION_DIR, else $XDG_CACHE_HOME/yolo or ~/.cache/yolo),
+// named after a hash of its absolute path. It keeps the file's size, mtime
+// and a hash of its first and last SESSION_SAMPLE bytes, the cursor and
+// scroll position, the comment state at the end of every row and the line
+// index of a paged file. Opening a file that still matches its record
+// loads the rows without laying them out or lexing them (editor_row_at
+// does that when they are first shown), skips indexing a paged file and
+// puts the cursor back. YOLO_SESSION=0 turns it off.
+
+#define SESSION_SAMPLE (64 * 1024)
+
+void session_load(const char* filename);
+int session_rows();
+int session_open_pager(const char* filename);
+int session_restore_rows();
+void session_restore_position();
+void session_track();
+void session_save();
+
+#endif
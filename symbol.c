@@ -0,0 +1,653 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "mem.h"
+#include "symbol.h"
+#include "trace.h"
+
+#define INDEX_MAGIC "YOLOSYM1"
+
+struct sym
+{
+	unsigned int name; // offset in the file's names
+	int line;
+	unsigned short col;
+	unsigned char kind;
+	unsigned char len;
+};
+
+// the index file holds, after the magic and the file count, each file as
+// path length (u16), path, mtime in ns, size, symbol count, names length,
+// the NUL separated names and the struct sym array
+struct sym_file
+{
+	char* path;
+	long long mtime;
+	long long size;
+	struct sym* syms;
+	int n;
+	int cap;
+	char* names;
+	int names_len;
+	int names_cap;
+};
+
+static struct
+{
+	struct sym_file* files; // sorted by path
+	int n;
+	int loaded;
+	int rescan; // walk the tree again on the next update
+	const char* index_path;
+} S;
+
+// files waiting to be parsed, taken by the workers in turn
+static struct
+{
+	struct sym_file** todo;
+	int n;
+	int next;
+} Q;
+
+static long long mtime_ns(struct stat* st)
+{
+	return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+static long long file_bytes(struct sym_file* f)
+{
+	return (long long) sizeof(struct sym) * f->cap + f->names_cap;
+}
+
+static void free_file(struct sym_file* f)
+{
+	mem_add(MEM_SYMBOLS, -file_bytes(f));
+	free(f->path);
+	free(f->syms);
+	free(f->names);
+}
+
+static int cmp_path(const void* a, const void* b)
+{
+	return strcmp(((const struct sym_file*) a)->path, ((const struct sym_file*) b)->path);
+}
+
+// parsing
+
+struct tok
+{
+	const char* s;
+	int len;
+	int line;
+	int col;
+};
+
+static void emit(struct sym_file* f, int kind, struct tok* t)
+{
+	int len = t->len > 255 ? 255 : t->len;
+	if (f->n == f->cap)
+	{
+		f->cap = f->cap ? f->cap * 2 : 64;
+		f->syms = realloc(f->syms, sizeof(struct sym) * f->cap);
+	}
+	if (f->names_len + len + 1 > f->names_cap)
+	{
+		while (f->names_len + len + 1 > f->names_cap) f->names_cap = f->names_cap ? f->names_cap * 2 : 1024;
+		f->names = realloc(f->names, f->names_cap);
+	}
+
+	struct sym* y = &f->syms[f->n++];
+	y->name = f->names_len;
+	y->line = t->line;
+	y->col = t->col > 65535 ? 65535 : t->col;
+	y->kind = kind;
+	y->len = len;
+	memcpy(&f->names[f->names_len], t->s, len);
+	f->names[f->names_len + len] = '\0';
+	f->names_len += len + 1;
+}
+
+static int is_keyword(struct editor_syntax* syn, struct tok* t)
+{
+	for (char** k = syn->keywords; *k; ++k)
+	{
+		if ((*k)[0] != t->s[0]) continue;
+		int klen = strlen(*k);
+		if ((*k)[klen - 1] == '|') --klen;
+		if (klen == t->len && !strncmp(*k, t->s, klen)) return 1;
+	}
+	return 0;
+}
+
+static int tag_kind(struct tok* t)
+{
+	if ((t->len == 6 && !strncmp(t->s, "struct", 6)) || (t->len == 5 && !strncmp(t->s, "class", 5)))
+		return SYM_STRUCT;
+	if (t->len == 5 && !strncmp(t->s, "union", 5)) return SYM_UNION;
+	if (t->len == 4 && !strncmp(t->s, "enum", 4)) return SYM_ENUM;
+	return -1;
+}
+
+// finds the definitions at file scope: a name and its parameters followed
+// by a block, struct/union/enum and a name followed by a block, and the
+// name a typedef declares. Preprocessor lines, comments and strings are
+// skipped, blocks are only looked into for their end.
+static void scan(struct sym_file* f, const char* s, long len, struct editor_syntax* syn)
+{
+	char* scs = syn->single_line_comment_start;
+	char* mcs = syn->multiline_comment_start;
+	char* mce = syn->multiline_comment_end;
+	int scs_len = scs ? strlen(scs) : 0;
+	int mcs_len = mcs && mce ? strlen(mcs) : 0;
+	int mce_len = mcs && mce ? strlen(mce) : 0;
+	int strings = syn->flags & HL_HIGHLIGHT_STRINGS;
+
+	int line = 1;
+	long line_start = 0;
+	int bol = 1; // only blanks so far on the line
+	int depth = 0, parens = 0, extern_blocks = 0;
+	int last = 0, prev = 0; // 'i' identifier, 'k' keyword, 'v' literal, or the punctuation
+	struct tok name = { 0 }, fn = { 0 }, tag = { 0 }, td = { 0 };
+	int fn_state = 0; // 1 in its parameters, 2 after them
+	int kind = -1, tag_state = 0; // 1 after struct/union/enum, 2 after its name too
+	int in_typedef = 0, td_locked = 0;
+
+	long i = 0;
+	while (i < len)
+	{
+		char c = s[i];
+		if (c == '\n')
+		{
+			++line;
+			line_start = ++i;
+			bol = 1;
+			continue;
+		}
+		if (isspace((unsigned char) c))
+		{
+			++i;
+			continue;
+		}
+		if (scs_len && c == scs[0] && !strncmp(&s[i], scs, scs_len))
+		{
+			while (i < len && s[i] != '\n') ++i;
+			continue;
+		}
+		if (mcs_len && c == mcs[0] && !strncmp(&s[i], mcs, mcs_len))
+		{
+			for (i += mcs_len; i < len && (s[i] != mce[0] || strncmp(&s[i], mce, mce_len)); ++i)
+			{
+				if (s[i] == '\n')
+				{
+					++line;
+					line_start = i + 1;
+				}
+			}
+			i += mce_len;
+			continue;
+		}
+		if (c == '#' && bol)
+		{
+			// the directive and its continuation lines
+			for (; i < len && s[i] != '\n'; ++i)
+			{
+				if (s[i] == '\\' && s[i + 1] == '\n')
+				{
+					++line;
+					line_start = ++i + 1;
+				}
+			}
+			continue;
+		}
+		bol = 0;
+		prev = last;
+
+		if (strings && (c == '"' || c == '\''))
+		{
+			for (++i; i < len && s[i] != c && s[i] != '\n'; ++i)
+				if (s[i] == '\\' && s[i + 1] && s[i + 1] != '\n') ++i;
+			if (i < len && s[i] == c) ++i;
+			last = 'v';
+			continue;
+		}
+		if (isalpha((unsigned char) c) || c == '_')
+		{
+			long j = i;
+			while (j < len && (isalnum((unsigned char) s[j]) || s[j] == '_')) ++j;
+			struct tok t = { &s[i], j - i, line, i - line_start };
+			i = j;
+			int kw = is_keyword(syn, &t);
+			last = kw ? 'k' : 'i';
+			if (depth > 0) continue;
+
+			if (kw)
+			{
+				int k = tag_kind(&t);
+				tag_state = k != -1;
+				if (k != -1) kind = k;
+				if (t.len == 7 && !strncmp(t.s, "typedef", 7) && parens == 0)
+				{
+					in_typedef = 1;
+					td_locked = 0;
+					td.len = 0;
+				}
+				continue;
+			}
+
+			if (tag_state == 1)
+			{
+				tag = t;
+				tag_state = 2;
+			}
+			else
+			{
+				tag_state = 0;
+			}
+			if (in_typedef && !td_locked)
+			{
+				// a function pointer type is named in (*name)
+				if (parens == 0) td = t;
+				else if (parens == 1 && prev == '*')
+				{
+					td = t;
+					td_locked = 1;
+				}
+			}
+			name = t;
+			continue;
+		}
+		if (isdigit((unsigned char) c))
+		{
+			while (i < len && (isalnum((unsigned char) s[i]) || s[i] == '.')) ++i;
+			last = 'v';
+			continue;
+		}
+
+		++i;
+		last = c;
+		if (depth > 0)
+		{
+			if (c == '{') ++depth;
+			else if (c == '}') --depth;
+			continue;
+		}
+		switch (c)
+		{
+			case '(':
+				if (parens++ == 0 && prev == 'i' && fn_state == 0 && !in_typedef)
+				{
+					fn = name;
+					fn_state = 1;
+				}
+				tag_state = 0;
+				break;
+			case ')':
+				if (parens > 0 && --parens == 0 && fn_state == 1) fn_state = 2;
+				break;
+			case '{':
+				if (prev == 'v' && parens == 0 && fn_state == 0)
+				{
+					++extern_blocks; // extern "C" { keeps its contents at file scope
+					break;
+				}
+				if (tag_state == 2 && prev == 'i') emit(f, kind, &tag);
+				else if (fn_state == 2) emit(f, SYM_FUNCTION, &fn);
+				fn_state = tag_state = 0;
+				++depth;
+				break;
+			case '}':
+				if (extern_blocks > 0) --extern_blocks;
+				break;
+			case ';':
+			case ',':
+				if (parens > 0) break;
+				if (in_typedef && td.len) emit(f, SYM_TYPEDEF, &td);
+				if (c == ';') in_typedef = 0;
+				td.len = 0;
+				td_locked = 0;
+				fn_state = tag_state = 0;
+				break;
+			case '=':
+				if (parens == 0) fn_state = 0;
+				tag_state = 0;
+				break;
+			default:
+				tag_state = 0;
+				break;
+		}
+	}
+}
+
+static void parse_file(struct sym_file* f)
+{
+	struct editor_syntax* syn = editor_syntax_for(f->path);
+	int fd = open(f->path, O_RDONLY);
+	if (fd == -1 || !syn)
+	{
+		if (fd != -1) close(fd);
+		return;
+	}
+
+	char* text = malloc(f->size + 1);
+	long len = 0;
+	ssize_t n;
+	while (len < f->size && (n = read(fd, &text[len], f->size - len)) > 0) len += n;
+	close(fd);
+	text[len] = '\0';
+
+	scan(f, text, len, syn);
+	free(text);
+	mem_add(MEM_SYMBOLS, file_bytes(f));
+}
+
+static void* worker_main(void* arg)
+{
+	(void) arg;
+	trace_name_thread("symbols");
+	while (1)
+	{
+		int i = __atomic_fetch_add(&Q.next, 1, __ATOMIC_RELAXED);
+		if (i >= Q.n) break;
+		long long span = trace_begin();
+		parse_file(Q.todo[i]);
+		trace_end("symbol_parse", span);
+	}
+	return NULL;
+}
+
+// parses the queued files on up to YOLO_SYMBOL_THREADS threads, the
+// calling one included
+static void parse_all()
+{
+	char* env = getenv("YOLO_SYMBOL_THREADS");
+	int threads = env && atoi(env) > 0 ? atoi(env) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > SYMBOL_MAX_THREADS) threads = SYMBOL_MAX_THREADS;
+	if (threads > Q.n) threads = Q.n;
+
+	pthread_t workers[SYMBOL_MAX_THREADS];
+	int started = 0;
+	Q.next = 0;
+	for (; started < threads - 1; ++started)
+		if (pthread_create(&workers[started], NULL, worker_main, NULL) != 0) break;
+	worker_main(NULL);
+	trace_name_thread("main");
+	for (int i = 0; i < started; ++i) pthread_join(workers[i], NULL);
+}
+
+// the tree
+
+struct file_list
+{
+	struct sym_file* f;
+	int n;
+	int cap;
+};
+
+// every file under dir with a syntax, leaving out hidden entries and not
+// following links to directories
+static void walk(const char* dir, struct file_list* list)
+{
+	DIR* d = opendir(dir);
+	if (!d) return;
+
+	struct dirent* e;
+	while ((e = readdir(d)) != NULL)
+	{
+		if (e->d_name[0] == '.') continue;
+		char* path = malloc(strlen(dir) + strlen(e->d_name) + 2);
+		if (!strcmp(dir, ".")) strcpy(path, e->d_name);
+		else sprintf(path, "%s/%s", dir, e->d_name);
+
+		struct stat st;
+		if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode))
+		{
+			walk(path, list);
+		}
+		else if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size <= SYMBOL_FILE_MAX &&
+		         editor_syntax_for(path))
+		{
+			if (list->n == list->cap)
+			{
+				list->cap = list->cap ? list->cap * 2 : 256;
+				list->f = realloc(list->f, sizeof(struct sym_file) * list->cap);
+			}
+			struct sym_file* f = &list->f[list->n++];
+			memset(f, 0, sizeof(*f));
+			f->path = path;
+			f->mtime = mtime_ns(&st);
+			f->size = st.st_size;
+			continue;
+		}
+		free(path);
+	}
+	closedir(d);
+}
+
+// the index file
+
+static void load_index()
+{
+	FILE* fp = fopen(S.index_path, "rb");
+	if (!fp) return;
+
+	char magic[8];
+	unsigned int count;
+	if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, INDEX_MAGIC, sizeof(magic)) ||
+	    fread(&count, sizeof(count), 1, fp) != 1 || count > (1 << 24))
+	{
+		fclose(fp);
+		return;
+	}
+
+	S.files = calloc(count, sizeof(struct sym_file));
+	int ok = 1;
+	for (S.n = 0; ok && S.n < (int) count; ++S.n)
+	{
+		struct sym_file* f = &S.files[S.n];
+		unsigned short plen;
+		unsigned int n, names_len;
+		ok = fread(&plen, sizeof(plen), 1, fp) == 1 && (f->path = calloc(plen + 1, 1)) != NULL &&
+			fread(f->path, 1, plen, fp) == plen &&
+			fread(&f->mtime, sizeof(f->mtime), 1, fp) == 1 && fread(&f->size, sizeof(f->size), 1, fp) == 1 &&
+			fread(&n, sizeof(n), 1, fp) == 1 && fread(&names_len, sizeof(names_len), 1, fp) == 1 &&
+			n < (1 << 24) && names_len < (1u << 30);
+		if (!ok) break;
+
+		f->n = f->cap = n;
+		f->names_len = f->names_cap = names_len;
+		f->syms = malloc(sizeof(struct sym) * (n ? n : 1));
+		f->names = malloc(names_len ? names_len : 1);
+		ok = fread(f->names, 1, names_len, fp) == names_len && fread(f->syms, sizeof(struct sym), n, fp) == n;
+		for (unsigned int i = 0; ok && i < n; ++i)
+			ok = f->syms[i].kind < SYM_KINDS && f->syms[i].name + f->syms[i].len < names_len;
+		mem_add(MEM_SYMBOLS, file_bytes(f));
+	}
+	fclose(fp);
+
+	if (!ok)
+	{
+		// a torn or foreign file, everything gets parsed again
+		for (int i = 0; i <= S.n && i < (int) count; ++i) free_file(&S.files[i]);
+		free(S.files);
+		S.files = NULL;
+		S.n = 0;
+		return;
+	}
+	qsort(S.files, S.n, sizeof(struct sym_file), cmp_path);
+}
+
+static int save_index()
+{
+	char tmp[PATH_MAX];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", S.index_path);
+	FILE* fp = fopen(tmp, "wb");
+	if (!fp) return -1;
+
+	unsigned int count = S.n;
+	fwrite(INDEX_MAGIC, 8, 1, fp);
+	fwrite(&count, sizeof(count), 1, fp);
+	for (int i = 0; i < S.n; ++i)
+	{
+		struct sym_file* f = &S.files[i];
+		unsigned short plen = strlen(f->path);
+		unsigned int n = f->n, names_len = f->names_len;
+		fwrite(&plen, sizeof(plen), 1, fp);
+		fwrite(f->path, 1, plen, fp);
+		fwrite(&f->mtime, sizeof(f->mtime), 1, fp);
+		fwrite(&f->size, sizeof(f->size), 1, fp);
+		fwrite(&n, sizeof(n), 1, fp);
+		fwrite(&names_len, sizeof(names_len), 1, fp);
+		fwrite(f->names, 1, names_len, fp);
+		fwrite(f->syms, sizeof(struct sym), n, fp);
+	}
+	if (ferror(fp) | fclose(fp))
+	{
+		unlink(tmp);
+		return -1;
+	}
+	return rename(tmp, S.index_path);
+}
+
+// brings the index up to date with the tree: the index file is read on
+// the first call, then the tree is walked and only new files and files
+// whose mtime or size changed are parsed. Later calls reuse the index as
+// it is until a file is saved. Returns the files indexed, *parsed is set
+// to the files parsed.
+int symbol_update(int* parsed)
+{
+	*parsed = 0;
+	if (!S.loaded)
+	{
+		S.index_path = getenv("YOLO_SYMBOLS") ? getenv("YOLO_SYMBOLS") : SYMBOL_INDEX_FILE;
+		load_index();
+		S.loaded = 1;
+		S.rescan = 1;
+	}
+	if (!S.rescan) return S.n;
+	S.rescan = 0;
+
+	long long span = trace_begin();
+	struct file_list found = { NULL, 0, 0 };
+	walk(".", &found);
+	qsort(found.f, found.n, sizeof(struct sym_file), cmp_path);
+
+	// unchanged files keep their symbols, the rest is queued
+	Q.todo = malloc(sizeof(struct sym_file*) * (found.n ? found.n : 1));
+	Q.n = 0;
+	int kept = 0;
+	for (int i = 0; i < found.n; ++i)
+	{
+		struct sym_file* f = &found.f[i];
+		struct sym_file* old = bsearch(f, S.files, S.n, sizeof(struct sym_file), cmp_path);
+		if (old && old->mtime == f->mtime && old->size == f->size)
+		{
+			f->syms = old->syms;
+			f->n = old->n;
+			f->cap = old->cap;
+			f->names = old->names;
+			f->names_len = old->names_len;
+			f->names_cap = old->names_cap;
+			old->syms = NULL;
+			old->names = NULL;
+			old->cap = old->names_cap = 0;
+			++kept;
+		}
+		else
+		{
+			Q.todo[Q.n++] = f;
+		}
+	}
+	int changed = Q.n > 0 || kept != S.n;
+	for (int i = 0; i < S.n; ++i) free_file(&S.files[i]);
+	free(S.files);
+	S.files = found.f;
+	S.n = found.n;
+
+	parse_all();
+	free(Q.todo);
+	Q.todo = NULL;
+	*parsed = Q.n;
+	if (changed) save_index();
+	trace_end("symbol_update", span);
+	return S.n;
+}
+
+// a file was written, the next update looks at the tree again
+void symbol_file_saved()
+{
+	S.rescan = 1;
+}
+
+// lookup
+
+// a fuzzy match: the query's characters in order, ignoring case. Matches
+// at the start of the name or of a word in it and runs of consecutive
+// characters score higher, and so do shorter names. -1 for no match.
+static int score(const char* q, int qlen, const char* name, int len)
+{
+	if (qlen > len) return -1;
+	int sc = 0, qi = 0, last = -2;
+	for (int i = 0; i < len && qi < qlen; ++i)
+	{
+		if (tolower((unsigned char) name[i]) != tolower((unsigned char) q[qi])) continue;
+		sc += 1;
+		if (i == 0) sc += 8;
+		else if (name[i - 1] == '_' || (isupper((unsigned char) name[i]) && islower((unsigned char) name[i - 1]))) sc += 6;
+		if (last == i - 1) sc += 4;
+		if (name[i] == q[qi]) sc += 1;
+		last = i;
+		++qi;
+	}
+	if (qi < qlen) return -1;
+	if (len == qlen) sc += 20;
+	return sc * 256 - len;
+}
+
+// the best matches of query, at most max of them ranked in out, with the
+// count of all matches in *total
+int symbol_lookup(const char* query, struct symbol_match* out, int max, int* total)
+{
+	int qlen = strlen(query);
+	int n = 0;
+	*total = 0;
+	if (qlen == 0 || max <= 0) return 0;
+
+	for (int i = 0; i < S.n; ++i)
+	{
+		struct sym_file* f = &S.files[i];
+		for (int j = 0; j < f->n; ++j)
+		{
+			struct sym* y = &f->syms[j];
+			const char* name = &f->names[y->name];
+			int sc = score(query, qlen, name, y->len);
+			if (sc < 0) continue;
+			++*total;
+			if (n == max && sc <= out[n - 1].score) continue;
+
+			int at = n < max ? n++ : n - 1;
+			while (at > 0 && out[at - 1].score < sc)
+			{
+				out[at] = out[at - 1];
+				--at;
+			}
+			out[at].name = name;
+			out[at].path = f->path;
+			out[at].line = y->line;
+			out[at].col = y->col;
+			out[at].kind = y->kind;
+			out[at].score = sc;
+		}
+	}
+	return n;
+}
+
+const char* symbol_kind_name(int kind)
+{
+	static const char* names[SYM_KINDS] = { "function", "struct", "union", "enum", "typedef" };
+	return kind >= 0 && kind < SYM_KINDS ? names[kind] : "?";
+}
@@ -0,0 +1,45 @@
+#ifndef SYMBOL_H_
+#define SYMBOL_H_
+
+#include "editor.h"
+
+// Symbol index of the source tree under the working directory: the
+// functions, structs, unions, enums and typedefs defined at file scope,
+// found by tokenizing each file with the comment and keyword rules of its
+// HL_DB entry. Files are parsed by a pool of threads (YOLO_SYMBOL_THREADS,
+// the online CPUs by default) and the index is kept in a compact binary
+// file, SYMBOL_INDEX_FILE or YOLO_SYMBOLS=path, so that later sessions
+// only parse the files whose mtime or size changed. Lookups go through the
+// index in memory and never read the sources.
+
+#define SYMBOL_INDEX_FILE ".yolo-symbols"
+#define SYMBOL_MAX_THREADS 64
+#define SYMBOL_FILE_MAX (64 << 20) // bigger files are left out
+#define SYMBOL_MATCHES 32 // ranked matches a lookup returns at most
+
+enum symbol_kind
+{
+	SYM_FUNCTION,
+	SYM_STRUCT,
+	SYM_UNION,
+	SYM_ENUM,
+	SYM_TYPEDEF,
+	SYM_KINDS
+};
+
+struct symbol_match
+{
+	const char* name; // valid until the next symbol_update
+	const char* path;
+	int line; // from 1
+	int col; // byte offset in the line
+	int kind;
+	int score;
+};
+
+int symbol_update(int* parsed);
+void symbol_file_saved();
+int symbol_lookup(const char* query, struct symbol_match* out, int max, int* total);
+const char* symbol_kind_name(int kind);
+
+#endif
@@ -1,6 +1,9 @@
 #define ORIGIN_FILE
 
+#include "bracket.h"
+#include "longline.h"
 #include "syntax_highlight.h"
+#include "trace.h"
 
 char* C_HL_extensions[] = { ".c", ".h", ".cpp", NULL };
 char* C_HL_keywords[] =
@@ -21,12 +24,10 @@ struct editor_syntax HL_DB[] =
 	}
 };
 
-void editor_select_syntax_highlight()
+// syntax for a file name by its extension or a part of it, NULL for none
+struct editor_syntax* editor_syntax_for(const char* filename)
 {
-	E.syntax = NULL;
-	if (E.filename == NULL) return;
-
-	char* ext = strrchr(E.filename, '.');
+	char* ext = strrchr(filename, '.');
 	for (unsigned int j = 0; j < HL_DB_ENTRIES; ++j)
 	{
 		struct editor_syntax* s = &HL_DB[j];
@@ -35,25 +36,66 @@ void editor_select_syntax_highlight()
 		{
 			int is_ext = (s->filematch[i][0] == '.');
 			if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-			    (!is_ext && strstr(E.filename, s->filematch[i])))
-			{
-				E.syntax = s;
-				int filerow;
-				for (filerow = 0; filerow < E.numrows; ++filerow)
-					editor_update_syntax(&E.row[filerow]);
-				return;
-			}
+			    (!is_ext && strstr(filename, s->filematch[i])))
+				return s;
+			++i;
 		}
-		++i;
 	}
+	return NULL;
 }
 
-void editor_update_syntax(erow *row)
+void editor_select_syntax_highlight()
 {
-	row->hl = realloc(row->hl, row->rsize);
-	memset(row->hl, HL_NORMAL, row->rsize);
+	E.syntax = NULL;
+	if (E.filename == NULL) return;
 
+	E.syntax = editor_syntax_for(E.filename);
 	if (E.syntax == NULL) return;
+	int filerow;
+	for (filerow = 0; filerow < E.numrows; ++filerow)
+	{
+		erow* row = editor_row_peek(filerow);
+		if (row) editor_update_syntax(row);
+	}
+}
+
+// rows touched while highlighting is deferred, lexed by editor_syntax_flush
+static int defer_depth;
+static int timing;
+static int timing_depth;
+static long long spent_ns;
+static int dirty_from = -1;
+static int dirty_to = -1;
+
+// lexer state at the start of a row
+struct lex_state editor_syntax_start(erow* row)
+{
+	struct lex_state st = { 1, 0, 0, 0, HL_NORMAL, 0, HL_NORMAL };
+	erow* prev = NULL;
+	if (row->idx > 0)
+	{
+		// cold and stripped rows keep hl_open_comment, only peek into pages
+		prev = E.paged ? editor_row_peek(row->idx - 1) : &E.row[row->idx - 1];
+	}
+	st.in_comment = (prev && prev->hl_open_comment);
+	return st;
+}
+
+// lexes s[0..len) into hl starting from st and leaves the state at len in
+// st. s must be NUL terminated, and a token starting before len may read
+// and color up to LEX_LOOKAHEAD bytes after it (reported through st->skip).
+void editor_syntax_lex(const char* s, int len, unsigned char* hl, struct lex_state* st)
+{
+	int i = st->skip < len ? st->skip : len;
+	memset(hl, st->skip_hl, i);
+	memset(&hl[i], HL_NORMAL, len - i);
+
+	if (E.syntax == NULL) return;
+	if (st->line_comment)
+	{
+		memset(hl, HL_COMMENT, len);
+		return;
+	}
 
 	char** keywords = E.syntax->keywords;
 
@@ -64,22 +106,22 @@ void editor_update_syntax(erow *row)
 	int mcs_len = mcs ? strlen(mcs) : 0;
 	int mce_len = mce ? strlen(mce) : 0;
 
+	int prev_sep = st->prev_sep;
+	int in_string = st->in_string;
+	int in_comment = st->in_comment;
 
-	int prev_sep = 1;
-	int in_string = 0;
-	int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
-
-	int i = 0;
-	while (i < row->rsize)
+	while (i < len)
 	{
-		char c = row->render[i];
-		unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
+		char c = s[i];
+		unsigned char prev_hl = (i > 0) ? hl[i - 1] : st->prev_hl;
 
 		if (scs_len && !in_string && !in_comment)
 		{
-			if (!strncmp(&row->render[i], scs, scs_len))
+			if (!strncmp(&s[i], scs, scs_len))
 			{
-				memset(&row->hl[i], HL_COMMENT, row->rsize - i);
+				memset(&hl[i], HL_COMMENT, len - i);
+				st->line_comment = 1;
+				i = len;
 				break;
 			}
 		}
@@ -88,24 +130,24 @@ void editor_update_syntax(erow *row)
 		{
 			if (in_comment)
 			{
-				row->hl[i] = HL_MLCOMMENT;
-				if (!strncmp(&row->render[i], mce, mce_len))
+				hl[i] = HL_MLCOMMENT;
+				if (!strncmp(&s[i], mce, mce_len))
 				{
-					memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
-					i += mcs_len;
-					in_comment = 1;
+					memset(&hl[i], HL_MLCOMMENT, mce_len);
+					i += mce_len;
+					in_comment = 0;
+					prev_sep = 1;
 					continue;
 				}
 				else
 				{
 					++i;
-					in_comment = 1;
 					continue;
 				}
 			}
-			else if (!strncmp(&row->render[i], mcs, mcs_len))
+			else if (!strncmp(&s[i], mcs, mcs_len))
 			{
-				memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
+				memset(&hl[i], HL_MLCOMMENT, mcs_len);
 				i += mcs_len;
 				in_comment = 1;
 				continue;
@@ -116,10 +158,10 @@ void editor_update_syntax(erow *row)
 		{
 			if (in_string)
 			{
-				row->hl[i] = HL_STRING;
-				if (c == '\\' && i + 1 < row->rsize)
+				hl[i] = HL_STRING;
+				if (c == '\\' && s[i + 1])
 				{
-					row->hl[i + 1] = HL_STRING;
+					hl[i + 1] = HL_STRING;
 					i += 2;
 					continue;
 				}
@@ -134,7 +176,7 @@ void editor_update_syntax(erow *row)
 				if (c == '"' || c == '\'')
 				{
 					in_string = c;
-					row->hl[i] = HL_STRING;
+					hl[i] = HL_STRING;
 					++i;
 					continue;
 				}
@@ -146,7 +188,7 @@ void editor_update_syntax(erow *row)
 			if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
 				(c == '.' && prev_hl == HL_NUMBER))
 			{
-				row->hl[i] = HL_NUMBER;
+				hl[i] = HL_NUMBER;
 				++i;
 				prev_sep = 0;
 				continue;
@@ -162,10 +204,10 @@ void editor_update_syntax(erow *row)
 				int kw2 = keywords[j][klen - 1] == '|';
 				if (kw2) klen--;
 
-				if (!strncmp(&row->render[i], keywords[j], klen) &&
-				    is_separator(row->render[i + klen]))
+				if (!strncmp(&s[i], keywords[j], klen) &&
+				    is_separator(s[i + klen]))
 				{
-					memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+					memset(&hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
 					i += klen;
 					break;
 				}
@@ -181,10 +223,106 @@ void editor_update_syntax(erow *row)
 		++i;
 	}
 
-	int changed = (row->hl_open_comment != in_comment);
-	row->hl_open_comment = in_comment;
-	if (changed && (row->idx + 1 < E.numrows))
-		editor_update_syntax(&E.row[row->idx + 1]);
+	st->prev_sep = prev_sep;
+	st->in_string = in_string;
+	st->in_comment = in_comment;
+	st->skip = i - len;
+	st->skip_hl = i > len ? hl[len] : HL_NORMAL;
+	if (i > 0) st->prev_hl = hl[i - 1];
+}
+
+static long long timing_begin()
+{
+	if (!timing || timing_depth++ > 0) return 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void timing_end(long long start)
+{
+	if (!timing || --timing_depth > 0) return;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	spent_ns += ts.tv_sec * 1000000000LL + ts.tv_nsec - start;
+}
+
+// lexes one row, returns 1 when its open comment state changed
+static int highlight_row(erow *row)
+{
+	if (row->wide)
+	{
+		bracket_update_row(row);
+		return longline_highlight(row);
+	}
+
+	struct lex_state st = editor_syntax_start(row);
+	editor_syntax_lex(row->render, row->rsize, row->hl, &st);
+	bracket_update_row(row);
+
+	int changed = (row->hl_open_comment != st.in_comment);
+	row->hl_open_comment = st.in_comment;
+	return changed;
+}
+
+void editor_update_syntax(erow *row)
+{
+	if (defer_depth > 0)
+	{
+		// keep hl valid for draw_rows until the real pass runs
+		if (!row->wide) memset(row->hl, HL_NORMAL, row->rsize);
+		if (dirty_from == -1 || row->idx < dirty_from) dirty_from = row->idx;
+		if (row->idx > dirty_to) dirty_to = row->idx;
+		return;
+	}
+
+	long long span = trace_begin();
+	long long start = timing_begin();
+	while (highlight_row(row) && row->idx + 1 < E.numrows)
+	{
+		row = editor_row_lexable(row->idx + 1);
+		if (!row) break;
+	}
+	timing_end(start);
+	trace_end("editor_update_syntax", span);
+}
+
+// batches highlighting until the matching editor_syntax_flush, which lexes
+// the touched rows in one top-down pass
+void editor_syntax_defer()
+{
+	++defer_depth;
+}
+
+void editor_syntax_flush()
+{
+	if (--defer_depth > 0 || dirty_from == -1) return;
+
+	int at = dirty_from;
+	int to = dirty_to;
+	dirty_from = dirty_to = -1;
+
+	long long span = trace_begin();
+	long long start = timing_begin();
+	for (; at < E.numrows; ++at)
+	{
+		erow* row = editor_row_lexable(at);
+		if (!row) break;
+		if (!highlight_row(row) && at >= to) break;
+	}
+	timing_end(start);
+	trace_end("editor_syntax_flush", span);
+}
+
+// time spent highlighting is summed up while timing is on, see latency.h
+void editor_syntax_timing(int on)
+{
+	timing = on;
+}
+
+long long editor_syntax_spent()
+{
+	return spent_ns;
 }
 
 int editor_syntax_to_color(int hl)
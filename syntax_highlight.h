@@ -27,6 +27,20 @@ enum highlight {
 	HL_MATCH
 };
 
+// lexer state at a column of a row, so lexing can resume from a checkpoint
+struct lex_state
+{
+	unsigned char prev_sep;
+	unsigned char in_string; // the opening quote
+	unsigned char in_comment;
+	unsigned char line_comment; // the rest of the row is a comment
+	unsigned char prev_hl;
+	unsigned char skip; // bytes after the end already colored by the last token
+	unsigned char skip_hl;
+};
+
+#define LEX_LOOKAHEAD 32
+
 struct editor_syntax
 {
 	char* filetype;
@@ -39,8 +53,17 @@ struct editor_syntax
 };
 extern struct editor_syntax HL_DB[];
 
+struct erow;
+
+struct editor_syntax* editor_syntax_for(const char* filename);
 void editor_select_syntax_highlight();
 void editor_update_syntax();
+void editor_syntax_defer();
+void editor_syntax_flush();
+void editor_syntax_timing(int on);
+long long editor_syntax_spent();
+struct lex_state editor_syntax_start(struct erow* row);
+void editor_syntax_lex(const char* s, int len, unsigned char* hl, struct lex_state* st);
 int editor_syntax_to_color(int hl);
 int is_separator(int c);
 
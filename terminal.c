@@ -0,0 +1,153 @@
+#include <poll.h>
+
+#include "editor.h"
+#include "event.h"
+#include "fold.h"
+#include "frame.h"
+#include "latency.h"
+
+// The terminal front end: raw mode, screen size and frames written to stdout.
+
+static void enable_raw_mode();
+static void disable_raw_mode();
+static int get_window_size(int *rows, int *cols);
+static int get_cursor_position(int* rows, int* cols);
+static int draw_frame();
+static void clear_screen();
+
+void init()
+{
+	enable_raw_mode();
+
+	int rows, cols;
+	if (get_window_size(&rows, &cols) == -1)
+		die("get_window_size");
+	editor_core_init(rows - 2, cols); // status bar height
+	editor_on_die(clear_screen);
+	event_on_frame(draw_frame);
+	event_on_resize(editor_update_window_size);
+	frame_init();
+}
+
+// drawn by the event loop, a frame the terminal can't take yet stays pending
+static int draw_frame()
+{
+	if (!frame_ready()) return 0;
+	refresh_screen();
+	return 1;
+}
+
+static void clear_screen()
+{
+	write(STDIN_FILENO, "\x1b[2J", 4); // clear entire screen
+	write(STDIN_FILENO, "\x1b[H", 3);  // move cursor to col:1, row:1
+}
+
+void refresh_screen()
+{
+	latency_frame_begin();
+	editor_scroll();
+
+	struct abuf ab = ABUF_INIT;
+
+	frame_begin(&ab);
+	ab_append(&ab, "\x1b[H", 3);     // move cursor to col:1, row:1
+
+	draw_rows(&ab);
+	draw_status_bar(&ab);
+	draw_message_bar(&ab);
+	draw_popup(&ab);
+
+	// move cursor
+	char buf[32];
+	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (fold_line(E.cy) - fold_line(E.rowoff)) + 1, E.gutter + (E.rx-E.coloff)+1);
+	ab_append(&ab, buf, strlen(buf));
+
+	frame_end(&ab);
+	ab_free(&ab);
+}
+
+// picks up a new terminal size after SIGWINCH
+void editor_update_window_size()
+{
+	struct winsize ws;
+
+	if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+		return;
+	E.screen_rows = ws.ws_row - 2; // status bar height
+	E.screen_cols = ws.ws_col;
+}
+
+static void enable_raw_mode()
+{
+	if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1)
+		die("tcgetattr");
+	atexit(disable_raw_mode);
+
+	struct termios config = E.orig_termios;
+	config.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+	config.c_oflag &= ~OPOST;
+	config.c_cflag |= CS8;
+	config.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
+	// reads never block, the event loop polls stdin instead
+	config.c_cc[VMIN] = 0;
+	config.c_cc[VTIME] = 0;
+
+	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &config) == -1)
+		die("tcsetattr");
+
+	write(STDIN_FILENO, "\x1b[?2004h", 8); // bracketed paste
+}
+
+static void disable_raw_mode()
+{
+	write(STDIN_FILENO, "\x1b[?2004l", 8);
+
+	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
+		die("tcsetattr");
+}
+
+static int get_window_size(int *rows, int *cols)
+{
+	struct winsize ws;
+
+	if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+	{
+		// plan b to get the screensize
+		if (write(STDIN_FILENO, "\x1b[999C\x1b[999B", 12) != 12)
+			return -1;
+		return get_cursor_position(rows, cols);
+	}
+	else
+	{
+		*cols = ws.ws_col;
+		*rows = ws.ws_row;
+		return 0;
+	}
+}
+
+// helper for plan b to get the screensize
+static int get_cursor_position(int* rows, int* cols)
+{
+	if (write(STDIN_FILENO, "\x1b[6n", 4) != 4)
+		return -1;
+
+	char buf[32];
+	unsigned int i = 0;
+
+	while (i < sizeof(buf)-1)
+	{
+		struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+		if (poll(&pfd, 1, 100) != 1) break;
+		if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
+		if (buf[i] == 'R') break;
+		++i;
+	}
+	buf[i] = '\0';
+	printf("\r\n&buf[1]: '%s'\r\n", &buf[1]);
+
+	if (buf[0] != '\x1b' || buf[1] != '[') return -1;
+	if (sscanf(&buf[2], "%d;%d", rows, cols) != 2) return -1;
+
+	return 0;
+}
@@ -0,0 +1,123 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+
+#include "complete.h"
+#include "diff.h"
+#include "editor.h"
+#include "event.h"
+#include "follow.h"
+
+// Headless checks of the editor core, run with make test. Each test works
+// on files under TEST_DIR and reports what it expected when it fails.
+
+#define TEST_DIR "/tmp/yolo-test"
+
+static int failed;
+
+#define CHECK(cond) \
+	do \
+	{ \
+		if (!(cond)) \
+		{ \
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			++failed; \
+		} \
+	} while (0)
+
+static void write_file(const char* path, const char* mode, const char* s)
+{
+	FILE* fp = fopen(path, mode);
+	if (!fp) die(path);
+	fputs(s, fp);
+	fclose(fp);
+}
+
+// runs what the event loop has queued, the diff resolves from a timer
+static void settle()
+{
+	for (int i = 0; i < 10; ++i) event_wait(0);
+}
+
+static int row_is(int at, const char* s)
+{
+	erow* row = editor_row_at(at);
+	return row && row->size == (int) strlen(s) && !memcmp(row->chars, s, row->size);
+}
+
+// appending to a last line without a newline continues its row, and the
+// gutter still matches the file afterwards
+static void test_follow_unterminated()
+{
+	const char* path = TEST_DIR "/unterminated.log";
+	write_file(path, "w", "one\ntwo\nthr");
+	editor_open((char*) path);
+	CHECK(follow_start());
+
+	write_file(path, "a", "ee\nfour\nfi");
+	follow_poll();
+	settle();
+	CHECK(E.numrows == 5);
+	CHECK(row_is(2, "three"));
+	CHECK(row_is(4, "fi"));
+	for (int i = 0; i <= E.numrows; ++i) CHECK(diff_mark(i) == 0);
+
+	write_file(path, "a", "ve\n");
+	follow_poll();
+	settle();
+	CHECK(E.numrows == 5);
+	CHECK(row_is(4, "five"));
+	for (int i = 0; i <= E.numrows; ++i) CHECK(diff_mark(i) == 0);
+
+	follow_stop();
+	editor_close();
+}
+
+static int indexed;
+
+static void on_indexed()
+{
+	++indexed;
+}
+
+// ^N on a buffer that is still being indexed answers from the words seen
+// so far within a slice, and the indexer says when it has all of them
+static void test_complete_partial()
+{
+	const char* path = TEST_DIR "/words.c";
+	FILE* fp = fopen(path, "w");
+	if (!fp) die(path);
+	for (int i = 0; i < 300000; ++i) fprintf(fp, "int value_%d = counter_%d + total;\n", i, i % 977);
+	fclose(fp);
+	editor_open((char*) path);
+	complete_on_indexed(on_indexed);
+
+	const char* words[COMPLETE_MATCHES];
+	long long start = event_now_ms();
+	int n = complete_lookup("tot", 3, words, COMPLETE_MATCHES);
+	CHECK(event_now_ms() - start < 50);
+	CHECK(complete_indexing());
+	CHECK(n == 1 && !strcmp(words[0], "total"));
+
+	while (complete_indexing()) event_wait(10);
+	CHECK(indexed == 1);
+	n = complete_lookup("counter_9", 9, words, COMPLETE_MATCHES);
+	CHECK(n == COMPLETE_MATCHES);
+
+	complete_on_indexed(NULL);
+	editor_close();
+}
+
+int main()
+{
+	mkdir(TEST_DIR, 0755);
+	editor_core_init(24, 80);
+
+	test_follow_unterminated();
+	test_complete_partial();
+
+	if (failed) fprintf(stderr, "%d checks failed\n", failed);
+	else printf("all checks passed\n");
+	return failed != 0;
+}
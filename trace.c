@@ -0,0 +1,182 @@
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+
+#include "editor.h"
+#include "trace.h"
+
+#define RING_MASK (TRACE_RING_SIZE - 1)
+
+struct trace_event
+{
+	const char* name; // a string literal, never copied
+	long long start;
+	long long dur;
+};
+
+struct trace_buffer
+{
+	// written by its thread only, head is published with a release store
+	struct trace_event ring[TRACE_RING_SIZE];
+	unsigned long long head;
+	int tid;
+	int idle; // its thread exited, the next new thread takes the buffer over
+	const char* name;
+	struct trace_buffer* next;
+};
+
+int trace_on;
+
+static struct
+{
+	pthread_mutex_t lock; // guards the buffer list
+	pthread_key_t key;
+	struct trace_buffer* buffers;
+	int next_tid;
+	long long since; // events older than the last trace_start are not written
+	char path[64];
+	const char* env;
+} T = {
+	.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static __thread struct trace_buffer* local;
+static __thread const char* local_name;
+
+long long trace_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void release(void* buf)
+{
+	__atomic_store_n(&((struct trace_buffer*) buf)->idle, 1, __ATOMIC_RELEASE);
+}
+
+// the buffer of the calling thread, set up by its first span
+static struct trace_buffer* buffer()
+{
+	pthread_mutex_lock(&T.lock);
+	struct trace_buffer* buf;
+	for (buf = T.buffers; buf; buf = buf->next)
+		if (__atomic_load_n(&buf->idle, __ATOMIC_ACQUIRE)) break;
+
+	if (buf)
+	{
+		buf->idle = 0;
+	}
+	else if ((buf = malloc(sizeof(*buf))) != NULL)
+	{
+		buf->head = 0;
+		buf->idle = 0;
+		buf->tid = ++T.next_tid;
+		buf->next = T.buffers;
+		T.buffers = buf;
+	}
+	if (buf)
+	{
+		buf->name = local_name;
+		pthread_setspecific(T.key, buf);
+	}
+	pthread_mutex_unlock(&T.lock);
+	return buf;
+}
+
+void trace_span(const char* name, long long start)
+{
+	if (!local && !(local = buffer())) return;
+
+	unsigned long long head = local->head;
+	struct trace_event* e = &local->ring[head & RING_MASK];
+	e->name = name;
+	e->start = start;
+	e->dur = trace_now() - start;
+	__atomic_store_n(&local->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// names the calling thread's track in the trace
+void trace_name_thread(const char* name)
+{
+	local_name = name;
+	if (local) local->name = name;
+}
+
+const char* trace_path()
+{
+	return T.env ? T.env : T.path;
+}
+
+void trace_start()
+{
+	T.since = trace_now();
+	__atomic_store_n(&trace_on, 1, __ATOMIC_RELAXED);
+}
+
+static void write_event(FILE* fp, int* first, int tid, struct trace_event* e)
+{
+	fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"yolo\",\"ph\":\"X\",\"ts\":%lld.%03lld,\"dur\":%lld.%03lld,\"pid\":%d,\"tid\":%d}",
+		*first ? "" : ",", e->name, e->start / 1000, e->start % 1000, e->dur / 1000, e->dur % 1000, (int) getpid(), tid);
+	*first = 0;
+}
+
+// stops tracing and writes the events to trace_path, returns how many or -1
+int trace_stop()
+{
+	__atomic_store_n(&trace_on, 0, __ATOMIC_RELAXED);
+
+	FILE* fp = fopen(trace_path(), "w");
+	if (!fp) return -1;
+
+	int n = 0;
+	int first = 1;
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	pthread_mutex_lock(&T.lock);
+	for (struct trace_buffer* buf = T.buffers; buf; buf = buf->next)
+	{
+		if (buf->name)
+		{
+			fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				first ? "" : ",", (int) getpid(), buf->tid, buf->name);
+			first = 0;
+		}
+
+		// a thread that saw tracing on just before it stopped may still be
+		// writing its next event, over the oldest slot, which is skipped
+		unsigned long long head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+		unsigned long long i = head >= TRACE_RING_SIZE ? head - TRACE_RING_SIZE + 1 : 0;
+		for (; i < head; ++i)
+		{
+			struct trace_event* e = &buf->ring[i & RING_MASK];
+			if (e->start < T.since) continue;
+			write_event(fp, &first, buf->tid, e);
+			++n;
+		}
+	}
+	pthread_mutex_unlock(&T.lock);
+	fprintf(fp, "\n]}\n");
+	if (fclose(fp) != 0) return -1;
+	return n;
+}
+
+static void stop_at_exit()
+{
+	if (trace_on) trace_stop();
+}
+
+void trace_init()
+{
+	static int done;
+	if (done) return;
+	done = 1;
+
+	pthread_key_create(&T.key, release);
+	trace_name_thread("main");
+	snprintf(T.path, sizeof(T.path), "/tmp/yolo-trace-%d.json", (int) getpid());
+	T.env = getenv("YOLO_TRACE");
+	if (T.env && !*T.env) T.env = NULL;
+
+	atexit(stop_at_exit);
+	if (T.env) trace_start();
+}
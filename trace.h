@@ -0,0 +1,33 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+// Spans of the hot paths in Chrome trace-event format, to load in Perfetto
+// or chrome://tracing. Every thread records into a ring of its own, so the
+// recording path takes no lock. YOLO_TRACE=path traces from startup and
+// writes the file at exit, ^U starts and stops tracing at any time.
+
+#define TRACE_RING_SIZE 65536 // latest events kept per thread, a power of two
+
+extern int trace_on;
+
+long long trace_now();
+void trace_span(const char* name, long long start);
+
+// while tracing is off a span costs a load and a branch on each end
+static inline long long trace_begin()
+{
+	return __atomic_load_n(&trace_on, __ATOMIC_RELAXED) ? trace_now() : 0;
+}
+
+static inline void trace_end(const char* name, long long start)
+{
+	if (start) trace_span(name, start);
+}
+
+void trace_init();
+void trace_name_thread(const char* name);
+void trace_start();
+int trace_stop();
+const char* trace_path();
+
+#endif
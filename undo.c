@@ -0,0 +1,436 @@
+#include "undo.h"
+#include "mem.h"
+#include "pager.h"
+
+enum undo_op
+{
+	OP_INSERT_TEXT = 1,
+	OP_DELETE_TEXT,
+	OP_INSERT_ROWS,
+	OP_DELETE_ROWS
+};
+
+// records are 8-byte aligned in the arena, text ops carry their bytes and
+// row ops carry n (length, bytes) pairs
+struct record
+{
+	unsigned int size;
+	unsigned int prev_size;
+	unsigned char op;
+	unsigned char group_start;
+	int a; // row, or first row for row ops
+	int b; // column, or row count for row ops
+	int cx, cy; // cursor before the group
+	int after_cx, after_cy; // cursor after the group
+	unsigned int len; // payload bytes
+};
+
+static struct
+{
+	char* buf;
+	size_t cap;
+	size_t limit;
+	size_t len; // end of the log
+	size_t pos; // records before pos are applied, the rest can be redone
+	long long last; // offset of the record just before pos, -1 if none
+	long long group; // start record of the newest group, -1 if none
+	long long saved; // pos when the buffer was last saved, -1 if unreachable
+	int suspended;
+	int new_group;
+	int typing;
+	int held; // undo_hold is on
+	int lost; // the group being recorded didn't fit, the rest of it isn't recorded
+} U = { NULL, 0, 0, 0, 0, -1, -1, 0, 0, 1, 0, 0, 0 };
+
+static struct record* rec_at(long long off)
+{
+	return (struct record*) &U.buf[off];
+}
+
+static size_t aligned(size_t n)
+{
+	return (n + 7) & ~(size_t) 7;
+}
+
+void undo_clear()
+{
+	U.len = U.pos = 0;
+	U.last = U.group = -1;
+	U.saved = 0;
+	U.new_group = 1;
+	U.typing = 0;
+	U.lost = 0;
+}
+
+void undo_mark_saved()
+{
+	U.saved = U.pos;
+}
+
+void undo_suspend()
+{
+	++U.suspended;
+}
+
+void undo_resume()
+{
+	--U.suspended;
+}
+
+// while held, every command goes into the group already started, which
+// makes a played macro a single undo
+void undo_hold(int on)
+{
+	U.held = on;
+}
+
+// called before every command, typed characters keep extending the
+// group of the characters typed before them
+void undo_begin_group(int typing)
+{
+	if (U.held) return;
+	if (typing && U.typing && !U.new_group) return;
+	U.new_group = 1;
+	U.typing = typing;
+}
+
+static size_t limit()
+{
+	if (!U.limit)
+	{
+		char* v = getenv("YOLO_UNDO_MB");
+		U.limit = (size_t) (v && atoi(v) > 0 ? atoi(v) : UNDO_DEFAULT_MB) * 1024 * 1024;
+	}
+	return U.limit;
+}
+
+// a command too large for the log: the history is cleared and nothing
+// more is recorded until the next command, so it can't be half undone
+static void lose_group()
+{
+	undo_clear();
+	U.saved = -1;
+	U.new_group = 0;
+	U.lost = 1;
+	set_status_message("Edit too large to undo, undo history cleared");
+}
+
+// drops whole groups from the front until `need` more bytes fit, the group
+// being recorded is never cut into. Returns 0 when it can't stay whole.
+static int make_room(size_t need)
+{
+	if (U.len + need > limit())
+	{
+		long long open = U.new_group ? (long long) U.len : U.group;
+		size_t stop = open >= 0 ? (size_t) open : U.len;
+		size_t cut = 0;
+		while (cut < stop && (U.len - cut + need > U.limit * 3 / 4 || !rec_at(cut)->group_start))
+			cut += rec_at(cut)->size;
+		if (U.len - cut + need > U.limit)
+		{
+			lose_group();
+			return 0;
+		}
+
+		memmove(U.buf, &U.buf[cut], U.len - cut);
+		U.len -= cut;
+		U.pos -= cut;
+		U.last = U.len ? U.last - (long long) cut : -1;
+		U.group = U.group >= (long long) cut ? U.group - (long long) cut : -1;
+		U.saved = U.saved >= (long long) cut ? U.saved - (long long) cut : -1;
+		if (U.len) rec_at(0)->prev_size = 0;
+	}
+
+	if (U.len + need > U.cap)
+	{
+		mem_add(MEM_UNDO, -(long long) U.cap);
+		while (U.len + need > U.cap) U.cap = U.cap ? U.cap * 2 : 4096;
+		U.buf = realloc(U.buf, U.cap);
+		mem_add(MEM_UNDO, U.cap);
+	}
+	return 1;
+}
+
+// whether a command making `records` records that carry `payload` bytes
+// in all would fit in the log, so that it can be undone
+int undo_fits(long long records, long long payload)
+{
+	if (U.suspended) return 1;
+	return records * (long long) aligned(sizeof(struct record)) + payload + 7 * records <= (long long) limit();
+}
+
+// starts a new record at the end of the log, the payload is filled by the caller
+static struct record* append(int op, int a, int b, size_t payload)
+{
+	if (U.lost)
+	{
+		if (!U.new_group) return NULL;
+		U.lost = 0;
+	}
+
+	// anything after the cursor can't be redone anymore
+	U.len = U.pos;
+	if (U.saved > (long long) U.pos) U.saved = -1;
+	if (U.group >= (long long) U.len) U.group = -1;
+
+	size_t size = aligned(sizeof(struct record) + payload);
+	if (size > limit() || !make_room(size))
+	{
+		if (!U.lost) lose_group();
+		return NULL;
+	}
+
+	struct record* r = rec_at(U.len);
+	r->size = size;
+	r->prev_size = U.last >= 0 ? rec_at(U.last)->size : 0;
+	r->op = op;
+	r->group_start = U.new_group;
+	r->a = a;
+	r->b = b;
+	r->cx = E.cx;
+	r->cy = E.cy;
+	r->after_cx = E.cx;
+	r->after_cy = E.cy;
+	r->len = payload;
+
+	if (U.new_group)
+	{
+		// the group before this one ended where this one starts
+		if (U.group >= 0)
+		{
+			rec_at(U.group)->after_cx = E.cx;
+			rec_at(U.group)->after_cy = E.cy;
+		}
+		U.group = U.len;
+		U.new_group = 0;
+	}
+
+	U.last = U.len;
+	U.len += size;
+	U.pos = U.len;
+	return r;
+}
+
+static char* payload(struct record* r)
+{
+	return (char*) (r + 1);
+}
+
+static void record_text(int op, int row, int col, const char* s, size_t len)
+{
+	if (U.suspended || len == 0) return;
+
+	// a typed character right after the previous one grows that record in place
+	if (op == OP_INSERT_TEXT && U.typing && !U.new_group && U.last >= 0 && U.pos == U.len)
+	{
+		struct record* r = rec_at(U.last);
+		if (r->op == OP_INSERT_TEXT && r->a == row && r->b + (int) r->len == col)
+		{
+			size_t grown = aligned(sizeof(struct record) + r->len + len);
+			if (grown <= r->size || make_room(grown - r->size))
+			{
+				r = rec_at(U.last);
+				memcpy(&payload(r)[r->len], s, len);
+				r->len += len;
+				U.len += grown - r->size;
+				U.pos = U.len;
+				r->size = grown;
+				return;
+			}
+		}
+	}
+
+	struct record* r = append(op, row, col, len);
+	if (r) memcpy(payload(r), s, len);
+}
+
+void undo_record_insert_text(int row, int col, const char* s, size_t len)
+{
+	record_text(OP_INSERT_TEXT, row, col, s, len);
+}
+
+void undo_record_delete_text(int row, int col, const char* s, size_t len)
+{
+	record_text(OP_DELETE_TEXT, row, col, s, len);
+}
+
+static void fill_rows(struct record* r, int n, char** lines, size_t* lens)
+{
+	char* p = payload(r);
+	for (int i = 0; i < n; ++i)
+	{
+		unsigned int len = lens[i];
+		memcpy(p, &len, sizeof(len));
+		memcpy(p + sizeof(len), lines[i], len);
+		p += sizeof(len) + len;
+	}
+}
+
+void undo_record_insert_rows(int at, int n, char** lines, size_t* lens)
+{
+	if (U.suspended || n <= 0) return;
+
+	size_t total = 0;
+	for (int i = 0; i < n; ++i) total += sizeof(unsigned int) + lens[i];
+	struct record* r = append(OP_INSERT_ROWS, at, n, total);
+	if (r) fill_rows(r, n, lines, lens);
+}
+
+// must run before the rows are removed
+void undo_record_delete_rows(int at, int n)
+{
+	if (U.suspended || n <= 0) return;
+
+	char** lines = malloc(sizeof(char*) * n);
+	size_t* lens = malloc(sizeof(size_t) * n);
+	size_t total = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		erow* row = editor_row_at(at + i);
+		lines[i] = row->chars;
+		lens[i] = row->size;
+		total += sizeof(unsigned int) + row->size;
+	}
+
+	// rows of a paged buffer may be evicted while others are loaded, copy them first
+	if (E.paged)
+	{
+		for (int i = 0; i < n; ++i)
+		{
+			erow* row = editor_row_at(at + i);
+			lines[i] = malloc(row->size);
+			memcpy(lines[i], row->chars, row->size);
+		}
+	}
+
+	struct record* r = append(OP_DELETE_ROWS, at, n, total);
+	if (r) fill_rows(r, n, lines, lens);
+
+	if (E.paged)
+		for (int i = 0; i < n; ++i) free(lines[i]);
+	free(lens);
+	free(lines);
+}
+
+// re-inserts the rows stored in a row record
+static void insert_rows_of(struct record* r)
+{
+	char** lines = malloc(sizeof(char*) * r->b);
+	size_t* lens = malloc(sizeof(size_t) * r->b);
+	char* p = payload(r);
+	for (int i = 0; i < r->b; ++i)
+	{
+		unsigned int len;
+		memcpy(&len, p, sizeof(len));
+		lines[i] = p + sizeof(len);
+		lens[i] = len;
+		p += sizeof(len) + len;
+	}
+	editor_insert_rows(r->a, r->b, lines, lens);
+	free(lens);
+	free(lines);
+}
+
+static void apply(struct record* r, int inverse)
+{
+	int op = r->op;
+	if (inverse)
+	{
+		if (op == OP_INSERT_TEXT) op = OP_DELETE_TEXT;
+		else if (op == OP_DELETE_TEXT) op = OP_INSERT_TEXT;
+		else if (op == OP_INSERT_ROWS) op = OP_DELETE_ROWS;
+		else op = OP_INSERT_ROWS;
+	}
+
+	switch (op)
+	{
+		case OP_INSERT_TEXT:
+			editor_row_insert_string(editor_row_mut(r->a), r->b, payload(r), r->len);
+			break;
+		case OP_DELETE_TEXT:
+			editor_row_del_string(editor_row_mut(r->a), r->b, r->len);
+			break;
+		case OP_INSERT_ROWS:
+			insert_rows_of(r);
+			break;
+		case OP_DELETE_ROWS:
+			editor_del_rows(r->a, r->b);
+			break;
+	}
+}
+
+static int editable()
+{
+	if (E.paged && pager_progress() >= 0)
+	{
+		set_status_message("Still indexing, the buffer is read-only until it is done");
+		return 0;
+	}
+	return 1;
+}
+
+static void finish(int cx, int cy)
+{
+	editor_syntax_flush();
+	undo_resume();
+	E.cy = cy < E.numrows ? cy : E.numrows;
+	E.cx = cx;
+	erow* row = E.cy < E.numrows ? editor_row_at(E.cy) : NULL;
+	if (E.cx > (row ? row->size : 0)) E.cx = row ? row->size : 0;
+	E.is_dirty = (U.saved != (long long) U.pos);
+	U.new_group = 1;
+	U.typing = 0;
+}
+
+void editor_undo()
+{
+	if (U.last < 0)
+	{
+		set_status_message("Nothing to undo");
+		return;
+	}
+	if (!editable()) return;
+
+	// the newest group ends at the current cursor
+	if (U.pos == U.len && U.group >= 0)
+	{
+		rec_at(U.group)->after_cx = E.cx;
+		rec_at(U.group)->after_cy = E.cy;
+	}
+
+	undo_suspend();
+	editor_syntax_defer();
+	struct record* r;
+	do
+	{
+		r = rec_at(U.last);
+		apply(r, 1);
+		U.pos = U.last;
+		U.last = r->prev_size ? U.last - (long long) r->prev_size : -1;
+	} while (!r->group_start && U.last >= 0);
+
+	finish(r->cx, r->cy);
+}
+
+void editor_redo()
+{
+	if (U.pos >= U.len)
+	{
+		set_status_message("Nothing to redo");
+		return;
+	}
+	if (!editable()) return;
+
+	undo_suspend();
+	editor_syntax_defer();
+	struct record* start = rec_at(U.pos);
+	do
+	{
+		struct record* r = rec_at(U.pos);
+		apply(r, 0);
+		U.last = U.pos;
+		U.pos += r->size;
+	} while (U.pos < U.len && !rec_at(U.pos)->group_start);
+
+	finish(start->after_cx, start->after_cy);
+}
@@ -0,0 +1,30 @@
+#ifndef UNDO_H_
+#define UNDO_H_
+
+#include "editor.h"
+
+// Undo/redo as an append-only log of row-level operations, recorded by the
+// row functions in buffer.c. Records live in one arena capped at
+// YOLO_UNDO_MB (UNDO_DEFAULT_MB by default), the oldest groups are dropped
+// when it is full. A group is everything one command did, and runs of
+// typed characters are merged into a single record.
+
+#define UNDO_DEFAULT_MB 64
+
+void undo_begin_group(int typing);
+void undo_hold(int on);
+void undo_suspend();
+void undo_resume();
+void undo_clear();
+void undo_mark_saved();
+int undo_fits(long long records, long long payload);
+
+void undo_record_insert_text(int row, int col, const char* s, size_t len);
+void undo_record_delete_text(int row, int col, const char* s, size_t len);
+void undo_record_insert_rows(int at, int n, char** lines, size_t* lens);
+void undo_record_delete_rows(int at, int n);
+
+void editor_undo();
+void editor_redo();
+
+#endif
@@ -0,0 +1,440 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem.h"
+#include "utf8.h"
+
+#define INVALID 0xffffffff
+
+struct range
+{
+	unsigned int lo, hi;
+};
+
+// characters taking no column of their own: combining marks, joiners,
+// variation selectors, emoji modifiers and the vowels and finals of
+// conjoining Hangul
+static const struct range zero_width[] = {
+	{ 0x0300, 0x036f }, { 0x0483, 0x0489 }, { 0x0591, 0x05bd }, { 0x05bf, 0x05bf },
+	{ 0x05c1, 0x05c2 }, { 0x05c4, 0x05c5 }, { 0x05c7, 0x05c7 }, { 0x0610, 0x061a },
+	{ 0x064b, 0x065f }, { 0x0670, 0x0670 }, { 0x06d6, 0x06dc }, { 0x06df, 0x06e4 },
+	{ 0x06e7, 0x06e8 }, { 0x06ea, 0x06ed }, { 0x0711, 0x0711 }, { 0x0730, 0x074a },
+	{ 0x07a6, 0x07b0 }, { 0x07eb, 0x07f3 }, { 0x0816, 0x082d }, { 0x0859, 0x085b },
+	{ 0x08d3, 0x08e1 }, { 0x08e3, 0x0903 }, { 0x093a, 0x093c }, { 0x093e, 0x094f },
+	{ 0x0951, 0x0957 }, { 0x0962, 0x0963 }, { 0x0981, 0x0983 }, { 0x09bc, 0x09bc },
+	{ 0x09be, 0x09cd }, { 0x09d7, 0x09d7 }, { 0x09e2, 0x09e3 }, { 0x0a01, 0x0a03 },
+	{ 0x0a3c, 0x0a51 }, { 0x0a70, 0x0a71 }, { 0x0a75, 0x0a75 }, { 0x0a81, 0x0a83 },
+	{ 0x0abc, 0x0abc }, { 0x0abe, 0x0acd }, { 0x0ae2, 0x0ae3 }, { 0x0b01, 0x0b03 },
+	{ 0x0b3c, 0x0b3c }, { 0x0b3e, 0x0b57 }, { 0x0b62, 0x0b63 }, { 0x0b82, 0x0b82 },
+	{ 0x0bbe, 0x0bcd }, { 0x0bd7, 0x0bd7 }, { 0x0c00, 0x0c04 }, { 0x0c3e, 0x0c56 },
+	{ 0x0c62, 0x0c63 }, { 0x0c81, 0x0c83 }, { 0x0cbc, 0x0cbc }, { 0x0cbe, 0x0cd6 },
+	{ 0x0ce2, 0x0ce3 }, { 0x0d00, 0x0d03 }, { 0x0d3b, 0x0d3c }, { 0x0d3e, 0x0d4d },
+	{ 0x0d57, 0x0d57 }, { 0x0d62, 0x0d63 }, { 0x0d81, 0x0d83 }, { 0x0dca, 0x0ddf },
+	{ 0x0df2, 0x0df3 }, { 0x0e31, 0x0e31 }, { 0x0e34, 0x0e3a }, { 0x0e47, 0x0e4e },
+	{ 0x0eb1, 0x0eb1 }, { 0x0eb4, 0x0ebc }, { 0x0ec8, 0x0ecd }, { 0x0f18, 0x0f19 },
+	{ 0x0f35, 0x0f35 }, { 0x0f37, 0x0f37 }, { 0x0f39, 0x0f39 }, { 0x0f3e, 0x0f3f },
+	{ 0x0f71, 0x0f84 }, { 0x0f86, 0x0f87 }, { 0x0f8d, 0x0fbc }, { 0x0fc6, 0x0fc6 },
+	{ 0x102b, 0x103e }, { 0x1056, 0x1059 }, { 0x105e, 0x1060 }, { 0x1062, 0x1064 },
+	{ 0x1067, 0x106d }, { 0x1071, 0x1074 }, { 0x1082, 0x108d }, { 0x108f, 0x108f },
+	{ 0x109a, 0x109d }, { 0x1160, 0x11ff }, { 0x135d, 0x135f }, { 0x1712, 0x1714 },
+	{ 0x1732, 0x1734 }, { 0x1752, 0x1753 }, { 0x1772, 0x1773 }, { 0x17b4, 0x17d3 },
+	{ 0x17dd, 0x17dd }, { 0x180b, 0x180d }, { 0x1885, 0x1886 }, { 0x18a9, 0x18a9 },
+	{ 0x1920, 0x193b }, { 0x1a17, 0x1a1b }, { 0x1a55, 0x1a7f }, { 0x1ab0, 0x1aff },
+	{ 0x1b00, 0x1b04 }, { 0x1b34, 0x1b44 }, { 0x1b6b, 0x1b73 }, { 0x1b80, 0x1b82 },
+	{ 0x1ba1, 0x1bad }, { 0x1be6, 0x1bf3 }, { 0x1c24, 0x1c37 }, { 0x1cd0, 0x1cf9 },
+	{ 0x1dc0, 0x1dff }, { 0x200b, 0x200f }, { 0x202a, 0x202e }, { 0x2060, 0x2064 },
+	{ 0x20d0, 0x20f0 }, { 0x2cef, 0x2cf1 }, { 0x2d7f, 0x2d7f }, { 0x2de0, 0x2dff },
+	{ 0x302a, 0x302f }, { 0x3099, 0x309a }, { 0xa66f, 0xa672 }, { 0xa674, 0xa67d },
+	{ 0xa69e, 0xa69f }, { 0xa6f0, 0xa6f1 }, { 0xa802, 0xa802 }, { 0xa806, 0xa806 },
+	{ 0xa80b, 0xa80b }, { 0xa823, 0xa827 }, { 0xa880, 0xa881 }, { 0xa8b4, 0xa8c5 },
+	{ 0xa8e0, 0xa8f1 }, { 0xa926, 0xa92d }, { 0xa947, 0xa953 }, { 0xa980, 0xa983 },
+	{ 0xa9b3, 0xa9c0 }, { 0xaa29, 0xaa36 }, { 0xaa43, 0xaa43 }, { 0xaa4c, 0xaa4d },
+	{ 0xaab0, 0xaab0 }, { 0xaab2, 0xaab4 }, { 0xaab7, 0xaab8 }, { 0xaabe, 0xaabf },
+	{ 0xaac1, 0xaac1 }, { 0xaaeb, 0xaaef }, { 0xaaf5, 0xaaf6 }, { 0xabe3, 0xabea },
+	{ 0xabec, 0xabed }, { 0xd7b0, 0xd7ff }, { 0xfb1e, 0xfb1e }, { 0xfe00, 0xfe0f },
+	{ 0xfe20, 0xfe2f }, { 0xfeff, 0xfeff }, { 0x101fd, 0x101fd }, { 0x10a01, 0x10a0f },
+	{ 0x10a38, 0x10a3f }, { 0x11000, 0x11002 }, { 0x11038, 0x11046 }, { 0x1107f, 0x11082 },
+	{ 0x110b0, 0x110ba }, { 0x11100, 0x11102 }, { 0x11127, 0x11134 }, { 0x1d165, 0x1d169 },
+	{ 0x1d16d, 0x1d172 }, { 0x1d17b, 0x1d182 }, { 0x1d185, 0x1d18b }, { 0x1d1aa, 0x1d1ad },
+	{ 0x1e8d0, 0x1e8d6 }, { 0x1e944, 0x1e94a }, { 0x1f3fb, 0x1f3ff }, { 0xe0000, 0xe0fff },
+};
+
+// characters taking two columns: East Asian wide and fullwidth forms and
+// the emoji shown as pictures by default
+static const struct range wide[] = {
+	{ 0x1100, 0x115f }, { 0x231a, 0x231b }, { 0x2329, 0x232a }, { 0x23e9, 0x23ec },
+	{ 0x23f0, 0x23f0 }, { 0x23f3, 0x23f3 }, { 0x25fd, 0x25fe }, { 0x2614, 0x2615 },
+	{ 0x2648, 0x2653 }, { 0x267f, 0x267f }, { 0x2693, 0x2693 }, { 0x26a1, 0x26a1 },
+	{ 0x26aa, 0x26ab }, { 0x26bd, 0x26be }, { 0x26c4, 0x26c5 }, { 0x26ce, 0x26ce },
+	{ 0x26d4, 0x26d4 }, { 0x26ea, 0x26ea }, { 0x26f2, 0x26f3 }, { 0x26f5, 0x26f5 },
+	{ 0x26fa, 0x26fa }, { 0x26fd, 0x26fd }, { 0x2705, 0x2705 }, { 0x270a, 0x270b },
+	{ 0x2728, 0x2728 }, { 0x274c, 0x274c }, { 0x274e, 0x274e }, { 0x2753, 0x2755 },
+	{ 0x2757, 0x2757 }, { 0x2795, 0x2797 }, { 0x27b0, 0x27b0 }, { 0x27bf, 0x27bf },
+	{ 0x2b1b, 0x2b1c }, { 0x2b50, 0x2b50 }, { 0x2b55, 0x2b55 }, { 0x2e80, 0x3029 },
+	{ 0x3030, 0x303e }, { 0x3041, 0x3098 }, { 0x309b, 0x33ff }, { 0x3400, 0x4dbf },
+	{ 0x4e00, 0xa4cf }, { 0xa960, 0xa97f }, { 0xac00, 0xd7a3 }, { 0xf900, 0xfaff },
+	{ 0xfe10, 0xfe19 }, { 0xfe30, 0xfe6f }, { 0xff00, 0xff60 }, { 0xffe0, 0xffe6 },
+	{ 0x16fe0, 0x16fe4 }, { 0x17000, 0x18cff }, { 0x1b000, 0x1b2ff }, { 0x1f004, 0x1f004 },
+	{ 0x1f0cf, 0x1f0cf }, { 0x1f18e, 0x1f18e }, { 0x1f191, 0x1f19a }, { 0x1f1e6, 0x1f202 },
+	{ 0x1f210, 0x1f23b }, { 0x1f240, 0x1f248 }, { 0x1f250, 0x1f251 }, { 0x1f260, 0x1f265 },
+	{ 0x1f300, 0x1f320 }, { 0x1f32d, 0x1f335 }, { 0x1f337, 0x1f37c }, { 0x1f37e, 0x1f393 },
+	{ 0x1f3a0, 0x1f3ca }, { 0x1f3cf, 0x1f3d3 }, { 0x1f3e0, 0x1f3f0 }, { 0x1f3f4, 0x1f3f4 },
+	{ 0x1f3f8, 0x1f3fa }, { 0x1f400, 0x1f43e }, { 0x1f440, 0x1f440 }, { 0x1f442, 0x1f4fc },
+	{ 0x1f4ff, 0x1f53d }, { 0x1f54b, 0x1f54e }, { 0x1f550, 0x1f567 }, { 0x1f57a, 0x1f57a },
+	{ 0x1f595, 0x1f596 }, { 0x1f5a4, 0x1f5a4 }, { 0x1f5fb, 0x1f64f }, { 0x1f680, 0x1f6c5 },
+	{ 0x1f6cc, 0x1f6cc }, { 0x1f6d0, 0x1f6d2 }, { 0x1f6d5, 0x1f6d7 }, { 0x1f6eb, 0x1f6ec },
+	{ 0x1f6f4, 0x1f6fc }, { 0x1f7e0, 0x1f7eb }, { 0x1f90c, 0x1f93a }, { 0x1f93c, 0x1f945 },
+	{ 0x1f947, 0x1f9ff }, { 0x1fa70, 0x1faff }, { 0x20000, 0x2fffd }, { 0x30000, 0x3fffd },
+};
+
+static int in_table(unsigned int cp, const struct range* t, int n)
+{
+	if (cp < t[0].lo || cp > t[n - 1].hi) return 0;
+	int lo = 0, hi = n - 1;
+	while (lo <= hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (cp > t[mid].hi) lo = mid + 1;
+		else if (cp < t[mid].lo) hi = mid - 1;
+		else return 1;
+	}
+	return 0;
+}
+
+static int cp_width(unsigned int cp)
+{
+	if (cp < 0x300) return 1;
+	// CJK ideographs and Hangul syllables, the bulk of wide text, skip the tables
+	if ((cp >= 0x4e00 && cp <= 0x9fff) || (cp >= 0xac00 && cp <= 0xd7a3)) return 2;
+	if (in_table(cp, zero_width, sizeof(zero_width) / sizeof(zero_width[0]))) return 0;
+	if (in_table(cp, wide, sizeof(wide) / sizeof(wide[0]))) return 2;
+	return 1;
+}
+
+static int regional_indicator(unsigned int cp)
+{
+	return cp >= 0x1f1e6 && cp <= 0x1f1ff;
+}
+
+// 1 when the len bytes at s are all below 0x80, 16 at a time where SSE2 is
+// there and 8 at a time otherwise
+int utf8_is_ascii(const char* s, int len)
+{
+	int i = 0;
+#ifdef __SSE2__
+	for (; i + 64 <= len; i += 64)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*) &s[i]);
+		__m128i b = _mm_loadu_si128((const __m128i*) &s[i + 16]);
+		__m128i c = _mm_loadu_si128((const __m128i*) &s[i + 32]);
+		__m128i d = _mm_loadu_si128((const __m128i*) &s[i + 48]);
+		if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)))) return 0;
+	}
+	for (; i + 16 <= len; i += 16)
+		if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*) &s[i]))) return 0;
+#else
+	for (; i + 8 <= len; i += 8)
+	{
+		uint64_t w;
+		memcpy(&w, &s[i], 8);
+		if (w & 0x8080808080808080ULL) return 0;
+	}
+#endif
+	for (; i < len; ++i)
+		if (s[i] & 0x80) return 0;
+	return 1;
+}
+
+// the character at s in *cp, returns its length. A malformed, overlong or
+// truncated sequence is a single invalid byte.
+int utf8_decode(const char* s, int len, unsigned int* cp)
+{
+	const unsigned char* u = (const unsigned char*) s;
+	unsigned int c = u[0];
+	unsigned int min;
+	int n;
+
+	if (c < 0x80)
+	{
+		*cp = c;
+		return 1;
+	}
+	if (c >= 0xc2 && c < 0xe0) { n = 2; c &= 0x1f; min = 0x80; }
+	else if (c >= 0xe0 && c < 0xf0) { n = 3; c &= 0x0f; min = 0x800; }
+	else if (c >= 0xf0 && c < 0xf5) { n = 4; c &= 0x07; min = 0x10000; }
+	else n = 0;
+
+	*cp = INVALID;
+	if (n == 0 || n > len) return 1;
+	for (int i = 1; i < n; ++i)
+	{
+		if ((u[i] & 0xc0) != 0x80) return 1;
+		c = c << 6 | (u[i] & 0x3f);
+	}
+	if (c < min || c > 0x10ffff || (c >= 0xd800 && c < 0xe000)) return 1;
+	*cp = c;
+	return n;
+}
+
+// length of the grapheme cluster at s, its columns in *width. An invalid
+// byte is a cluster of its own, one column wide.
+int utf8_cluster(const char* s, int len, int* width)
+{
+	const unsigned char* u = (const unsigned char*) s;
+	if (u[0] < 0x80 && (len == 1 || u[1] < 0x80 || u[0] < 0x20))
+	{
+		*width = 1;
+		return 1;
+	}
+
+	unsigned int cp;
+	int n = utf8_decode(s, len, &cp);
+	*width = 1;
+	if (cp == INVALID || (cp >= 0x80 && cp < 0xa0)) return n;
+	*width = cp_width(cp);
+
+	int joiner = cp == 0x200d;
+	int pair = regional_indicator(cp); // two of them make a flag
+	while (n < len && u[n] >= 0x80)
+	{
+		unsigned int next;
+		int m = utf8_decode(&s[n], len - n, &next);
+		if (next == INVALID || n + m > UTF8_CLUSTER_MAX) break;
+		if (pair && regional_indicator(next)) pair = 0;
+		else if (!joiner && cp_width(next) != 0) break;
+		joiner = next == 0x200d;
+		n += m;
+	}
+	return n;
+}
+
+// 0 for what the terminal can't show as it is: invalid bytes and C1 controls
+int utf8_printable(const char* s, int len)
+{
+	unsigned int cp;
+	utf8_decode(s, len, &cp);
+	return cp != INVALID && (cp < 0x80 || cp >= 0xa0);
+}
+
+// moves *at past the tab or cluster there, returns its columns at column col
+int utf8_step(const char* s, int len, int* at, int col)
+{
+	if (s[*at] == '\t')
+	{
+		++*at;
+		return TAB_LEN - col % TAB_LEN;
+	}
+	int width;
+	*at += utf8_cluster(&s[*at], len - *at, &width);
+	return width;
+}
+
+// skips the continuation bytes at `at` of a character that starts before it,
+// for walks starting at an arbitrary offset such as a long-line chunk
+int utf8_resync(const char* s, int len, int at)
+{
+	if (at >= len || (s[at] & 0xc0) != 0x80) return at;
+	for (int back = 1; back <= 3 && back <= at; ++back)
+	{
+		if ((s[at - back] & 0xc0) == 0x80) continue;
+		unsigned int cp;
+		int n = utf8_decode(&s[at - back], len - at + back, &cp);
+		return cp != INVALID && n > back ? at - back + n : at;
+	}
+	return at;
+}
+
+// start of the cluster after the one at `at`
+int utf8_next(const char* s, int len, int at)
+{
+	if (at >= len) return len;
+	int width;
+	return at + utf8_cluster(&s[at], len - at, &width);
+}
+
+// start of the cluster before `at`, found walking forward from a little
+// before it since clusters can't be told apart backwards
+int utf8_prev(const char* s, int len, int at)
+{
+	if (at <= 0) return 0;
+	if (!(s[at - 1] & 0x80)) return at - 1;
+
+	int p = utf8_resync(s, len, at > 2 * UTF8_CLUSTER_MAX ? at - 2 * UTF8_CLUSTER_MAX : 0);
+	for (;;)
+	{
+		int q = utf8_next(s, len, p);
+		if (q >= at) return p;
+		p = q;
+	}
+}
+
+// column stops of a row, see utf8.h
+
+struct col_stop
+{
+	int cx;
+	int ro; // offset in render
+	int col;
+};
+
+struct row_cols
+{
+	int n;
+	int cap;
+	struct col_stop s[];
+};
+
+static struct row_cols* reserve(erow* row, int n)
+{
+	struct row_cols* c = row->cols;
+	if (c && c->cap >= n) return c;
+	long long before = c ? (long long) (sizeof(struct row_cols) + sizeof(struct col_stop) * c->cap) : 0;
+	c = realloc(c, sizeof(struct row_cols) + sizeof(struct col_stop) * n);
+	mem_add(MEM_RENDER, (long long) (sizeof(struct row_cols) + sizeof(struct col_stop) * n) - before);
+	c->cap = n;
+	row->cols = c;
+	return c;
+}
+
+// lays out the render of a row, which rowmem_layout made room for, and its
+// column stops; returns the render size
+int utf8_render(erow* row)
+{
+	struct row_cols* c = reserve(row, row->size / UTF8_STOP + 1);
+	int n = 0;
+	int cx = 0, o = 0, col = 0;
+	while (cx < row->size)
+	{
+		if (cx >= n * UTF8_STOP)
+		{
+			c->s[n].cx = cx;
+			c->s[n].ro = o;
+			c->s[n].col = col;
+			++n;
+		}
+		int at = cx;
+		if (!(row->chars[at] & 0x80) && row->chars[at] != '\t' && (at + 1 == row->size || !(row->chars[at + 1] & 0x80)))
+		{
+			// an ASCII character not followed by a mark, most of them
+			row->render[o++] = row->chars[cx++];
+			++col;
+			continue;
+		}
+		int width = utf8_step(row->chars, row->size, &cx, col);
+		if (row->chars[at] == '\t')
+		{
+			memset(&row->render[o], ' ', width);
+			o += width;
+		}
+		else
+		{
+			memcpy(&row->render[o], &row->chars[at], cx - at);
+			o += cx - at;
+		}
+		col += width;
+	}
+	if (n == 0)
+	{
+		c->s[0].cx = c->s[0].ro = c->s[0].col = 0;
+		n = 1;
+	}
+	c->n = n;
+	row->render[o] = '\0';
+	return o;
+}
+
+// last stop whose field at `off` is at or before v
+static struct col_stop* find_stop(struct row_cols* c, size_t off, int v)
+{
+	int lo = 0, hi = c->n - 1;
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if (*(int*) ((char*) &c->s[mid] + off) <= v) lo = mid;
+		else hi = mid - 1;
+	}
+	return &c->s[lo];
+}
+
+int utf8_cx_to_rx(erow* row, int cx)
+{
+	struct col_stop* s = find_stop(row->cols, offsetof(struct col_stop, cx), cx);
+	int j = s->cx;
+	int col = s->col;
+	while (j < cx && j < row->size) col += utf8_step(row->chars, row->size, &j, col);
+	return col;
+}
+
+int utf8_rx_to_cx(erow* row, int rx)
+{
+	struct col_stop* s = find_stop(row->cols, offsetof(struct col_stop, col), rx);
+	int j = s->cx;
+	int col = s->col;
+	while (j < row->size)
+	{
+		int at = j;
+		col += utf8_step(row->chars, row->size, &j, col);
+		if (col > rx) return at;
+	}
+	return j;
+}
+
+// chars offset of the cluster holding render offset ro
+int utf8_ro_to_cx(erow* row, int ro)
+{
+	struct col_stop* s = find_stop(row->cols, offsetof(struct col_stop, ro), ro);
+	int j = s->cx;
+	int o = s->ro;
+	int col = s->col;
+	while (j < row->size)
+	{
+		int at = j;
+		int width = utf8_step(row->chars, row->size, &j, col);
+		col += width;
+		o += row->chars[at] == '\t' ? width : j - at;
+		if (o > ro) return at;
+	}
+	return j;
+}
+
+// offset in render of the cluster holding column rx, when render holds len
+// bytes starting at column base (a long-line window) or the whole row.
+// *cut is how many columns of that cluster lie left of rx.
+int utf8_render_at(erow* row, int len, int base, int rx, int* cut)
+{
+	int o = 0;
+	int col = base;
+	if (row->cols && !row->wide)
+	{
+		struct col_stop* s = find_stop(row->cols, offsetof(struct col_stop, col), rx);
+		o = s->ro;
+		col = s->col;
+	}
+
+	*cut = 0;
+	while (o < len)
+	{
+		int width;
+		int n = utf8_cluster(&row->render[o], len - o, &width);
+		if (col + width > rx)
+		{
+			*cut = rx - col;
+			break;
+		}
+		col += width;
+		o += n;
+	}
+	return o;
+}
+
+void utf8_free(erow* row)
+{
+	struct row_cols* c = row->cols;
+	if (!c) return;
+	mem_add(MEM_RENDER, -(long long) (sizeof(struct row_cols) + sizeof(struct col_stop) * c->cap));
+	free(c);
+	row->cols = NULL;
+}
@@ -0,0 +1,34 @@
+#ifndef UTF8_H_
+#define UTF8_H_
+
+#include "editor.h"
+
+// UTF-8 text. The cursor moves by grapheme clusters, a character together
+// with the combining marks, joiners and modifiers that follow it, and a
+// cluster takes the columns of its first character (0 for none, 2 for wide
+// ones). Rows found pure ASCII by a vectorized scan keep one render byte per
+// column and no extra state. Other rows carry a list of column stops, one
+// every UTF8_STOP chars, so mapping between chars, render bytes and columns
+// walks at most that far.
+
+#define UTF8_STOP 64
+#define UTF8_CLUSTER_MAX 32 // bytes, a longer cluster is cut in pieces
+
+int utf8_is_ascii(const char* s, int len);
+int utf8_decode(const char* s, int len, unsigned int* cp);
+int utf8_cluster(const char* s, int len, int* width);
+int utf8_printable(const char* s, int len);
+int utf8_step(const char* s, int len, int* at, int col);
+int utf8_resync(const char* s, int len, int at);
+int utf8_next(const char* s, int len, int at);
+int utf8_prev(const char* s, int len, int at);
+
+// rows that aren't pure ASCII (row->cols is set)
+int utf8_render(erow* row);
+int utf8_cx_to_rx(erow* row, int cx);
+int utf8_rx_to_cx(erow* row, int rx);
+int utf8_ro_to_cx(erow* row, int ro);
+int utf8_render_at(erow* row, int len, int base, int rx, int* cut);
+void utf8_free(erow* row);
+
+#endif